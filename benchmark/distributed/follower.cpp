@@ -17,6 +17,7 @@
 #include <chrono>
 using namespace std::chrono_literals;
 #include <numeric>
+#include <algorithm>
 
 #include "common/boost_log_helper.hpp"
 #include <boost/program_options.hpp>
@@ -39,6 +40,8 @@ int main(const int argc, const char **argv)
     filesystem::path ycsb_run_path = cur_src_dir / "workload" / "run.ycsb";
     string log_level;
     unsigned client_id;
+    bool coalesce_reads;
+    unsigned mux_qps;
 
     {
         namespace po = boost::program_options;
@@ -53,6 +56,11 @@ int main(const int argc, const char **argv)
             ("id", po::value(&client_id)->required(), "specify client ID")
             ("ycsb-load", po::value(&ycsb_load_path), "YCSB load output")
             ("ycsb-run", po::value(&ycsb_run_path), "YCSB run output")
+            ("coalesce-reads", po::bool_switch(&coalesce_reads),
+                "Let concurrent reads of the same key share one RDMA READ.")
+            ("mux-qps", po::value(&mux_qps)->default_value(0),
+                "Multiplex all threads onto this many QPs per server, 0 for "
+                "each thread connecting on its own.")
             ;
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -124,9 +132,19 @@ int main(const int argc, const char **argv)
     volatile bool start_flag = false, stop_flag = false;
 
     vector<unsigned long long> thread_completed_ops(thread_nr_to_test, 0);
+    /* time each client took to set up, i.e. fetch cluster map and connect */
+    vector<std::chrono::microseconds> thread_startup_time(thread_nr_to_test);
+    const auto read_flights = coalesce_reads ?
+        make_shared<gestalt::SingleFlight>() : nullptr;
+    const auto qp_mux = mux_qps ?
+        make_shared<gestalt::QpMux>(client_id * 1000 + 999, mux_qps) : nullptr;
     const auto thread_test_fn = [&] (const unsigned thread_id) {
         auto &completed_ops = thread_completed_ops.at(thread_id);
-        gestalt::Client client(config_path, client_id * 1000 + thread_id);
+        const auto startup_begin = std::chrono::steady_clock::now();
+        gestalt::Client client(config_path, client_id * 1000 + thread_id, qp_mux);
+        thread_startup_time.at(thread_id) = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - startup_begin);
+        client.read_flights = read_flights;
 
         while (!start_flag)
             [[unlikely]] ;
@@ -231,6 +249,15 @@ int main(const int argc, const char **argv)
 
     BOOST_LOG_TRIVIAL(info) << "total_completed_ops "
         << std::accumulate(thread_completed_ops.begin(), thread_completed_ops.end(), 0ull);
+    BOOST_LOG_TRIVIAL(info) << "client_startup_us max "
+        << std::max_element(thread_startup_time.begin(), thread_startup_time.end())->count()
+        << " avg " << std::accumulate(thread_startup_time.begin(), thread_startup_time.end(),
+            0us).count() / thread_nr_to_test;
+    if (read_flights)
+        BOOST_LOG_TRIVIAL(info) << "coalesced_reads " << read_flights->coalesced;
+    if (qp_mux)
+        BOOST_LOG_TRIVIAL(info) << "mux_posted " << qp_mux->posted
+            << " post_calls " << qp_mux->post_calls;
 
 
     return EXIT_SUCCESS;
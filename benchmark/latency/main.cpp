@@ -144,8 +144,11 @@ int main(const int argc, const char **argv)
 
     /* setup client */
 
+    const auto startup_begin = std::chrono::steady_clock::now();
     gestalt::Client client(config_path, client_id);
-    BOOST_LOG_TRIVIAL(info) << "client successfully setup";
+    BOOST_LOG_TRIVIAL(info) << "client successfully setup in "
+        << std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - startup_begin).count() << " us";
 
     /* load, and heat up client locator cache */
     /** @note insert collisions will be ignored */
@@ -8,10 +8,13 @@
 #include <isa-l/crc.h>
 #include <filesystem>
 #include <cassert>
+#include <iomanip>
 #include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
 #include "ycsb.h"
 #include "ycsb_parser.hpp"
 #include "headless_hashtable.hpp"
+#include "spec/dataslot.hpp"
 
 
 namespace {
@@ -81,6 +84,47 @@ struct __attribute__ ((packed)) entry {
     }
 };
 static_assert(sizeof(entry) == 128 + 1/*for empty value struct*/);
+
+/**
+ * Fill rate of a simulated cluster, where each server is a table of `slots`
+ * slots, and keys are placed as gestalt::Client does.
+ * @param trace keys to insert
+ * @param nr_servers
+ * @param slots slots per server
+ * @param independent use independent placement and slot hashes, otherwise
+ *      the legacy single CRC32 for both
+ * @param search linear search length, 1 for no search (current client)
+ * @return ratio of successfully inserted keys
+ */
+double simulate_cluster_fill(
+    const smdsbz::ycsb_parser::trace &trace,
+    unsigned nr_servers, size_t slots, bool independent, size_t search)
+{
+    std::vector<std::vector<bool>> occupied(nr_servers, std::vector<bool>(slots));
+    size_t inserted = 0;
+    for (const auto &t : trace) {
+        uint64_t placement, slot;
+        if (independent) {
+            const auto d = gestalt::dataslot_key_view(t.okey.c_str()).digest();
+            placement = d.placement;
+            slot = d.slot;
+        }
+        else {
+            placement = slot = crc32_iscsi(
+                (unsigned char*)t.okey.c_str(), t.okey.length(), 0x114514);
+        }
+        auto &server = occupied[placement % nr_servers];
+        for (size_t off = 0; off < search; off++) {
+            auto cell = server[(slot + off) % slots];
+            if (cell)
+                continue;
+            cell = true;
+            ++inserted;
+            break;
+        }
+    }
+    return 1. * inserted / trace.size();
+}
 }
 
 int main(const int argc, const char **argv)
@@ -89,6 +133,61 @@ int main(const int argc, const char **argv)
     auto workload_path = std::filesystem::path(YCSB_WORKLOAD_DIR) / "workloada";
     auto load_dump_path = std::filesystem::path(".") / "load.txt";
 
+    /**
+     * * table - single table fill factor experiment
+     * * cluster - compare fill factor of shared and independent key hashes
+     *      across cluster sizes
+     */
+    std::string mode;
+    {
+        namespace po = boost::program_options;
+        po::options_description desc;
+        desc.add_options()
+            ("mode", po::value(&mode)->default_value("table"),
+                "Experiment to run, \"table\" or \"cluster\".")
+            ;
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+
+    if (mode == "cluster") {
+        /* NOTE: power of 2 so that legacy placement suffers from shared
+            residue whenever server count is even */
+        const size_t SLOTS = 1 << 16;
+        const float FILL_RATE = .75;
+        const std::vector<unsigned> cluster_sizes{1, 2, 3, 4, 6, 8, 12, 16};
+        const size_t TESTSET_SIZE = FILL_RATE * SLOTS * cluster_sizes.back();
+
+        yp::dump_load(YCSB_BIN,
+            {{"workload", workload_path.string()}, {"fieldcount", "1"},
+             {"recordcount", std::to_string(TESTSET_SIZE)}},
+            load_dump_path);
+        yp::trace full_trace;
+        yp::parse(load_dump_path, full_trace, /*with_value*/false);
+
+        BOOST_LOG_TRIVIAL(info) << "experiment with " << SLOTS
+            << " slots per server, fill rate " << FILL_RATE;
+        BOOST_LOG_TRIVIAL(info) << std::left << std::fixed << std::setprecision(2)
+            << std::setw(10) << "servers"
+            << std::setw(16) << "shared (%)"
+            << std::setw(16) << "indep. (%)"
+            << std::setw(20) << "shared+search (%)"
+            << std::setw(20) << "indep.+search (%)";
+        for (const auto n : cluster_sizes) {
+            const yp::trace trace(full_trace.begin(),
+                full_trace.begin() + std::min<size_t>(FILL_RATE * SLOTS * n, full_trace.size()));
+            const auto search = gestalt::params::hht_search_length;
+            BOOST_LOG_TRIVIAL(info)
+                << std::setw(10) << n
+                << std::setw(16) << 100. * simulate_cluster_fill(trace, n, SLOTS, false, 1)
+                << std::setw(16) << 100. * simulate_cluster_fill(trace, n, SLOTS, true, 1)
+                << std::setw(20) << 100. * simulate_cluster_fill(trace, n, SLOTS, false, search)
+                << std::setw(20) << 100. * simulate_cluster_fill(trace, n, SLOTS, true, search);
+        }
+        return 0;
+    }
+
     /* unittesting my YCSB parser */
     {
         BOOST_LOG_TRIVIAL(debug) << "unittest: YCSB parser";
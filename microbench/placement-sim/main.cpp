@@ -0,0 +1,206 @@
+/**
+ * @file
+ * Simulate placement engines on membership changes
+ *
+ * For a key set and a cluster of N servers, reports for each engine the
+ * fraction of keys whose primary (or any replica) moves when one server is
+ * added, the last server is removed, or a server in the middle of the rank is
+ * removed, along with per-server load balance of the initial placement.
+ *
+ * With `--heterogeneous`, servers get 1x to 4x capacity, load is measured as
+ * load factor (keys over capacity), and capacity-weighted rendezvous placement
+ * is simulated alongside.
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+#include "ycsb.h"
+#include "ycsb_parser.hpp"
+#include "spec/dataslot.hpp"
+#include "internal/placement.hpp"
+
+
+namespace {
+
+using namespace gestalt;
+using acting_sets = std::vector<std::vector<unsigned>>;
+
+/** capacity of server #id, in arbitrary unit */
+double capacity_of(unsigned id, bool heterogeneous)
+{
+    return heterogeneous ? 1 + (id - 1) % 4 : 1;
+}
+
+acting_sets place_all(placement::Engine e, const std::vector<uint32_t> &khx,
+    const std::vector<unsigned> &rank, unsigned r, bool weighted, bool heterogeneous)
+{
+    std::vector<double> weights;
+    for (const auto &id : rank)
+        weights.push_back(capacity_of(id, heterogeneous));
+
+    acting_sets out(khx.size());
+    for (size_t i = 0; i < khx.size(); i++)
+        placement::place(e, khx[i], rank, r, [] (unsigned) { return true; }, out[i],
+            weighted ? &weights : nullptr);
+    return out;
+}
+
+struct moved_fraction {
+    /** keys whose primary changed */
+    double primary;
+    /** keys with any replica changed */
+    double any;
+};
+
+moved_fraction compare(const acting_sets &before, const acting_sets &after)
+{
+    size_t primary = 0, any = 0;
+    for (size_t i = 0; i < before.size(); i++) {
+        primary += before[i].at(0) != after[i].at(0);
+        any += before[i] != after[i];
+    }
+    return {1. * primary / before.size(), 1. * any / before.size()};
+}
+
+struct balance {
+    /** most loaded server over average, by load factor */
+    double max_over_avg;
+    /** coefficient of variation of per-server load factor */
+    double cv;
+};
+
+balance load_balance(const acting_sets &sets, const std::vector<unsigned> &rank,
+    bool heterogeneous)
+{
+    std::vector<double> load(*std::max_element(rank.begin(), rank.end()) + 1, 0);
+    for (const auto &s : sets)
+        for (const auto &id : s)
+            load[id]++;
+    double sum = 0, sq = 0, mx = 0;
+    for (const auto &id : rank) {
+        const double f = load[id] / capacity_of(id, heterogeneous);
+        sum += f;
+        sq += f * f;
+        mx = std::max(mx, f);
+    }
+    const double avg = sum / rank.size();
+    return {mx / avg, std::sqrt(sq / rank.size() - avg * avg) / avg};
+}
+
+}   /* anonymous namespace */
+
+
+int main(const int argc, const char **argv)
+{
+    namespace yp = smdsbz::ycsb_parser;
+    auto workload_path = std::filesystem::path(YCSB_WORKLOAD_DIR) / "workloada";
+    std::filesystem::path load_dump_path;
+    unsigned nr_servers, nr_replicas;
+    size_t nr_keys;
+    bool heterogeneous;
+    {
+        namespace po = boost::program_options;
+        po::options_description desc;
+        desc.add_options()
+            ("servers", po::value(&nr_servers)->default_value(16),
+                "Number of servers before membership change.")
+            ("replicas", po::value(&nr_replicas)->default_value(2),
+                "Replica count.")
+            ("keys", po::value(&nr_keys)->default_value(1e6),
+                "Number of keys, generated with YCSB.")
+            ("ycsb-load", po::value(&load_dump_path),
+                "Use keys of this YCSB load output instead of generating.")
+            ("heterogeneous", po::bool_switch(&heterogeneous),
+                "Servers have 1x to 4x capacity.")
+            ;
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    if (nr_servers < 2 || nr_replicas < 1 || nr_replicas >= nr_servers) {
+        BOOST_LOG_TRIVIAL(fatal) << "need 1 <= replicas < servers, and at least 2 servers";
+        return EXIT_FAILURE;
+    }
+
+    if (load_dump_path.empty()) {
+        load_dump_path = std::filesystem::path(".") / "load.txt";
+        yp::dump_load(YCSB_BIN,
+            {{"workload", workload_path.string()}, {"fieldcount", "1"},
+             {"recordcount", std::to_string(nr_keys)}},
+            load_dump_path);
+    }
+    std::vector<uint32_t> khx;
+    {
+        yp::trace trace;
+        yp::parse(load_dump_path, trace, /*with_value*/false);
+        khx.reserve(trace.size());
+        for (const auto &t : trace)
+            khx.push_back(dataslot_key_view(t.okey.c_str()).digest().placement);
+    }
+    BOOST_LOG_TRIVIAL(info) << "simulating " << khx.size() << " keys on "
+        << nr_servers << " servers, " << nr_replicas << " replicas, ideal moved "
+        << "fraction on a single change is ~" << std::fixed << std::setprecision(2)
+        << 100. / nr_servers << "%";
+
+    /* server IDs start from 1, as allocated by monitor */
+    std::vector<unsigned> rank(nr_servers);
+    std::iota(rank.begin(), rank.end(), 1);
+    auto grown = rank;
+    grown.push_back(nr_servers + 1);
+    auto shrunk_tail = rank;
+    shrunk_tail.pop_back();
+    auto shrunk_mid = rank;
+    shrunk_mid.erase(shrunk_mid.begin() + nr_servers / 2);
+
+    BOOST_LOG_TRIVIAL(info) << std::left << std::fixed << std::setprecision(2)
+        << std::setw(12) << "engine"
+        << std::setw(14) << "max/avg load"
+        << std::setw(10) << "load cv"
+        << std::setw(22) << "add: prim/any (%)"
+        << std::setw(22) << "rm tail: prim/any (%)"
+        << std::setw(22) << "rm mid: prim/any (%)";
+    struct variant {
+        placement::Engine e;
+        bool weighted;
+    };
+    std::vector<variant> variants{
+        {placement::Engine::modulo, false},
+        {placement::Engine::jump, false},
+        {placement::Engine::rendezvous, false},
+    };
+    if (heterogeneous)
+        variants.push_back({placement::Engine::rendezvous, true});
+    for (const auto &[e, w] : variants) {
+        const auto run = [&, e = e, w = w] (const std::vector<unsigned> &rk) {
+            return place_all(e, khx, rk, nr_replicas, w, heterogeneous);
+        };
+        const auto base = run(rank);
+        const auto b = load_balance(base, rank, heterogeneous);
+        const auto add = compare(base, run(grown));
+        const auto rmt = compare(base, run(shrunk_tail));
+        const auto rmm = compare(base, run(shrunk_mid));
+        const auto fmt = [] (const moved_fraction &m) {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(2)
+                << 100. * m.primary << " / " << 100. * m.any;
+            return os.str();
+        };
+        BOOST_LOG_TRIVIAL(info) << std::left << std::fixed << std::setprecision(3)
+            << std::setw(12) << (std::string(placement::engine_name(e)) + (w ? "-w" : ""))
+            << std::setw(14) << b.max_over_avg
+            << std::setw(10) << b.cv
+            << std::setw(22) << fmt(add)
+            << std::setw(22) << fmt(rmt)
+            << std::setw(22) << fmt(rmm);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file
+ * Time formatting the slot table at server startup
+ *
+ * Maps a file-backed stand-in of the PMem device, and formats it with the
+ * legacy one-by-one `HeadlessHashTable::clear()` followed by a full msync, and
+ * with parallel non-temporal formatting at each of the given thread counts,
+ * then times the recovery scan of a warm restart over the formatted table.
+ *
+ * Place the file on a DAX-mounted filesystem to measure real PMem, elsewhere
+ * it is page cache and msync-bound.
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <chrono>
+#include <iomanip>
+#include <cstring>
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+#include <libpmem.h>
+#include "common/size_literals.hpp"
+#include "misc/numa.hpp"
+#include "spec/dataslot.hpp"
+#include "headless_hashtable.hpp"
+#include "table_format.hpp"
+
+
+int main(const int argc, const char **argv)
+{
+    using namespace gestalt;
+    std::filesystem::path path;
+    size_t size_mb;
+    std::vector<unsigned> threads;
+    int numa;
+    bool legacy;
+    {
+        namespace po = boost::program_options;
+        po::options_description desc;
+        desc.add_options()
+            ("path", po::value(&path)->default_value("./table-format.img"),
+                "File standing in for the device, created if missing.")
+            ("size", po::value(&size_mb)->default_value(4096),
+                "Size of the device in MiB.")
+            ("threads", po::value(&threads)->multitoken()
+                    ->default_value(std::vector<unsigned>{1, 2, 4, 8}, "1 2 4 8"),
+                "Thread counts of parallel formatting.")
+            ("numa", po::value(&numa)->default_value(-1),
+                "Pin threads to CPUs of this NUMA node, -1 for any CPU.")
+            ("legacy", po::bool_switch(&legacy),
+                "Also time the legacy one-by-one clear().")
+            ;
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+
+    size_t mapped_len;
+    int is_pmem;
+    void *buf = pmem_map_file(path.c_str(), size_mb * 1_M, PMEM_FILE_CREATE,
+        0600, &mapped_len, &is_pmem);
+    if (!buf) {
+        BOOST_LOG_TRIVIAL(fatal) << "cannot map " << path << ": " << pmem_errormsg();
+        return EXIT_FAILURE;
+    }
+    const size_t nr_slots = mapped_len / sizeof(dataslot);
+    const auto cpus = misc::numa::get_cpus(numa);
+    BOOST_LOG_TRIVIAL(info) << "formatting " << nr_slots << " slots ("
+        << mapped_len / 1_M << " MiB) on " << path
+        << (is_pmem ? ", PMem" : ", not PMem, msync per chunk") << ", "
+        << (cpus.empty() ? "any CPU" : std::to_string(cpus.size()) + " NUMA-local CPUs");
+
+    const auto report = [&] (const std::string &name, auto &&fn) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        BOOST_LOG_TRIVIAL(info) << std::left << std::fixed << std::setprecision(3)
+            << std::setw(16) << name
+            << std::setw(12) << elapsed.count() << " s "
+            << std::setw(12) << mapped_len / 1_M / elapsed.count() << " MiB/s";
+    };
+
+    if (legacy)
+        report("legacy", [&] {
+            HeadlessHashTable<dataslot> table(static_cast<dataslot*>(buf), nr_slots);
+            table.clear();
+            pmem_msync(buf, mapped_len);
+        });
+    for (const auto &t : threads) {
+        table_format_options opt;
+        opt.nr_threads = t;
+        opt.cpus = cpus;
+        report("parallel x" + std::to_string(t), [&] {
+            if (int r = format_table(static_cast<dataslot*>(buf), nr_slots, is_pmem, opt); r)
+                BOOST_LOG_TRIVIAL(error) << "format_table(): " << std::strerror(-r);
+        });
+    }
+
+    {
+        table_format_options opt;
+        opt.nr_threads = threads.empty() ? 0 : threads.back();
+        opt.cpus = cpus;
+        table_recovery_stats stats;
+        vector<uint64_t> occupancy((nr_slots + 63) / 64);
+        report("recover x" + std::to_string(opt.nr_threads), [&] {
+            if (int r = recover_table(static_cast<dataslot*>(buf), nr_slots,
+                    /*gen*/1, is_pmem, opt, stats, occupancy.data(), {}); r)
+                BOOST_LOG_TRIVIAL(error) << "recover_table(): " << std::strerror(-r);
+        });
+    }
+
+    pmem_unmap(buf, mapped_len);
+    return EXIT_SUCCESS;
+}
@@ -7,12 +7,12 @@
 #include <algorithm>
 #include <sstream>
 #include <thread>
+#include <cstring>
 
 #include <boost/property_tree/ini_parser.hpp>
 #include "common/boost_log_helper.hpp"
 
 #include "client.hpp"
-#include "./ops/all.hpp"
 #include "optim.hpp"
 
 
@@ -20,23 +20,22 @@ namespace gestalt {
 
 using namespace std;
 
-using ReadOp = ops::Read;
-using LockOp = ops::Lock; using UnlockOp = ops::Unlock;
-using WriteOp = ops::WriteAPM;
-
-
-Client::Client(const filesystem::path &config_path, unsigned _id) :
+ClientBase::ClientBase(const filesystem::path &config_path, unsigned _id,
+        shared_ptr<QpMux> mux, const string &bucket_name) :
     id(_id),
     /* the following contexts are filled later in this constructor */
-    node_mapper(), ibvctx(), session_pool()
+    node_mapper(), ibvctx(), qp_mux(std::move(mux)), session_pool()
 {
     {
         ifstream f(config_path);
         boost::property_tree::read_ini(f, config);
     }
-    num_replicas = config.get_child("global.num_replicas").get_value<unsigned>();
-    if (!num_replicas)
-        throw std::invalid_argument("num_replicas");
+    bucket = gestalt::bucket::find(gestalt::bucket::parse(config), bucket_name.empty()
+        ? config.get<string>("client.bucket", gestalt::bucket::default_name)
+        : bucket_name);
+    num_replicas = bucket.num_replicas;
+    BOOST_LOG_TRIVIAL(debug) << "opening bucket " << bucket.name << ", "
+        << num_replicas << " replica(s)";
 
     node_mapper = DataMapper(this);
     BOOST_LOG_TRIVIAL(debug) << "DataMapper initialized: "
@@ -51,9 +50,15 @@ Client::Client(const filesystem::path &config_path, unsigned _id) :
         }
         ibvctx.chosen = ibvctx.devices[0];
 
-        ibvpd.reset(ibv_alloc_pd(ibvctx.chosen));
-        if (!ibvpd)
-            boost_log_errno_throw(ibv_alloc_pd);
+        /* [mux] buffers have to be in the same PD as the shared QPs */
+        if (qp_mux)
+            ibvpd = qp_mux->pd();
+        else {
+            ibv_pd *pd = ibv_alloc_pd(ibvctx.chosen);
+            if (!pd)
+                boost_log_errno_throw(ibv_alloc_pd);
+            ibvpd.reset(pd, __IbvPdDeleter());
+        }
     }
 
     /* [opt::batched_poll] get shared cq */
@@ -66,15 +71,118 @@ Client::Client(const filesystem::path &config_path, unsigned _id) :
     session_pool = RDMAConnectionPool(this);
     BOOST_LOG_TRIVIAL(debug) << "RDMAConnectionPool initialized";
 
+    weigh_servers();
+    node_mapper.save_cache();
+
+    if (config.get("client.watch_clustermap", false))
+        node_mapper.watch();
+}
+
+void ClientBase::weigh_servers()
+{
+    /* by the extent of the bucket on each server, as registered to monitor,
+        never by MRs of connected servers, so that every client places keys
+        alike whatever it is connected to, and none waits on connecting */
+    unordered_map<unsigned, size_t> capacity;
+    for (const auto &[id, s] : node_mapper.server_map)
+        capacity.insert({id, s.capacity / sizeof(dataslot)});
+    node_mapper.weigh(capacity);
+}
+
+void ClientBase::refresh_clustermap()
+{
+    /* placement before the change, to find out affected keys */
+    const auto before = node_mapper.view();
+
+    DataMapper::update u;
+    if (!node_mapper.apply_update(u))
+        [[unlikely]] return;
+
+    /* servers removed from cluster map are already leaving */
+    for (const auto &id : u.removed)
+        session_pool.disconnect(id, /*graceful*/false);
+    if (!session_pool.is_lazy())
+        session_pool.connect_all(u.added);
+    weigh_servers();
+    node_mapper.save_cache();
+
+    /* only keys whose acting set changed need to be located again */
+    const auto after = node_mapper.view();
+    const auto moved = [&] (const okey &key, const auto &) {
+        const auto hx = key.digest().placement;
+        return DataMapper::map(before, hx, num_replicas)
+            != DataMapper::map(after, hx, num_replicas);
+    };
+    const auto n = normal_placements.erase_if(moved)
+        + abnormal_placements.erase_if(moved);
+    collision_set.erase_if(moved);
+    BOOST_LOG_TRIVIAL(debug) << "cluster map epoch " << u.epoch << " applied, "
+        << n << " locator(s) invalidated";
+}
+
+template <class Traits>
+BasicClient<Traits>::BasicClient(const filesystem::path &config_path, unsigned _id,
+        shared_ptr<QpMux> mux, const string &bucket_name) :
+    ClientBase(config_path, _id, std::move(mux), bucket_name)
+{
+    if constexpr (traits::num_replicas) {
+        if (num_replicas != traits::num_replicas) {
+            BOOST_LOG_TRIVIAL(fatal) << "client built for " << traits::num_replicas
+                << " replicas, but bucket has " << num_replicas;
+            throw std::invalid_argument("num_replicas");
+        }
+    }
+
+    /* [opt::write_back] coalesce overwrites on the same key */
+    if (const auto window = config.get("client.write_back_window_us", 0u); window) {
+        const auto staleness = config.get("client.write_back_max_staleness_us", 10 * window);
+        const auto entries = config.get("client.write_back_max_entries", size_t(1024));
+        if (staleness < window)
+            throw std::invalid_argument("write_back_max_staleness_us");
+        write_back.reset(new WriteBackBuffer(
+            std::chrono::microseconds(window), std::chrono::microseconds(staleness),
+            entries));
+        BOOST_LOG_TRIVIAL(debug) << "write-back enabled, window " << window
+            << "us, max staleness " << staleness << "us, max entries " << entries;
+    }
+
+    /* [opt::key_filter] skip Reading keys that servers tell absent */
+    if (config.get("client.key_filter", false)) {
+        filter_cache.reset(new decltype(filter_cache)::element_type());
+        filter_ttl = std::chrono::microseconds(config.get("client.key_filter_ttl_us", 1000u));
+        BOOST_LOG_TRIVIAL(debug) << "key filter enabled, blocks cached for "
+            << filter_ttl.count() << "us";
+    }
+
     /* initialize structured RDMA ops */
-    read_op.reset(new ReadOp(ibvpd.get(), ibvscq.get()));
-    lock_op.reset(new LockOp(ibvpd.get(), ibvscq.get()));
-    unlock_op.reset(new UnlockOp(ibvpd.get(), ibvscq.get()));
-    write_op.reset(new WriteOp(ibvpd.get(), ibvscq.get()));
+    read_op.reset(new read_op_type(ibvpd.get(), ibvscq.get()));
+    lock_op.reset(new lock_op_type(ibvpd.get(), ibvscq.get()));
+    unlock_op.reset(new unlock_op_type(ibvpd.get(), ibvscq.get()));
+    write_op.reset(new write_op_type(ibvpd.get(), ibvscq.get()));
+    claim_op.reset(new claim_op_type(ibvpd.get(), ibvscq.get()));
+    filter_op.reset(new filter_op_type(ibvpd.get(), ibvscq.get()));
+    if (qp_mux) {
+        read_op->multiplex(qp_mux.get());
+        lock_op->multiplex(qp_mux.get());
+        unlock_op->multiplex(qp_mux.get());
+        write_op->multiplex(qp_mux.get());
+        claim_op->multiplex(qp_mux.get());
+        filter_op->multiplex(qp_mux.get());
+    }
 }
 
 
-Client::oloc Client::map(const okey &key, bool &need_search) const
+template <class Traits>
+BasicClient<Traits>::~BasicClient()
+{
+    if (int r = flush(); r)
+        [[unlikely]] BOOST_LOG_TRIVIAL(error) << "lost buffered writes on teardown: "
+            << std::strerror(-r);
+}
+
+
+template <class Traits>
+ClientBase::oloc BasicClient<Traits>::map(const okey &key, bool &need_search)
 {
     if (abnormal_placements.exist(key)) {
         [[unlikely]] need_search = false;
@@ -87,14 +195,19 @@ Client::oloc Client::map(const okey &key, bool &need_search) const
         need_search = true;
     }
 
-    const auto hx = key.hash();
-    const auto nodes = node_mapper.map(hx, num_replicas);
+    const auto hx = key.digest();
+    auto nodes = node_mapper.map(hx.placement, replicas());
+    /* [lazy] servers failing to connect are marked out, map again */
+    while (session_pool.ensure(nodes))
+        [[unlikely]] nodes = node_mapper.map(hx.placement, replicas());
 
-    oloc ret; ret.reserve(num_replicas);
+    oloc ret; ret.reserve(replicas());
     for (const auto &sid : nodes) {
-        const auto &s = session_pool.pool.at(sid);
-        const uintptr_t start_addr = s.addr + (hx % s.slots) * sizeof(dataslot);
-        ret.push_back({sid, start_addr, sizeof(dataslot)});
+        /* keys of the bucket only land in its extent on the server */
+        const auto &n = node_mapper.server_map.at(sid);
+        const uintptr_t start_addr = session_pool.pool.at(sid).addr + n.bucket_offset
+            + (hx.slot % (n.capacity / sizeof(slot_type))) * sizeof(slot_type);
+        ret.push_back({sid, start_addr, sizeof(slot_type)});
     }
 
 #if 0
@@ -111,7 +224,108 @@ Client::oloc Client::map(const okey &key, bool &need_search) const
     return ret;
 }
 
-int Client::probe_and_justify_oloc(const okey &key, oloc &ls)
+template <class Traits>
+ClientBase::oloc BasicClient<Traits>::displace(const oloc &home, size_t d) const
+{
+    oloc ret; ret.reserve(home.size());
+    for (const auto &r : home) {
+        const auto &m = session_pool.pool.at(r.id);
+        const auto &n = node_mapper.server_map.at(r.id);
+        const size_t first = n.bucket_offset / sizeof(slot_type);
+        const size_t slots = n.capacity / sizeof(slot_type);
+        const size_t i = (m.slot_index(r.addr) - first + d) % slots;
+        ret.push_back({r.id, m.addr + (first + i) * sizeof(slot_type), r.length});
+    }
+    return ret;
+}
+
+template <class Traits>
+int BasicClient<Traits>::search_window(const okey &key, const oloc &home,
+    bool claim, size_t &d)
+{
+    const auto &p = home[0];
+    const auto &m = session_pool.pool.at(p.id);
+    const auto &n = node_mapper.server_map.at(p.id);
+    const size_t first = m.slot_index(p.addr) + 1;
+    const size_t end = (n.bucket_offset + n.capacity) / sizeof(slot_type);
+    const size_t w = std::min(bucket.search_length - 1, end - first);
+    if (!w)
+        [[unlikely]] return claim ? -EDQUOT : -ENOENT;
+
+    const auto lane = m.index_lane(first);
+    typename claim_op_type::target_t slots[claim_op_type::max_window];
+    for (size_t i = 0; i < w; i++) {
+        const uintptr_t addr = p.addr + (i + 1) * sizeof(slot_type);
+        slots[i] = {addr, m.rkey(lane, addr)};
+    }
+    const int r = (*claim_op)(m.qps[lane], {m.bitmap_addr, m.index_rkeys[lane]},
+        first, slots, w, key, m.generation, claim)();
+    d = claim_op->found + 1;
+    return r;
+}
+
+template <class Traits>
+int BasicClient<Traits>::claim_replicas(const oloc &locs)
+{
+    for (size_t i = 1; i < locs.size(); i++) {
+        const auto &m = session_pool.pool.at(locs[i].id);
+        const auto index = m.slot_index(locs[i].addr);
+        const auto lane = m.index_lane(index);
+        if (int r = (*claim_op)(m.qps[lane], {m.bitmap_addr, m.index_rkeys[lane]},
+                index)(); r && r != -EEXIST)
+            [[unlikely]] return r;
+    }
+    return 0;
+}
+
+template <class Traits>
+int BasicClient<Traits>::check_filter(const okey &key, const oloc &locs)
+{
+    const auto &p = locs[0];
+    const auto &m = session_pool.pool.at(p.id);
+    if (!m.filter_blocks)
+        [[unlikely]] return 0;
+    const auto pos = key_filter::locate(key.fingerprint(), m.filter_blocks);
+    const uint64_t k = uint64_t(p.id) << 48 | pos.block;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (filter_cache->exist(k)) {
+        if (const auto c = filter_cache->get(k); now - c.fetched < filter_ttl)
+            [[likely]] return key_filter::may_contain(c.b, pos) ? 0 : -EINVAL;
+    }
+    const auto lane = m.lane(p.addr, session_pool.stripe_by_key);
+    if (int r = (*filter_op)(m.qps[lane], {m.filter_addr, m.index_rkeys[lane]}, pos)(); r)
+        [[unlikely]] return r;
+    filter_cache->put(k, {filter_op->block(), now});
+    return key_filter::may_contain(filter_op->block(), pos) ? 0 : -EINVAL;
+}
+
+template <class Traits>
+int BasicClient<Traits>::count_in_filters(const okey &key, const oloc &locs)
+{
+    for (const auto &l : locs) {
+        const auto &m = session_pool.pool.at(l.id);
+        if (!m.filter_blocks)
+            [[unlikely]] continue;
+        const auto pos = key_filter::locate(key.fingerprint(), m.filter_blocks);
+        /* Fetch and Adds on the index take one RNIC, see memory_region::index_lane() */
+        const auto lane = m.index_lane(pos.block);
+        if (int r = (*filter_op)(m.qps[lane], {m.filter_addr, m.index_rkeys[lane]},
+                pos, /*add*/true)(); r)
+            [[unlikely]] return r;
+
+        if (!filter_cache)
+            [[likely]] continue;
+        if (const uint64_t k = uint64_t(l.id) << 48 | pos.block; filter_cache->exist(k)) {
+            auto c = filter_cache->get(k);
+            key_filter::add(c.b, pos);
+            filter_cache->put(k, c);
+        }
+    }
+    return 0;
+}
+
+int ClientBase::probe_and_justify_oloc(const okey &key, oloc &ls)
 {
     /**
      * @note Currently we don't implement probing, as we always heat up locator
@@ -123,8 +337,8 @@ int Client::probe_and_justify_oloc(const okey &key, oloc &ls)
      * traverse the same code path.
      */
 
-    /* if we need to implement probing someday, use read_op, therefore we may
-        save one op when probing for read on a small object */
+    /* keys displaced by a collision are searched for on a miss of the home
+        slot, see BasicClient::read_displaced() and BasicClient::put_through() */
 
     if (collision_set.exist(key))
         return -EDQUOT;
@@ -136,7 +350,7 @@ int Client::probe_and_justify_oloc(const okey &key, oloc &ls)
 constexpr decltype(0us) retry_holdoff_vec[] = {0us, 2us, 3us, 3us, 5us, 7us};
 constexpr unsigned retry_holdoff_vec_len = sizeof(retry_holdoff_vec)
     / sizeof(std::remove_all_extents_t<decltype(retry_holdoff_vec)>);
-void Client::maybe_holdoff_retry() const noexcept
+void ClientBase::maybe_holdoff_retry() const noexcept
 {
     /* do not holdoff if not eager */
     if ((std::chrono::steady_clock::now() - last_retry_tp).count()
@@ -149,12 +363,11 @@ void Client::maybe_holdoff_retry() const noexcept
 
 /* I/O interface */
 
-int Client::raw_read(const char *key)
+template <class Traits>
+int BasicClient<Traits>::raw_read(const char *key)
 {
     BOOST_LOG_TRIVIAL(trace) << "Client::raw_read() object \"" << key << "\"";
 
-    const auto prop = dynamic_cast<ReadOp*>(read_op.get());
-    assert(prop);
     /* HACK: avoid further repeated construct, if not optimized */
     const okey _key(key);
     bool is_search_needed;
@@ -173,27 +386,99 @@ int Client::raw_read(const char *key)
         // TODO: stuff probe read result to read_op, saving a Read op, that is if we had implemented probing
     }
 
+    /* [opt::key_filter] a key certainly absent costs no slot Read */
+    if (filter_cache) {
+        [[unlikely]] if (int r = check_filter(_key, locs); r)
+            return r;
+    }
+
     /* fetch data from remote */
     {
         const auto &loc = locs[0];
         const auto &mr = session_pool.pool.at(loc.id);
-        if (int r = (*prop)(mr.conn.get(), loc.addr, loc.length, mr.rkey)(); r)
+        const auto lane = mr.lane(loc.addr, session_pool.stripe_by_key);
+        if (int r = (*read_op)(mr.qps[lane],
+                loc.addr, loc.length, mr.rkey(lane, loc.addr))(); r)
             [[unlikely]] return r;
     }
 
-    /* validate data on your own */
+    /* validate data on your own, against the table it came from, only the
+        slots actually Read (set by ops::Read), displaced keys are searched for
+        by read_displaced() */
     read_op->buf.pos = 0;
+    read_op->buf.generation = session_pool.pool.at(locs[0].id).generation;
 
     return 0;
 }
 
-int Client::get(const char *key)
+template <class Traits>
+int BasicClient<Traits>::get(const char *key)
 {
+    maybe_refresh_clustermap();
+    if (write_back) [[unlikely]] {
+        drain_write_back(false);
+        /* read your own writes */
+        if (const auto e = write_back->find(key); e) {
+            auto &buf = read_op->buf;
+            buf.set(key, e->value.data(), e->value.size());
+            buf.working_range = buf.slots();
+            return 0;
+        }
+    }
+
     if constexpr (optimization::retry_holdoff)
         maybe_holdoff_retry();
 
+    /* [opt::read_flights] share READ with concurrent readers of the same key */
+    if (read_flights) [[unlikely]] {
+        const okey _key(key);
+        bool is_leader;
+        const auto f = read_flights->board(_key, is_leader);
+        if (!is_leader)
+            return follow_read(_key, *f);
+        const SingleFlight::leader_guard guard(*read_flights, _key, f);
+
+        int v = raw_read(key);
+        read_flights->depart(_key, f);
+        if (!v) {
+            [[likely]] v = validate_read(key);
+            if (v == -EINVAL)
+                [[unlikely]] v = read_displaced(key);
+        }
+        const auto &buf = read_op->buf;
+        SingleFlight::land(*f, v, buf.arr.data(),
+            v ? 0 : buf.working_range * sizeof(slot_type),
+            buf.pos, buf.working_range, buf.generation);
+        return v;
+    }
+
     if (int r = raw_read(key); r)
         [[unlikely]] return r;
+    if (int v = validate_read(key); v != -EINVAL)
+        [[likely]] return v;
+    return read_displaced(key);
+}
+
+template <class Traits>
+int BasicClient<Traits>::follow_read(const okey &key, SingleFlight::flight &f)
+{
+    const int v = f.wait();
+    if (v == -EINVAL || v == -EREMOTE)
+        erase_oloc_cache(key);
+    if (v)
+        return v;
+
+    auto &buf = read_op->buf;
+    memcpy(buf.arr.data(), f.payload.data(), f.payload.size());
+    buf.pos = f.pos;
+    buf.working_range = f.working_range;
+    buf.generation = f.generation;
+    return 0;
+}
+
+template <class Traits>
+int BasicClient<Traits>::validate_read(const char *key)
+{
     int v = read_op->buf.validity(key);
     if (v == 0)
         [[likely]] return 0;
@@ -222,7 +507,68 @@ int Client::get(const char *key)
     return v;
 }
 
-int Client::put(void)
+template <class Traits>
+int BasicClient<Traits>::read_displaced(const char *key)
+{
+    /* the key may only have been displaced by another one taking its home */
+    const auto &home = read_op->buf.arr[0].meta.atomic.m;
+    if (bucket.search_length < 2 || !(home.bits & slot_type::meta_type::bits_flag::valid)
+            || home.generation != read_op->buf.generation)
+        [[likely]] return -EINVAL;
+
+    const okey _key(key);
+    bool is_search_needed;
+    const auto locs = this->map(_key, is_search_needed);
+    size_t d;
+    if (int r = search_window(_key, locs, false, d); r != -EEXIST)
+        return r == -ENOENT ? -EINVAL : r;
+    abnormal_placements.put(_key, displace(locs, d));
+
+    if (int r = raw_read(key); r)
+        [[unlikely]] return r;
+    return validate_read(key);
+}
+
+template <class Traits>
+int BasicClient<Traits>::put(const char *key, const void *din, size_t dlen)
+{
+    maybe_refresh_clustermap();
+    if (write_back) [[unlikely]] {
+        /* refused now, as put_through() would on every write-back */
+        write_back->stage(key, din, dlen);
+        drain_write_back(false);
+        return 0;
+    }
+
+    write_op->buf.set(key, din, dlen);
+    return put_through();
+}
+
+template <class Traits>
+int BasicClient<Traits>::put(void)
+{
+    maybe_refresh_clustermap();
+    /* #write_op is already filled, leave due entries to the next I/O */
+    if (write_back)
+        [[unlikely]] write_back->discard(okey(write_op->buf.data()[0].key()));
+    return put_through();
+}
+
+template <class Traits>
+int BasicClient<Traits>::drain_write_back(bool all)
+{
+    return write_back->drain([this] (const okey &key, const WriteBackBuffer::entry &e) {
+        write_op->buf.set(key, e.value.data(), e.value.size());
+        const int r = put_through();
+        if (r && r != -EBUSY)
+            [[unlikely]] BOOST_LOG_TRIVIAL(warning) << "failed to write back "
+                << key.c_str() << " : " << std::strerror(-r);
+        return r;
+    }, all);
+}
+
+template <class Traits>
+int BasicClient<Traits>::put_through(void)
 {
     BOOST_LOG_TRIVIAL(trace) << "Client::put() object \""
         << write_op->buf.arr[0].key().c_str() << "\" of size "
@@ -231,10 +577,9 @@ int Client::put(void)
     if constexpr (optimization::retry_holdoff)
         maybe_holdoff_retry();
 
-    const auto plop = dynamic_cast<LockOp*>(lock_op.get());
-    const auto pulop = dynamic_cast<UnlockOp*>(unlock_op.get());
-    const auto pwop = dynamic_cast<WriteOp*>(write_op.get());
-    assert(plop && pulop && pwop);
+    const auto plop = lock_op.get();
+    const auto pulop = unlock_op.get();
+    const auto pwop = write_op.get();
 
     /**
      * @note currently large value support not implemented
@@ -242,7 +587,9 @@ int Client::put(void)
     if (pwop->buf.slots() > 1)
         [[unlikely]] throw std::runtime_error("large object not supported yet");
 
-    const auto &_key = pwop->buf.data()[0].key();
+    const okey _key(pwop->buf.data()[0].key());
+    /* a redirected locator is only trusted while the key is found there */
+    bool is_displaced = abnormal_placements.exist(_key);
     bool is_search_needed;
     auto locs = this->map(_key, is_search_needed);
 
@@ -268,16 +615,17 @@ int Client::put(void)
      * are initialized, we make sure the memory pool layout of a bucket remains
      * static.
      *
-     * Moreover, in the current implementation, linear search is not implemented,
-     * therefore a lock fail due to invalid always means object not exist, and
-     * key mismatch always means collision.
-     * @sa Client::abnormal_placements
+     * Moreover, slots are never freed, therefore a lock fail due to invalid
+     * always means object not exist, and the home slot is claimed in the
+     * occupancy bitmap of the primary. Key mismatch, or the home slot claimed
+     * by a concurrent insert, means collision, and the object is looked for in
+     * the search window past the home slot, or inserted to a free slot of it,
+     * both through the bitmap and atomic fields only, see ops::Claim.
+     * @sa ClientBase::abnormal_placements
      *
-     * Therefore, linear search on write does not need to be implemented, at
-     * least for now. What comes out of Client::map(const okey&, bool&) is where
-     * data goes to. Collision on primary means failure, and collision on replicas
-     * is ignored (as this implementation is only intended for performance
-     * benchmarking) !
+     * The object goes the same distance from home on every replica. Only a full
+     * window on primary means failure, and collision on replicas is ignored (as
+     * this implementation is only intended for performance benchmarking) !
      */
 
     if (is_search_needed) {
@@ -296,33 +644,109 @@ int Client::put(void)
 
     /* initialize replica vector */
 
-    vector<WriteOp::target_t> repvec;
-    for (const auto &r : locs) {
-        const auto &m = session_pool.pool.at(r.id);
-        repvec.push_back({m.conn.get(), r.addr, m.rkey});
-    }
-    const auto &prim_rep = repvec.at(0);
-
-    /* lock (primary) */
-    do {
-        if (int r = (*plop)(prim_rep.id, prim_rep.addr, _key, prim_rep.rkey)(); r) {
-            [[unlikely]] if (r == -EINVAL)
-                [[likely]] break;
-            if constexpr (optimization::retry_holdoff) {
-                if (r == -EBUSY) {
-                    [[likely]] last_retry_tp = std::chrono::steady_clock::now();
-                    return r;
-                }
+    vector<typename write_op_type::target_t> repvec;
+    const auto locate = [&] {
+        repvec.clear();
+        for (const auto &r : locs) {
+            const auto &m = session_pool.pool.at(r.id);
+            /* the primary is locked and unlocked through the same QP */
+            const auto lane = repvec.empty() ? m.atomic_lane(r.addr)
+                : m.lane(r.addr, session_pool.stripe_by_key);
+            repvec.push_back({m.qps[lane], r.addr,
+                m.rkey(lane, r.addr), m.generation,
+                bucket.persistent && m.durability == session::durability::power_fail});
+        }
+    };
+    locate();
+
+    /* counted in before claiming a slot, so that no filter Read misses a
+        written key, and a failure leaks no claimed slot; a key counted in but
+        not inserted after all is merely a false positive */
+    bool is_counted = false;
+    const auto count_in = [&] {
+        if (is_counted)
+            return 0;
+        const int r = count_in_filters(_key, locs);
+        is_counted = !r;
+        return r;
+    };
+
+    /* lock (primary), or claim a slot for inserting */
+    bool is_insert = false;
+    for (unsigned attempt = 0; true; attempt++) {
+        const auto &p = repvec[0];
+        int r = (*plop)(p.id, p.addr, _key, p.rkey, p.generation)();
+        if (!r)
+            [[likely]] break;
+        if constexpr (optimization::retry_holdoff) {
+            if (r == -EBUSY) {
+                [[likely]] last_retry_tp = std::chrono::steady_clock::now();
+                return r;
             }
-            if (r == -EBADF) {
-                [[likely]] collision_set.put(_key, '\0');
-                erase_oloc_cache(_key);
-                return -EDQUOT;
+        }
+        if (r == -EBUSY)
+            return r;
+        if (attempt == 2)
+            [[unlikely]] return -EAGAIN;
+
+        /* the key moved under a redirected locator, start over from home */
+        if (is_displaced) {
+            [[unlikely]] erase_oloc_cache(_key);
+            is_displaced = false;
+            locs = this->map(_key, is_search_needed);
+            locate();
+            continue;
+        }
+
+        if (r == -EINVAL) {
+            /* empty home slot, ours unless a concurrent insert claimed it */
+            if (int r = count_in(); r)
+                [[unlikely]] return r;
+            const auto &m = session_pool.pool.at(locs[0].id);
+            const auto index = m.slot_index(locs[0].addr);
+            const auto lane = m.index_lane(index);
+            r = (*claim_op)(m.qps[lane], {m.bitmap_addr, m.index_rkeys[lane]},
+                index)();
+            if (!r) {
+                [[likely]] is_insert = true;
+                break;
             }
+            if (r != -EEXIST)
+                return r;
+        }
+        else if (r != -EBADF)
             return r;
+
+        /* home slot taken by another key, look in the window past it */
+        if (r = count_in(); r)
+            [[unlikely]] return r;
+        size_t d;
+        r = search_window(_key, locs, true, d);
+        if (r == -EDQUOT) {
+            [[unlikely]] collision_set.put(_key, '\0');
+            erase_oloc_cache(_key);
+            return -EDQUOT;
         }
-    } while (0);
-    BOOST_LOG_TRIVIAL(trace) << "data slot " << _key.c_str() << " locked";
+        if (r && r != -EEXIST)
+            [[unlikely]] return r;
+        locs = displace(locs, d);
+        locate();
+        abnormal_placements.put(_key, locs);
+        is_displaced = true;
+        BOOST_LOG_TRIVIAL(trace) << "data slot " << _key.c_str() << " displaced by "
+            << d << (r ? ", found" : ", claimed");
+        if (!r) {
+            is_insert = true;
+            break;
+        }
+    }
+    BOOST_LOG_TRIVIAL(trace) << "data slot " << _key.c_str()
+        << (is_insert ? " claimed" : " locked");
+    if (is_insert) {
+        if (int r = claim_replicas(locs); r)
+            [[unlikely]] return r;
+    }
+    const auto &prim_rep = repvec.at(0);
 
     /* write replicas
         HACK: we ignore lock status on replicas, write whatever comes handy as
@@ -339,7 +763,8 @@ int Client::put(void)
         if (repvec.size() == 1)
             break;
 
-        if (int r = (*pulop)(prim_rep.id, prim_rep.addr, _key, prim_rep.rkey)(); r)
+        if (int r = (*pulop)(prim_rep.id, prim_rep.addr, _key, prim_rep.rkey,
+                prim_rep.generation)(); r)
             [[unlikely]] return r;
     } while (0);
     BOOST_LOG_TRIVIAL(trace) << "data slot " << _key.c_str() << " unlocked";
@@ -347,4 +772,7 @@ int Client::put(void)
     return 0;
 }
 
+
+template class BasicClient<client_traits<>>;
+
 }   /* namespace gestalt */
@@ -2,6 +2,15 @@
  * @file data_mapper.cpp
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <unistd.h>
+
 #include "common/boost_log_helper.hpp"
 
 #include <grpcpp/channel.h>
@@ -18,10 +27,76 @@
 namespace gestalt {
 
 using namespace std;
+using namespace std::chrono_literals;
+
+
+struct DataMapper::watcher_t {
+    mutable std::mutex _mutex;
+    /** context of the ongoing Watch call, for cancellation */
+    unique_ptr<grpc::ClientContext> ctx;
+    /** latest cluster map pushed by monitor */
+    gestalt::rpc::ServerList latest;
+    /** apply #latest even if not newer, i.e. the map in use is not trusted */
+    bool force = false;
+    atomic<bool> pending = false;
+    atomic<bool> is_stopping = false;
+    std::jthread th;
+
+    /** context of the call validating bootstrap cache, for cancellation */
+    unique_ptr<grpc::ClientContext> vctx;
+    std::jthread validator;
 
+    ~watcher_t()
+    {
+        is_stopping = true;
+        {
+            std::scoped_lock l(_mutex);
+            if (ctx)
+                ctx->TryCancel();
+            if (vctx)
+                vctx->TryCancel();
+        }
+        if (th.joinable())
+            th.join();
+        if (validator.joinable())
+            validator.join();
+    }
+};
 
-DataMapper::DataMapper(Client *_c) : client(_c)
+
+DataMapper::DataMapper() noexcept : client(nullptr)
+{ }
+
+bool DataMapper::make_node(const rpc::ServerProp &s, const string &bucket,
+    server_node &out)
 {
+    const auto it = std::find_if(s.buckets().begin(), s.buckets().end(),
+        [&bucket] (const auto &b) { return b.name() == bucket; });
+    if (it == s.buckets().end() || it->length() < sizeof(dataslot))
+        return false;
+    out = server_node(s.addr(), it->offset(), it->length(),
+        {s.rdma_addrs().begin(), s.rdma_addrs().end()});
+    return true;
+}
+
+DataMapper &DataMapper::operator=(DataMapper &&tmp) noexcept = default;
+
+DataMapper::~DataMapper()
+{ }
+
+
+DataMapper::DataMapper(ClientBase *_c) : client(_c)
+{
+    engine = placement::parse_engine(client->bucket.placement);
+
+    /* [bootstrap_cache] start connecting right away, monitor is asked in
+        background */
+    cache_path = client->config.get<string>("client.bootstrap_cache", "");
+    if (load_cache()) {
+        validate_in_background();
+        return;
+    }
+
     gestalt::rpc::ServerList out;
     {
         auto chan = grpc::CreateChannel(
@@ -30,8 +105,8 @@ DataMapper::DataMapper(Client *_c) : client(_c)
         auto stub = gestalt::rpc::ClusterMap::NewStub(chan);
         grpc::ClientContext ctx;
         /**
-         * TODO: should be getting only servers responsible for bucket opened by
-         * this client, however in the benchmark setup we only have one big
+         * NOTE: gets all servers, those not serving the bucket opened by this
+         * client are skipped below
          * bucket that takes all PMem space, so for now we get all servers in
          * the cluster.
          */
@@ -43,34 +118,340 @@ DataMapper::DataMapper(Client *_c) : client(_c)
     }
     BOOST_LOG_TRIVIAL(debug) << "fetched server list from monitor";
 
+    epoch = out.epoch();
     const auto &servers = out.servers();
     server_rank.reserve(servers.size());
     for (const auto &s : servers) {
+        server_node n;
+        if (!make_node(s, client->bucket.name, n))
+            continue;
         server_rank.push_back(s.id());
-        server_map.insert({s.id(), {s.addr()}});
+        server_map.insert({s.id(), std::move(n)});
     }
+    if (server_rank.empty())
+        BOOST_LOG_TRIVIAL(warning) << "no server serves bucket " << client->bucket.name;
+}
+
+DataMapper::placement_view DataMapper::view() const
+{
+    placement_view v{engine, server_rank, server_weight, {}};
+    for (const auto &id : server_rank)
+        if (server_map.at(id).status != server_node::Status::up)
+            [[unlikely]] v.down.push_back(id);
+    return v;
+}
+
+DataMapper::acting_set DataMapper::map(const placement_view &v, uint32_t khx, unsigned r)
+{
+    acting_set out;
+    out.reserve(r);
+    placement::place(v.engine, khx, v.rank, r, [&v] (unsigned id) {
+        return std::find(v.down.begin(), v.down.end(), id) == v.down.end();
+    }, out, v.weight.empty() ? nullptr : &v.weight);
+    return out;
 }
 
 DataMapper::acting_set DataMapper::map(uint32_t base, unsigned r) const
 {
-    /**
-     * @note currently implemented as round-robin
-     */
     acting_set out;
-    for (unsigned off = 0; off < server_rank.size() && out.size() < r; ++off) {
-        unsigned rank;
-        [[likely]] rank = (off + base) % server_rank.size();
-        unsigned id = server_rank[rank];
-        if (server_map.at(id).status != server_node::Status::up)
-            [[unlikely]] continue;
-        out.push_back(id);
-    }
+    out.reserve(r);
+    placement::place(engine, base, server_rank, r, [this] (unsigned id) {
+        return server_map.at(id).status == server_node::Status::up;
+    }, out, server_weight.empty() ? nullptr : &server_weight);
     return out;
 }
 
+void DataMapper::weigh(const unordered_map<unsigned, size_t> &capacity)
+{
+    server_weight.clear();
+    if (client->config.get<string>("global.placement_weights", "capacity") == "uniform")
+        return;
+
+    size_t total = 0, lo = SIZE_MAX, hi = 0;
+    for (const auto &[id, c] : capacity) {
+        total += c;
+        lo = std::min(lo, c);
+        hi = std::max(hi, c);
+    }
+    /* homogeneous cluster, keep the cheaper unweighted placement */
+    if (capacity.empty() || lo == hi || !lo)
+        return;
+    if (engine != placement::Engine::rendezvous) {
+        BOOST_LOG_TRIVIAL(warning) << "server capacities range from " << lo
+            << " to " << hi << " slots, but placement engine "
+            << placement::engine_name(engine) << " cannot weigh servers, "
+            << "smaller servers will fill up first";
+        return;
+    }
+
+    const double avg = 1. * total / capacity.size();
+    server_weight.reserve(server_rank.size());
+    for (const auto &id : server_rank) {
+        const auto it = capacity.find(id);
+        server_weight.push_back(it == capacity.end() ? 1. : it->second / avg);
+    }
+    BOOST_LOG_TRIVIAL(debug) << "placement weighted by capacity: "
+        << dump_clustermap();
+}
+
 void DataMapper::mark_out(unsigned id)
 {
     server_map.at(id).status = server_node::Status::out;
 }
 
+
+DataMapper::watcher_t &DataMapper::ensure_watcher()
+{
+    if (!watcher)
+        watcher.reset(new watcher_t);
+    return *watcher;
+}
+
+void DataMapper::watch()
+{
+    if (watcher && watcher->th.joinable())
+        [[unlikely]] return;
+    auto &w = ensure_watcher();
+
+    const auto monitor_address =
+        client->config.get_child("global.monitor_address").get_value<string>();
+    w.th = std::jthread([w = &w, monitor_address, known = epoch] {
+        auto stub = gestalt::rpc::ClusterMap::NewStub(grpc::CreateChannel(
+            monitor_address, grpc::InsecureChannelCredentials()));
+        gestalt::rpc::WatchRequest in;
+        in.set_known_epoch(known);
+
+        while (!w->is_stopping) {
+            {
+                std::scoped_lock l(w->_mutex);
+                /* checked under lock, or we may miss cancellation */
+                if (w->is_stopping)
+                    break;
+                w->ctx.reset(new grpc::ClientContext);
+            }
+            auto reader = stub->Watch(w->ctx.get(), in);
+            gestalt::rpc::ServerList o;
+            while (reader->Read(&o)) {
+                BOOST_LOG_TRIVIAL(debug) << "monitor pushed cluster map of epoch "
+                    << o.epoch();
+                in.set_known_epoch(o.epoch());
+                std::scoped_lock l(w->_mutex);
+                w->latest = std::move(o);
+                w->pending.store(true, memory_order_release);
+            }
+            if (auto r = reader->Finish(); !r.ok() && !w->is_stopping) {
+                BOOST_LOG_TRIVIAL(warning) << "RPC Watch(): " << r.error_message()
+                    << ", retrying";
+                std::this_thread::sleep_for(1s);
+            }
+        }
+    });
+}
+
+bool DataMapper::has_update() const noexcept
+{
+    return watcher && watcher->pending.load(memory_order_relaxed);
+}
+
+bool DataMapper::apply_update(update &u)
+{
+    if (!has_update())
+        return false;
+
+    gestalt::rpc::ServerList latest;
+    bool force;
+    {
+        std::scoped_lock l(watcher->_mutex);
+        latest = std::move(watcher->latest);
+        force = std::exchange(watcher->force, false);
+        watcher->pending.store(false, memory_order_relaxed);
+    }
+    if (latest.epoch() <= epoch && !force)
+        [[unlikely]] return false;
+
+    u.epoch = latest.epoch();
+    u.added.clear();
+    u.removed.clear();
+
+    decltype(server_map) new_map;
+    vector<unsigned> new_rank;
+    new_rank.reserve(latest.servers_size());
+    for (const auto &s : latest.servers()) {
+        server_node n;
+        if (!make_node(s, client->bucket.name, n))
+            continue;
+        new_rank.push_back(s.id());
+        const auto it = server_map.find(s.id());
+        if (it == server_map.end() || it->second.addr != n.addr
+                || it->second.rdma_addrs != n.rdma_addrs
+                || it->second.bucket_offset != n.bucket_offset
+                || it->second.capacity != n.capacity) {
+            if (it != server_map.end())
+                u.removed.push_back(s.id());
+            u.added.push_back(s.id());
+            new_map.insert({s.id(), std::move(n)});
+        }
+        else
+            new_map.insert(*it);
+    }
+    for (const auto &[id, s] : server_map)
+        if (!new_map.contains(id))
+            u.removed.push_back(id);
+
+    server_map = std::move(new_map);
+    server_rank = std::move(new_rank);
+    server_weight.clear();
+    epoch = u.epoch;
+
+    BOOST_LOG_TRIVIAL(info) << "cluster map advanced to epoch " << epoch
+        << ", " << u.added.size() << " server(s) added, "
+        << u.removed.size() << " removed";
+    return true;
+}
+
+
+bool DataMapper::load_cache()
+{
+    if (cache_path.empty())
+        return false;
+
+    gestalt::rpc::BootstrapCache cache;
+    {
+        ifstream f(cache_path, ios::binary);
+        /* first run */
+        if (!f)
+            return false;
+        if (!cache.ParseFromIstream(&f)) {
+            BOOST_LOG_TRIVIAL(warning) << "ignoring corrupted bootstrap cache "
+                << cache_path;
+            return false;
+        }
+    }
+    const auto &servers = cache.map().servers();
+    if (servers.empty())
+        [[unlikely]] return false;
+
+    /* the cache holds the servers of the bucket it was saved for, as well as
+        its extent on them */
+    epoch = cache.map().epoch();
+    server_rank.reserve(servers.size());
+    for (const auto &s : servers) {
+        server_node n;
+        if (!make_node(s, client->bucket.name, n)) {
+            BOOST_LOG_TRIVIAL(info) << "bootstrap cache " << cache_path
+                << " is of another bucket, ignoring";
+            server_rank.clear();
+            server_map.clear();
+            return false;
+        }
+        server_rank.push_back(s.id());
+        server_map.insert({s.id(), std::move(n)});
+    }
+    BOOST_LOG_TRIVIAL(debug) << "cluster map of epoch " << epoch
+        << " taken from bootstrap cache " << cache_path;
+    return true;
+}
+
+void DataMapper::validate_in_background()
+{
+    auto &w = ensure_watcher();
+
+    vector<pair<unsigned, server_node>> cached;
+    for (const auto &id : server_rank)
+        cached.emplace_back(id, server_map.at(id));
+
+    const auto monitor_address =
+        client->config.get_child("global.monitor_address").get_value<string>();
+    w.validator = std::jthread([w = &w, monitor_address, known = epoch,
+            cached = std::move(cached), bucket = client->bucket.name] {
+        auto stub = gestalt::rpc::ClusterMap::NewStub(grpc::CreateChannel(
+            monitor_address, grpc::InsecureChannelCredentials()));
+        {
+            std::scoped_lock l(w->_mutex);
+            if (w->is_stopping)
+                return;
+            w->vctx.reset(new grpc::ClientContext);
+        }
+        gestalt::rpc::ServerList out;
+        if (auto r = stub->GetServers(w->vctx.get(), {}, &out); !r.ok()) {
+            if (!w->is_stopping)
+                BOOST_LOG_TRIVIAL(warning) << "cannot validate bootstrap cache, "
+                    << "RPC GetServers(): " << r.error_message();
+            return;
+        }
+
+        /* epochs restart with monitor, compare membership as well */
+        bool same = out.epoch() == known;
+        size_t i = 0;
+        for (const auto &s : out.servers()) {
+            server_node n;
+            if (!same || !make_node(s, bucket, n))
+                continue;
+            same = i < cached.size() && s.id() == cached[i].first
+                && n.addr == cached[i].second.addr
+                && n.rdma_addrs == cached[i].second.rdma_addrs
+                && n.bucket_offset == cached[i].second.bucket_offset
+                && n.capacity == cached[i].second.capacity;
+            i++;
+        }
+        same = same && i == cached.size();
+        if (same) {
+            BOOST_LOG_TRIVIAL(debug) << "bootstrap cache validated";
+            return;
+        }
+        BOOST_LOG_TRIVIAL(info) << "bootstrap cache of epoch " << known
+            << " is stale, monitor is at epoch " << out.epoch();
+
+        std::scoped_lock l(w->_mutex);
+        /* Watch may have pushed something newer meanwhile */
+        if (w->pending && w->latest.epoch() >= out.epoch())
+            return;
+        w->latest = std::move(out);
+        w->force = true;
+        w->pending.store(true, memory_order_release);
+    });
+}
+
+void DataMapper::save_cache() const
+{
+    if (cache_path.empty())
+        return;
+
+    gestalt::rpc::BootstrapCache cache;
+    auto &m = *cache.mutable_map();
+    m.set_epoch(epoch);
+    for (const auto &id : server_rank) {
+        const auto &s = server_map.at(id);
+        auto &o = *m.add_servers();
+        o.set_id(id);
+        o.set_addr(s.addr);
+        o.set_capacity(s.capacity);
+        for (const auto &a : s.rdma_addrs)
+            o.add_rdma_addrs(a);
+        auto &b = *o.add_buckets();
+        b.set_name(client->bucket.name);
+        b.set_offset(s.bucket_offset);
+        b.set_length(s.capacity);
+    }
+
+    /* write aside and rename, so that no one reads a torn cache */
+    auto tmp = cache_path;
+    tmp += ".tmp." + std::to_string(getpid()) + "." + std::to_string(client->id);
+    {
+        ofstream f(tmp, ios::binary | ios::trunc);
+        if (!f || !cache.SerializeToOstream(&f)) {
+            [[unlikely]] BOOST_LOG_TRIVIAL(warning) << "cannot write bootstrap cache "
+                << tmp;
+            return;
+        }
+    }
+    std::error_code ec;
+    filesystem::rename(tmp, cache_path, ec);
+    if (ec) {
+        [[unlikely]] BOOST_LOG_TRIVIAL(warning) << "cannot replace bootstrap cache "
+            << cache_path << ": " << ec.message();
+        filesystem::remove(tmp, ec);
+    }
+}
+
 }   /* namespace gestalt */
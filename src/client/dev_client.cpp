@@ -76,7 +76,7 @@ int main(const int argc, const char **argv)
 
         {
             auto &r = client.read_op->buf;
-            const auto actual = reinterpret_cast<const char*>(r.data()->data.get());
+            const auto actual = reinterpret_cast<const char*>(r.data()->data.value());
             BOOST_LOG_TRIVIAL(info) << "got out this: "
                 << actual << ", expecting this: " << testbuf
                 << std::endl;
@@ -8,6 +8,8 @@
 #include <filesystem>
 #include <string>
 #include <sstream>
+#include <future>
+#include <chrono>
 #include <arpa/inet.h>
 
 #include "common/boost_log_helper.hpp"
@@ -18,6 +20,7 @@
 #include <grpcpp/client_context.h>
 #include "Session.pb.h"
 #include "Session.grpc.pb.h"
+#include "spec/session.hpp"
 
 #include "internal/rdma_connection_pool.hpp"
 #include "client.hpp"
@@ -31,62 +34,223 @@ namespace gestalt {
 using namespace std;
 
 
-RDMAConnectionPool::RDMAConnectionPool(Client *_c) : client(_c)
+RDMAConnectionPool::RDMAConnectionPool(ClientBase *_c) : client(_c)
 {
     using ServerStatus = DataMapper::server_node::Status;
-    const auto srv_rpc_port =
-        client->config.get_child("server.rpc_port").get_value<unsigned>();
-    const auto srv_rdma_port =
-        client->config.get_child("server.rdma_port").get_value<unsigned>();
 
+    /* [striping] more QPs per server spread load over RNIC processing units */
+    lanes = client->config.get<unsigned>("client.qps_per_server", 1);
+    if (!lanes)
+        throw std::invalid_argument("client.qps_per_server");
+    const auto striping = client->config.get<string>("client.qp_striping", "key");
+    if (striping != "key" && striping != "round_robin")
+        throw std::invalid_argument("client.qp_striping");
+    stripe_by_key = striping == "key";
+
+    /* [lazy] servers are connected on first use */
+    const auto mode = client->config.get<string>("client.connect", "eager");
+    if (lazy = mode == "lazy"; lazy)
+        return;
+    if (mode != "eager")
+        throw std::invalid_argument("client.connect");
+
+    vector<unsigned> ids;
     for (const auto &[server_id, s] : client->node_mapper.server_map) {
-        BOOST_LOG_TRIVIAL(trace) << "try connecting server "
-            << server_id << " @ " << s.addr
-            << " (port rpc " << srv_rpc_port << " rdma " << srv_rdma_port << ")";
         if (s.status != ServerStatus::up) {
             BOOST_LOG_TRIVIAL(warning) << __func__ << "(): "
                 << "stumbled on an inactive server in cluster map, ignoring";
             continue;
         }
+        ids.push_back(server_id);
+    }
+    connect_all(ids);
+}
 
-        /* 1. initiate call */
-        auto chan = grpc::CreateChannel(
-            s.addr + ":" + std::to_string(srv_rpc_port),
-            grpc::InsecureChannelCredentials());
-        auto stub = gestalt::rpc::Session::NewStub(chan);
-        grpc::ClientContext ctx;
-        gestalt::rpc::ClientProp in;
-        in.set_id(client->id);
-        auto reader = stub->Connect(&ctx, in);
 
-        /* 2. connect */
+int RDMAConnectionPool::connect(unsigned server_id)
+{
+    if (pool.contains(server_id))
+        [[unlikely]] return 0;
+
+    memory_region mr;
+    if (int r = establish(server_id, mr); r) {
+        [[unlikely]] client->node_mapper.mark_out(server_id);
+        return r;
+    }
+    pool.insert({server_id, std::move(mr)});
+    BOOST_LOG_TRIVIAL(trace) << "inserted server " << server_id
+        << " to connection pool";
+    return 0;
+}
+
+unsigned RDMAConnectionPool::connect_all(const vector<unsigned> &ids)
+{
+    /* connection setup is mostly waiting on network round trips, overlap them */
+    /* [mux] views own no connections, only the return code tells failures */
+    vector<std::pair<unsigned, std::future<std::pair<int, memory_region>>>> inflight;
+    for (const auto &id : ids) {
+        if (pool.contains(id))
+            continue;
+        inflight.emplace_back(id, std::async(std::launch::async, [this, id] {
+            memory_region mr;
+            const int r = establish(id, mr);
+            return std::make_pair(r, std::move(mr));
+        }));
+    }
+
+    unsigned failed = 0;
+    for (auto &[id, f] : inflight) {
+        auto [r, mr] = f.get();
+        if (r || !mr.connected()) {
+            [[unlikely]] client->node_mapper.mark_out(id);
+            failed++;
+            continue;
+        }
+        pool.insert({id, std::move(mr)});
+    }
+    BOOST_LOG_TRIVIAL(trace) << "connected " << inflight.size() - failed
+        << " server(s) concurrently, " << failed << " failed";
+    return failed;
+}
+
+
+int RDMAConnectionPool::establish(unsigned server_id, memory_region &out) const
+{
+    if (!client->qp_mux)
+        [[likely]] return establish(server_id, out, client->id, lanes, 16);
+
+    /* [mux] connect once per process, as the multiplexer */
+    auto &mux = *client->qp_mux;
+    shared_ptr<const memory_region> shared;
+    const int r = mux.share(server_id, shared,
+        [&] (shared_ptr<const memory_region> &created) {
+            auto mr = make_shared<memory_region>();
+            if (int r = establish(server_id, *mr, mux.id, mux.lanes, QpMux::sq_depth); r)
+                [[unlikely]] return r;
+            for (const auto &qp : mr->qps)
+                mux.attach(qp);
+            created = std::move(mr);
+            return 0;
+        });
+    if (r)
+        [[unlikely]] return r;
+    out = memory_region(std::move(shared));
+    return 0;
+}
+
+int RDMAConnectionPool::establish(unsigned server_id, memory_region &out,
+    unsigned client_id, unsigned nr_qps, unsigned sq_depth) const
+{
+    const auto srv_rdma_port =
+        client->config.get_child("server.rdma_port").get_value<unsigned>();
+    const auto &s = client->node_mapper.server_map.at(server_id);
+
+    /* lane #i goes to RDMA endpoint, i.e. RNIC, #i % endpoints of the server,
+        the same for every client, and every endpoint gets as many lanes.
+        Most RNICs only keep atomics atomic against those through themselves
+        (IBV_ATOMIC_HCA), so atomics on a word must take the same RNIC from
+        every client, see memory_region::atomic_lane() */
+    const size_t nr_endpoints = s.rdma_addrs.size();
+    const auto max_qps =
+        client->config.get<unsigned>("server.max_connections_per_client", 4);
+    if (const auto n = lanes_for(nr_qps, nr_endpoints, max_qps); n != nr_qps) {
+        BOOST_LOG_TRIVIAL(warning) << "server " << server_id << " serves "
+            << nr_endpoints << " endpoint(s), taking " << n << " QP(s) instead of "
+            << nr_qps << ", server.max_connections_per_client is " << max_qps;
+        nr_qps = n;
+    }
+    if (nr_qps > max_qps)
+        [[unlikely]] BOOST_LOG_TRIVIAL(error) << "server " << server_id
+            << " serves more endpoints than server.max_connections_per_client ("
+            << max_qps << "), it will reject the QPs beyond";
+
+    BOOST_LOG_TRIVIAL(trace) << "try connecting server "
+        << server_id << " @ " << s.addr << " (port rdma " << srv_rdma_port
+        << ", " << nr_qps << " QP(s) over " << nr_endpoints
+        << " endpoint(s))";
+
+    vector<rdma_addrinfo*> addrinfos(nr_endpoints, NULL);
+    defer([&] {
+        for (auto &a : addrinfos)
+            if (a)
+                rdma_freeaddrinfo(a);
+    });
+    for (size_t e = 0; e < nr_endpoints; e++) {
+        rdma_addrinfo addr_hint{
+            .ai_port_space = RDMA_PS_TCP
+        };
+        const auto &a = s.rdma_addrs[e];
+        if (rdma_getaddrinfo(
+                a.c_str(), std::to_string(srv_rdma_port).c_str(),
+                &addr_hint, &addrinfos[e]))
+            boost_log_errno_throw(rdma_getaddrinfo);
+    }
+
+    /* QPs of a server report to one CQ, a client polls a single place no
+        matter which QP an operation was striped to */
+    decltype(memory_region::cq) cq;
+    if (nr_qps > 1 && !optimization::batched_poll) {
+        cq.reset(ibv_create_cq(client->ibvpd->context, nr_qps * sq_depth, NULL, NULL, 0));
+        if (!cq)
+            boost_log_errno_throw(ibv_create_cq);
+    }
+    decltype(memory_region::conns) conns;
+    conns.reserve(nr_qps);
+    /* contiguous space the regions make up */
+    uintptr_t addr;
+    size_t length, chunk_length;
+    decltype(memory_region::rkeys) rkeys;
+    rkeys.reserve(nr_qps);
+    uintptr_t bitmap_addr;
+    size_t index_length;
+    decltype(memory_region::index_rkeys) index_rkeys;
+    index_rkeys.reserve(nr_qps);
+    uint8_t generation;
+    session::durability durability;
+
+    for (unsigned lane = 0; lane < nr_qps; lane++) {
+        /* 1. connect, naming self in private data */
         rdma_cm_id *raw_conn;
         {
-            rdma_addrinfo *addrinfo;
-            rdma_addrinfo addr_hint{
-                .ai_port_space = RDMA_PS_TCP
-            };
-            if (rdma_getaddrinfo(
-                    s.addr.c_str(), std::to_string(srv_rdma_port).c_str(),
-                    &addr_hint, &addrinfo))
-                boost_log_errno_throw(rdma_getaddrinfo);
-            defer([&] { rdma_freeaddrinfo(addrinfo); });
             ibv_qp_init_attr init_attr{
-                .send_cq = optimization::batched_poll ? client->ibvscq.get() : NULL,
-                .cap = { .max_send_wr = 16, .max_recv_wr = 16,
+                .send_cq = optimization::batched_poll ? client->ibvscq.get() : cq.get(),
+                .cap = { .max_send_wr = sq_depth, .max_recv_wr = 16,
                             .max_send_sge = 16, .max_recv_sge = 16,
                             .max_inline_data = 512 },
                 .qp_type = IBV_QPT_RC,
                 .sq_sig_all = 0
             };
-            if (rdma_create_ep(&raw_conn, addrinfo, client->ibvpd.get(), &init_attr))
+            if (rdma_create_ep(&raw_conn, addrinfos[lane % nr_endpoints],
+                    client->ibvpd.get(), &init_attr))
                 boost_log_errno_throw(rdma_create_ep);
-            if (rdma_connect(raw_conn, NULL)) {
+
+            ibv_device_attr dev_attr;
+            if (errno = ibv_query_device(raw_conn->verbs, &dev_attr); errno)
+                boost_log_errno_throw(ibv_query_device);
+            const session::conn_request req{
+                .magic = session::magic,
+                .version = session::version,
+                .lane = static_cast<uint16_t>(lane),
+                .client_id = client_id,
+            };
+            /* READs and atomics may be outstanding as many as the RNIC allows */
+            rdma_conn_param param{
+                .private_data = &req,
+                .private_data_len = sizeof(req),
+                .responder_resources = static_cast<uint8_t>(
+                    std::min(dev_attr.max_qp_rd_atom, 255)),
+                .initiator_depth = static_cast<uint8_t>(
+                    std::min(dev_attr.max_qp_init_rd_atom, 255)),
+                .retry_count = 7,
+                .rnr_retry_count = 7,
+            };
+            if (rdma_connect(raw_conn, &param)) {
+                const int err = errno;
                 BOOST_LOG_TRIVIAL(warning) << "Cannot connect to server "
-                    << server_id << " @ " << s.addr << ", marking it out";
+                    << server_id << " @ " << s.rdma_addrs[lane % nr_endpoints]
+                    << ", marking it out";
                 rdma_destroy_ep(raw_conn);
-                client->node_mapper.mark_out(server_id);
-                continue;
+                return -err;
             }
             BOOST_LOG_TRIVIAL(trace) << "RDMA connected to "
                 << inet_ntoa(raw_conn->route.addr.dst_sin.sin_addr)
@@ -95,74 +259,201 @@ RDMAConnectionPool::RDMAConnectionPool(Client *_c) : client(_c)
                 << inet_ntoa(raw_conn->route.addr.src_sin.sin_addr)
                 << ":" << raw_conn->route.addr.src_sin.sin_port;
         }
-        decltype(memory_region::conn) conn(raw_conn);
-
-        /* 3. get MR from server */
-        gestalt::rpc::MemoryRegion raw_mr;
-        if (!reader->Read(&raw_mr)) {
-            const char *what = "failed reading memory region from server";
-            BOOST_LOG_TRIVIAL(fatal) << what;
-            throw std::runtime_error(what);
+        const auto &conn = conns.emplace_back(raw_conn);
+
+        /* 2. get MR from private data of the accept, which sync ids keep until
+            the next CM call */
+        const auto &ev_param = conn->event->param.conn;
+        const auto *rep =
+            static_cast<const session::conn_reply*>(ev_param.private_data);
+        if (!rep || ev_param.private_data_len < offsetof(session::conn_reply, regions)
+            || rep->magic != session::magic || rep->version != session::version
+            || ev_param.private_data_len < offsetof(session::conn_reply, regions)
+                + rep->nr_regions * sizeof(session::region_descriptor)) [[unlikely]] {
+            ostringstream what;
+            what << "server " << server_id << " replied malformed session descriptor";
+            BOOST_LOG_TRIVIAL(fatal) << what.str();
+            throw std::runtime_error(what.str());
         }
-        memory_region mr(
-            raw_mr.addr(), raw_mr.length(), raw_mr.rkey(),
-            std::move(conn));
-
-        /* 4. finish */
-        if (auto r = reader->Finish(); !r.ok()) {
-            auto what = string("closing RPC Connect(): ") + r.error_message();
-            BOOST_LOG_TRIVIAL(fatal) << what;
-            throw std::runtime_error(what);
+        /* regions are chunks of one space, alike in length but the last one,
+            so that the rkey of an address is found by division */
+        const auto *const regions = rep->regions;
+        const size_t nr_regions = rep->nr_regions;
+        bool contiguous = nr_regions && nr_regions <= session::conn_reply::max_regions
+            && regions[0].length && regions[0].length % sizeof(dataslot) == 0;
+        for (size_t i = 1; contiguous && i < nr_regions; i++)
+            contiguous = regions[i].addr == regions[i - 1].addr + regions[i - 1].length
+                && regions[i].length && regions[i].length % sizeof(dataslot) == 0
+                && (i == nr_regions - 1 ? regions[i].length <= regions[0].length
+                    : regions[i].length == regions[0].length);
+        if (!contiguous) [[unlikely]] {
+            ostringstream what;
+            what << "server " << server_id << " serves " << nr_regions
+                << " memory regions not making up a slot table";
+            BOOST_LOG_TRIVIAL(fatal) << what.str();
+            throw std::runtime_error(what.str());
         }
+        vector<uint32_t> lane_rkeys(nr_regions);
+        for (size_t i = 0; i < nr_regions; i++)
+            lane_rkeys[i] = regions[i].rkey;
 
-        /* 5. add connection property to runtime */
-        pool.insert({server_id, std::move(mr)});
-        BOOST_LOG_TRIVIAL(trace) << "inserted server " << server_id
-            << " to connection pool";
+        /* every QP of a server is served the same space, though through MRs
+            of the RNIC it connected to */
+        const size_t lane_length =
+            regions[nr_regions - 1].addr + regions[nr_regions - 1].length - regions[0].addr;
+        if (rep->index.length < key_filter::offset(lane_length / sizeof(dataslot))
+                || rep->index.length % sizeof(key_filter::block)) [[unlikely]] {
+            ostringstream what;
+            what << "server " << server_id << " serves an index region "
+                << "not covering its slot table";
+            BOOST_LOG_TRIVIAL(fatal) << what.str();
+            throw std::runtime_error(what.str());
+        }
+        if (!lane) {
+            [[likely]] addr = regions[0].addr;
+            length = lane_length;
+            chunk_length = regions[0].length;
+            bitmap_addr = rep->index.addr;
+            index_length = rep->index.length;
+            generation = rep->generation;
+            durability = rep->durability;
+        }
+        else if (addr != regions[0].addr || length != lane_length
+                || chunk_length != regions[0].length
+                || bitmap_addr != rep->index.addr
+                || generation != rep->generation) [[unlikely]] {
+            ostringstream what;
+            what << "server " << server_id << " served different memory regions "
+                << "to QPs of the same client";
+            BOOST_LOG_TRIVIAL(fatal) << what.str();
+            throw std::runtime_error(what.str());
+        }
+        rkeys.push_back(std::move(lane_rkeys));
+        index_rkeys.push_back(rep->index.rkey);
     }
+    /* the key filter takes what the bitmap leaves */
+    const size_t filter_offset = key_filter::offset(length / sizeof(dataslot));
+    out = memory_region(addr, length, std::move(rkeys), chunk_length,
+        bitmap_addr, bitmap_addr + filter_offset,
+        (index_length - filter_offset) / sizeof(key_filter::block),
+        std::move(index_rkeys), generation,
+        durability, nr_endpoints, std::move(cq), std::move(conns));
+
+    return 0;
 }
 
 
 RDMAConnectionPool::~RDMAConnectionPool() noexcept(false)
 {
-    const auto srv_rpc_port =
-        client->config.get_child("server.rpc_port").get_value<unsigned>();
-    grpc::CompletionQueue grpccq;
+    if (pool.empty())
+        return;
+    vector<unsigned> ids;
+    ids.reserve(pool.size());
+    for (const auto &[id, mr] : pool)
+        ids.push_back(id);
+    disconnect_all(ids);
+}
+
 
-    /* disconnect one-by-one */
-    for (auto mrit = pool.begin(); mrit != pool.end(); mrit = pool.begin()) {
-        const auto &[server_id, mr] = *mrit;
-        const auto &conn = mr.conn;
+void RDMAConnectionPool::disconnect(unsigned server_id, bool graceful)
+{
+    const auto mrit = pool.find(server_id);
+    if (mrit == pool.end())
+        [[unlikely]] return;
 
-        BOOST_LOG_TRIVIAL(trace) << "RDMA disconnecting from "
-            << inet_ntoa(conn->route.addr.dst_sin.sin_addr)
-            << ":" << conn->route.addr.dst_sin.sin_port;
+    /* server is gone, there is no one to say goodbye to */
+    if (!graceful) {
+        BOOST_LOG_TRIVIAL(trace) << "dropping connection to server " << server_id;
+        if (client->qp_mux)
+            [[unlikely]] client->qp_mux->forget(server_id);
+        for (auto &conn : mrit->second.conns) {
+            const auto ep = conn.release();
+            rdma_disconnect(ep);
+            rdma_destroy_ep(ep);
+        }
+        pool.erase(mrit);
+        return;
+    }
 
-        auto chan = grpc::CreateChannel(
-            client->node_mapper.server_map.at(server_id).addr
-                + ":" + std::to_string(srv_rpc_port),
-            grpc::InsecureChannelCredentials());
-        auto stub = gestalt::rpc::Session::NewStub(chan);
+    disconnect_all({server_id});
+}
+
+void RDMAConnectionPool::disconnect_all(const vector<unsigned> &ids)
+{
+    using clock = std::chrono::system_clock;
+
+    const auto srv_rpc_port =
+        client->config.get_child("server.rpc_port").get_value<unsigned>();
+    const auto deadline = clock::now() + std::chrono::milliseconds(
+        client->config.get<unsigned>("client.shutdown_timeout_ms", 1000));
+
+    /* 1. say goodbye to every server at once, each call lives until its
+        completion is drained from #grpccq */
+    struct call_t {
+        unsigned server_id;
+        unique_ptr<gestalt::rpc::Session::Stub> stub;
         grpc::ClientContext ctx;
-        gestalt::rpc::ClientProp in;
-        in.set_id(client->id);
         google::protobuf::Empty out;
         grpc::Status r;
-        stub->AsyncDisconnect(&ctx, in, &grpccq)
-            ->Finish(&out, &r, reinterpret_cast<void*>(server_id));
+    };
+    grpc::CompletionQueue grpccq;
+    vector<unique_ptr<call_t>> calls;
+    calls.reserve(ids.size());
+    for (const auto &id : ids) {
+        const auto mrit = pool.find(id);
+        if (mrit == pool.end())
+            [[unlikely]] continue;
+        /* [mux] connections are not ours to close */
+        if (mrit->second.shared) {
+            [[unlikely]] pool.erase(mrit);
+            continue;
+        }
+        auto &call = calls.emplace_back(make_unique<call_t>());
+        call->server_id = id;
+        call->stub = gestalt::rpc::Session::NewStub(grpc::CreateChannel(
+            client->node_mapper.server_map.at(id).addr
+                + ":" + std::to_string(srv_rpc_port),
+            grpc::InsecureChannelCredentials()));
+        call->ctx.set_deadline(deadline);
+        gestalt::rpc::ClientProp in;
+        in.set_id(client->id);
+        call->stub->AsyncDisconnect(&call->ctx, in, &grpccq)
+            ->Finish(&call->out, &call->r, call.get());
+    }
 
-        /* rdma_disconnect() at client side, invoked automatically with dtor */
+    /* 2. tear down RDMA connections while RPCs are in flight, errors mean the
+        server hung up first and are of no interest */
+    for (const auto &call : calls) {
+        const auto mrit = pool.find(call->server_id);
+        for (auto &conn : mrit->second.conns) {
+            const auto ep = conn.release();
+            BOOST_LOG_TRIVIAL(trace) << "RDMA disconnecting from "
+                << inet_ntoa(ep->route.addr.dst_sin.sin_addr)
+                << ":" << ep->route.addr.dst_sin.sin_port;
+            rdma_disconnect(ep);
+            rdma_destroy_ep(ep);
+        }
         pool.erase(mrit);
-        /* NOTE: sometimes it takes a while ... */
+    }
 
+    /* 3. reap completions until deadline, servers lagging behind release
+        their side once RDMA CM reports the disconnect anyway */
+    for (size_t pending = calls.size(); pending; pending--) {
         void *tag;
         bool ok = false;
-        if (grpccq.Next(&tag, &ok); !ok) {
-            auto what = string("RPC Disconnect(): ") + r.error_message();
-            BOOST_LOG_TRIVIAL(fatal) << what;
-            throw std::runtime_error(what);
-        }
+        /* calls are deadlined, the queue never blocks much past #deadline */
+        if (!grpccq.Next(&tag, &ok))
+            [[unlikely]] break;
+        const auto call = static_cast<const call_t*>(tag);
+        if (!ok || !call->r.ok())
+            [[unlikely]] BOOST_LOG_TRIVIAL(warning) << "RPC Disconnect() of server "
+                << call->server_id << ": " << call->r.error_message();
     }
+    grpccq.Shutdown();
+    void *tag;
+    bool ok;
+    while (grpccq.Next(&tag, &ok))
+        ;
 }
 
 }   /* namespace gestalt */
@@ -10,6 +10,7 @@
 #include <filesystem>
 #include <unordered_map>
 #include <vector>
+#include <type_traits>
 
 #include <rdma/rdma_cma.h>
 #include "common/boost_log_helper.hpp"
@@ -17,9 +18,14 @@
 #include <boost/noncopyable.hpp>
 
 #include "./spec/dataslot.hpp"
+#include "./spec/bucket.hpp"
 #include "./internal/ops_base.hpp"
 #include "./internal/data_mapper.hpp"
 #include "./internal/rdma_connection_pool.hpp"
+#include "./internal/single_flight.hpp"
+#include "./internal/write_back_buffer.hpp"
+#include "./internal/qp_mux.hpp"
+#include "./ops/all.hpp"
 #include "./common/lru_cache.hpp"
 #include "./defaults.hpp"
 
@@ -31,21 +37,27 @@ using namespace std;
 using okey = dataslot::key_type;
 class DataMapper;
 class RDMAConnectionPool;
+template <class Traits> class BasicClient;
 
 
 /**
- * Client - the Gestalt storage cluster operator
+ * ClientBase - runtime of a Gestalt client that does not depend on which I/O
+ * operations it performs, i.e. cluster map, RDMA sessions and locator caches
  *
- * @note Not thread-safe, for shared access is controlled accross client by
- * design, and tackling with inter-thread synchronization would hurt performance
- * in the common case.
+ * @sa gestalt::BasicClient
  */
-class Client final : private boost::noncopyable {
+class ClientBase : private boost::noncopyable {
+protected:
 
     /* instance runtime */
 
     unsigned id;
     boost::property_tree::ptree config;
+    /**
+     * bucket opened, read-only
+     * @note config `client.bucket`, and `[bucket:<name>]` sections
+     */
+    gestalt::bucket::spec bucket;
     /**
      * number of replicas of the bucket, read-only
      */
@@ -55,7 +67,7 @@ class Client final : private boost::noncopyable {
 
     /** maps from okey to server nodes in cluster */
     DataMapper node_mapper;
-    friend class DataMapper;
+    friend class gestalt::DataMapper;
 
     /* RDMA sessions */
 
@@ -79,7 +91,8 @@ class Client final : private boost::noncopyable {
                 boost_log_errno_throw(ibv_dealloc_pd);
         }
     };
-    unique_ptr<ibv_pd, __IbvPdDeleter> ibvpd;
+    /** PD of this client, or that of #qp_mux if multiplexed */
+    shared_ptr<ibv_pd> ibvpd;
     struct __IbvCqDeleter {
         inline void operator()(ibv_cq *cq)
         {
@@ -92,9 +105,14 @@ class Client final : private boost::noncopyable {
      * @sa gestalt::optimization::batched_poll
      */
     unique_ptr<ibv_cq, __IbvCqDeleter> ibvscq;
+    /**
+     * (optional) QPs shared with other clients of this process, NULL for this
+     * client connecting servers on its own
+     */
+    shared_ptr<QpMux> qp_mux;
     /** pooled RDMA connection */
     RDMAConnectionPool session_pool;
-    friend class RDMAConnectionPool;
+    friend class gestalt::RDMAConnectionPool;
 
     /* misc */
 
@@ -126,10 +144,8 @@ class Client final : private boost::noncopyable {
     mutable LRUCache<okey, char, gestalt::defaults::client_locator_cache_size> normal_placements;
     /**
      * caches redirected location of object that are not stored at their default
-     * calculated placement, i.e. those require linear search on at least one of
-     * its replica.
-     * @note currently we treat objects that cannot be placed at their default
-     * location as failed insertions, i.e. this cache is currently always empty
+     * calculated placement, i.e. those found or inserted in the search window
+     * past a home slot taken by another key, see ops::Claim
      */
     mutable LRUCache<okey, oloc, gestalt::defaults::client_redirection_cache_size> abnormal_placements;
     inline void erase_oloc_cache(const okey &key)
@@ -143,28 +159,44 @@ public:
      */
     mutable LRUCache<okey, char, static_cast<size_t>(1e4)> collision_set;
 
+    /**
+     * (optional) coalesces concurrent reads on the same key, shared with other
+     * clients of this process, NULL for every read going to remote on its own
+     */
+    shared_ptr<SingleFlight> read_flights;
+
     /* con/dtors */
-public:
-    Client(const filesystem::path &config_path, unsigned id = 114514);
-    /** for now we don't implement HA, cluster map will be static */
-    // void refresh_clustermap();
+protected:
+    ClientBase(const filesystem::path &config_path, unsigned id,
+        shared_ptr<QpMux> mux, const string &bucket_name);
+    ~ClientBase() = default;
 
-    /* I/O interface */
-private:
+    /* cluster map updates */
+protected:
     /**
-     * calculate mapped location
-     * @param key object key
-     * @param[out] need_search do we still need to search for a justified placement
-     * @return ordered set of acting replica location
+     * apply cluster map update pushed by monitor, connecting new servers,
+     * retiring removed ones, and invalidating locator cache entries whose
+     * acting set changed
+     * @note enabled by config `client.watch_clustermap`
      */
-    oloc map(const okey &key, bool &need_search) const;
+    void refresh_clustermap();
+    inline void maybe_refresh_clustermap()
+    {
+        if (node_mapper.has_update())
+            [[unlikely]] refresh_clustermap();
+    }
+    /** weigh placement by capacity of servers, as advertised in cluster map */
+    void weigh_servers();
 
+    /* I/O helpers */
+protected:
     /**
      * Probe for key around all `oloc`s, and justify them to exactly where the
      * object is currently located, or available slots where new object can be
      * inserted. The location will be inserted to locator cache.
-     * @note If Client::map(const okey&, bool&) hinted a search is needed, this
-     * method must be called, otherwise you will be performing a headless overwrite.
+     * @note If BasicClient::map(const okey&, bool&) hinted a search is needed,
+     * this method must be called, otherwise you will be performing a headless
+     * overwrite.
      * @param[in] key object key
      * @param[in,out] ls calculated locators
      * @return 
@@ -181,32 +213,184 @@ private:
     decltype(std::chrono::steady_clock::now()) last_retry_tp;
     void maybe_holdoff_retry() const noexcept;
 
+    /* debug interface */
+public:
+    inline string dump_clustermap() const
+    {
+        return node_mapper.dump_clustermap();
+    }
+
+};  /* class ClientBase */
+
+
+/**
+ * Compile-time configuration of gestalt::BasicClient
+ *
+ * @tparam R replica count, 0 for taking `global.num_replicas` from config at
+ *      runtime
+ * @tparam ReadOp, LockOp, UnlockOp, WriteOp, ClaimOp, FilterOp I/O operation
+ *      implementations
+ * @tparam Slot slot layout, must be the one held by the operations' buffers
+ */
+template <unsigned R = 0,
+    class ReadOp = ops::Read,
+    class LockOp = ops::Lock, class UnlockOp = ops::Unlock,
+    class WriteOp = ops::WriteAPM,
+    class ClaimOp = ops::Claim,
+    class FilterOp = ops::KeyFilter,
+    class Slot = dataslot>
+struct client_traits {
+    static constexpr unsigned num_replicas = R;
+    using read_op_type = ReadOp;
+    using lock_op_type = LockOp;
+    using unlock_op_type = UnlockOp;
+    using write_op_type = WriteOp;
+    using claim_op_type = ClaimOp;
+    using filter_op_type = FilterOp;
+    using slot_type = Slot;
+};
+
+
+/**
+ * BasicClient - the Gestalt storage cluster operator
+ *
+ * I/O operations are concrete members, so the get / put path is free of
+ * dynamic casts and virtual dispatch, and replica count and slot geometry are
+ * compile-time constants where possible.
+ *
+ * @note Not thread-safe, for shared access is controlled accross client by
+ * design, and tackling with inter-thread synchronization would hurt performance
+ * in the common case.
+ *
+ * @tparam Traits see gestalt::client_traits
+ */
+template <class Traits>
+class BasicClient final : public ClientBase {
+public:
+    using traits = Traits;
+    using slot_type = typename traits::slot_type;
+    using read_op_type = typename traits::read_op_type;
+    using lock_op_type = typename traits::lock_op_type;
+    using unlock_op_type = typename traits::unlock_op_type;
+    using write_op_type = typename traits::write_op_type;
+    using claim_op_type = typename traits::claim_op_type;
+    using filter_op_type = typename traits::filter_op_type;
+
+    static_assert(std::is_same_v<
+        std::remove_pointer_t<decltype(std::declval<read_op_type&>().buf.data())>,
+        slot_type>);
+
+    /* con/dtors */
 public:
-    unique_ptr<ops::Base> read_op;
+    /**
+     * @param config_path path to gestalt.conf
+     * @param id client unique ID
+     * @param mux (optional) share QPs of this multiplexer instead of
+     *      connecting servers on its own
+     * @param bucket_name bucket to open, config `client.bucket` if empty
+     */
+    BasicClient(const filesystem::path &config_path, unsigned id = 114514,
+        shared_ptr<QpMux> mux = nullptr, const string &bucket_name = {});
+    /** writes back buffered values, if any */
+    ~BasicClient();
+
+    /* I/O interface */
+private:
+    /**
+     * @return replica count of the bucket
+     */
+    inline unsigned replicas() const noexcept
+    {
+        if constexpr (traits::num_replicas)
+            return traits::num_replicas;
+        else
+            return num_replicas;
+    }
+
+    /**
+     * calculate mapped location
+     * @param key object key
+     * @param[out] need_search do we still need to search for a justified placement
+     * @return ordered set of acting replica location
+     */
+    oloc map(const okey &key, bool &need_search);
+    /**
+     * locators #d slots past #home, on every replica, wrapping around the
+     * extent of the bucket on each server
+     */
+    oloc displace(const oloc &home, size_t d) const;
+    /**
+     * search the window past the home slot of #key on its primary, i.e. up to
+     * `search_length - 1` slots, not wrapping around the bucket
+     * @param home home locators of #key
+     * @param claim claim a free slot of the window if #key is not found
+     * @param[out] d distance of the slot found or claimed from home, see
+     *      displace()
+     * @return see ops::Claim::perform()
+     */
+    int search_window(const okey &key, const oloc &home, bool claim, size_t &d);
+    /**
+     * mark slots of replicas but the primary claimed, taken or not
+     * @return 0, or error of the first claim failed
+     */
+    int claim_replicas(const oloc &locs);
+
+public:
+    unique_ptr<read_op_type> read_op;
     /**
      * perform raw read on #key, data will be stored in #read_op.buf
      * @note if calling this variant, validate data on your own
      * @param key 
-     * @sa Client::get(const char*)
+     * @sa BasicClient::get(const char*)
      */
     int raw_read(const char *key);
     /**
      * perform read on #key
      * @param key 
+     * @note if #read_flights is set, the read may be served by a concurrent
+     *      `get` of the same key from another client
+     * @note with write-back enabled, a buffered value of #key is returned
+     *      without going to remote
      * @return validity of read data
      * * 0 ok
      * * -EINVAL data not found
      */
     int get(const char *key);
+private:
+    /**
+     * validate data fetched by BasicClient::raw_read(const char*)
+     * @sa BasicClient::get(const char*)
+     */
+    int validate_read(const char *key);
+    /**
+     * [collision] read #key from the search window past its home slot, if
+     * the slot just read holds another key
+     * @sa BasicClient::get(const char*)
+     */
+    int read_displaced(const char *key);
+    /**
+     * wait for the leader of flight #f, and take over its result
+     * @sa BasicClient::get(const char*)
+     */
+    int follow_read(const okey &key, SingleFlight::flight &f);
+public:
 
-    unique_ptr<ops::Base> lock_op;
-    unique_ptr<ops::Base> unlock_op;
-    unique_ptr<ops::Base> write_op;
+    unique_ptr<lock_op_type> lock_op;
+    unique_ptr<unlock_op_type> unlock_op;
+    unique_ptr<write_op_type> write_op;
+    /** searches and claims slots through occupancy bitmaps of servers */
+    unique_ptr<claim_op_type> claim_op;
+    /** Reads and updates key filters of servers */
+    unique_ptr<filter_op_type> filter_op;
     /**
      * perform overwrite on #key
      * @note if calling this variant, #write_op must be filled
-     * @note currently collision on any replica will be treated as failed
-     *      insertion, and -EDQUOT is returned.
+     * @note a key whose home slot on the primary is taken goes to a free slot
+     *      of the search window past it, -EDQUOT is returned if there is none;
+     *      collision on replicas is ignored, i.e. an insert takes the slot at
+     *      the same distance on every replica, overwriting whatever key
+     *      already holds it there
+     * @note always writes through, dropping any buffered value of the key
      * @return 
      * * 0 ok
      * * -EDQUOT failed to find a slot to fill
@@ -214,30 +398,89 @@ public:
     int put(void);
     /**
      * perform write (reset) on #key
+     * @note with write-back enabled, the value is only buffered, and errors
+     *      of writing it back are reported by a later call to
+     *      BasicClient::flush(). A value failing with anything but -EBUSY or
+     *      -EAGAIN is dropped from the buffer, i.e. lost, though this call
+     *      returned 0
+     * @throw std::runtime_error if the value takes more than one slot, with
+     *      or without write-back
      * @param key 
      * @param din 
      * @param dlen 
      * @return 
-     * @sa Client::put(void)
+     * @sa BasicClient::put(void)
+     */
+    int put(const char *key, const void *din, size_t dlen);
+    /**
+     * write back all buffered values, no-op if write-back is disabled
+     * @return 0 if all succeeded, otherwise error of the first failed `put`
+     * @note values failing with anything but -EBUSY or -EAGAIN are dropped
+     *      and lost, see gestalt::WriteBackBuffer::drain
      */
-    inline int put(const char *key, const void *din, size_t dlen) {
-        write_op.get()->buf.set(key, din, dlen);
-        return put();
+    inline int flush()
+    {
+        if (!write_back)
+            [[likely]] return 0;
+        return drain_write_back(true);
     }
 
+private:
+    /**
+     * (optional) write-back buffer, NULL for writing through
+     * @note configured by `client.write_back_window_us`,
+     * `client.write_back_max_staleness_us` and `client.write_back_max_entries`,
+     * write-back is enabled if window is non-zero
+     */
+    unique_ptr<WriteBackBuffer> write_back;
+    /**
+     * @param all flush all entries, otherwise only due ones
+     * @sa gestalt::WriteBackBuffer::drain
+     */
+    int drain_write_back(bool all);
+    /** BasicClient::put(void) without touching #write_back */
+    int put_through(void);
+
+    struct cached_filter_block {
+        key_filter::block b;
+        std::chrono::steady_clock::time_point fetched;
+    };
+    /**
+     * [opt::key_filter] key filter blocks of servers, by server ID in the
+     * top 16 bits and block index in the rest, NULL for not consulting key
+     * filters on reads
+     * @note configured by `client.key_filter` and `client.key_filter_ttl_us`,
+     * a block is trusted for as long as the TTL, keys inserted by other
+     * clients meanwhile may be missed
+     */
+    unique_ptr<LRUCache<uint64_t, cached_filter_block,
+        gestalt::defaults::client_filter_cache_size>> filter_cache;
+    std::chrono::microseconds filter_ttl;
+    /**
+     * [opt::key_filter] whether #key may be resident on its primary
+     * @param locs locators of #key
+     * @return 0 may be resident, -EINVAL certainly absent, or error of Reading
+     *      the filter block
+     */
+    int check_filter(const okey &key, const oloc &locs);
+    /**
+     * count #key in the key filters of its replicas, and in cached blocks, so
+     * that this client reads its own inserts
+     * @return 0, or error of the first update failed
+     */
+    int count_in_filters(const okey &key, const oloc &locs);
+public:
+
     /**
      * @note currently we don't implement space allocation (reserve) nor
      * revokation (remove), for while our benchmark is running, the working set
      * remains static, that is just how YCSB works.
      */
 
-    /* debug interface */
-public:
-    inline string dump_clustermap() const
-    {
-        return node_mapper.dump_clustermap();
-    }
+};  /* class BasicClient */
 
-};  /* class Client */
+/** the default client, replica count taken from config */
+using Client = BasicClient<client_traits<>>;
+extern template class BasicClient<client_traits<>>;
 
 }   /* namespace gestalt */
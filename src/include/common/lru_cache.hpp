@@ -59,5 +59,23 @@ public:
                 item_list.splice(item_list.begin(), item_list, it->second);
                 return it->second->second;
         };
+        /**
+         * erase all entries satisfying #pred
+         * @param pred `bool(const KEY_T&, const VAL_T&)`
+         * @return number of entries erased
+         */
+        template <class PRED_T> size_t erase_if(PRED_T &&pred) {
+                size_t erased = 0;
+                for (auto it = item_list.begin(); it != item_list.end(); ) {
+                        if (!pred(it->first, it->second)) {
+                                ++it;
+                                continue;
+                        }
+                        item_map.erase(it->first);
+                        it = item_list.erase(it);
+                        erased++;
+                }
+                return erased;
+        }
 
 };
\ No newline at end of file
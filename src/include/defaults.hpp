@@ -24,12 +24,18 @@ const vector<filesystem::path> config_paths{
 /**
  * maximum entries in a locator cache
  *
- * A cache entry includes a 496B key and optional locators, which are just a
- * small vector of packed three numbers, therefore a cache of maximum 10 million
- * entries will cost us around 2 * 1e7 * 512B ~= 10MB memory, when populated.
+ * A cache entry includes the key (only as long as the key itself, typically a
+ * few dozen bytes) and optional locators, which are just a small vector of
+ * packed three numbers, therefore a cache of maximum 10 million entries will
+ * cost us well under 1e7 * 128B ~= 1.2GB memory, when populated.
  */
 constexpr size_t client_locator_cache_size = 1e7;
 constexpr size_t client_redirection_cache_size = client_locator_cache_size * .1;
+/**
+ * maximum key filter blocks cached, each of 64 B and a timestamp, i.e. some
+ * 10 MB when populated
+ */
+constexpr size_t client_filter_cache_size = 1e5;
 
 }   /* namespace defaults */
 }   /* namespace gestalt */
@@ -3,8 +3,8 @@
  *
  * DataMapper - mapping object key to server nodes in a calculated fashion
  *
- * For now we may only test on limited number of server nodes, data mapping
- * among server nodes is done in a round-robin fashion.
+ * Data mapping among server nodes is done by a placement engine chosen per
+ * bucket, see gestalt::placement::Engine .
  *
  * Final mapping to RDPMA VA is done inside class RDMAConnectionPool .
  */
@@ -15,8 +15,12 @@
 #include <vector>
 #include <unordered_map>
 #include <sstream>
+#include <memory>
+#include <filesystem>
+#include <cstdint>
 
 #include "../spec/dataslot.hpp"
+#include "./placement.hpp"
 
 
 namespace gestalt {
@@ -24,13 +28,18 @@ namespace gestalt {
 using namespace std;
 
 using okey = dataslot::key_type;
-class Client;
+class ClientBase;
+template <class Traits> class BasicClient;
 class RDMAConnectionPool;
+namespace rpc {
+class ServerProp;
+}
 
 
 class DataMapper {
-    Client *client;
-    friend class gestalt::Client;
+    ClientBase *client;
+    friend class gestalt::ClientBase;
+    template <class Traits> friend class gestalt::BasicClient;
 
     struct server_node {
         /**
@@ -41,23 +50,71 @@ class DataMapper {
         } status;
         /** server IP address */
         string addr;
+        /** offset of the bucket into the advertised MR in bytes */
+        size_t bucket_offset;
+        /** length of the bucket in bytes, as registered to monitor */
+        size_t capacity;
+        /** addresses RDMA is served on, one per RNIC or port, at least #addr */
+        vector<string> rdma_addrs;
     public:
-        server_node() noexcept : status(Status::out)
+        server_node() noexcept : status(Status::out), bucket_offset(0), capacity(0)
         { }
-        server_node(const string &_addr) noexcept :
-            status(Status::up), addr(_addr)
+        server_node(const string &_addr, size_t _offset, size_t _cap,
+                vector<string> &&_rdma_addrs) :
+            status(Status::up), addr(_addr), bucket_offset(_offset), capacity(_cap),
+            rdma_addrs(_rdma_addrs.empty() ? vector<string>{_addr} : std::move(_rdma_addrs))
         { }
         server_node(const server_node &other) = default;
         server_node &operator=(const server_node &other) = default;
     };
     /** map of candicate servers for `client`'s bucket, server ID -> property */
     unordered_map<unsigned, server_node> server_map;
+    /**
+     * describe server #s if it serves #bucket
+     * @param[out] out server with the extent of #bucket
+     * @return whether #s serves #bucket
+     */
+    static bool make_node(const rpc::ServerProp &s, const string &bucket,
+        server_node &out);
     /**
      * rank of server, same of that calculated and returned by monitor on a
      * given bucket
-     * @note we actually only have one bucket now
      */
     vector<unsigned> server_rank;
+    /**
+     * placement engine of the bucket, config `placement` of its section,
+     * defaulting to `global.placement`
+     */
+    placement::Engine engine = placement::Engine::modulo;
+    /**
+     * weights of servers in #server_rank, proportional to their capacity,
+     * empty for uniform
+     */
+    vector<double> server_weight;
+    /** cluster map epoch, as numbered by monitor */
+    uint64_t epoch = 0;
+
+    /**
+     * background watch on monitor's cluster map, holding the latest map pushed
+     * until the owning client applies it
+     */
+    struct watcher_t;
+    unique_ptr<watcher_t> watcher;
+    watcher_t &ensure_watcher();
+
+    /** persisted cluster map, see config `client.bootstrap_cache` */
+    filesystem::path cache_path;
+    /**
+     * take cluster map from #cache_path, leaving it to be validated against
+     * monitor in background
+     * @return false if not cached, or cache unusable
+     */
+    bool load_cache();
+    /**
+     * fetch cluster map from monitor, and queue it as an update if it differs
+     * from the cached one, without blocking
+     */
+    void validate_in_background();
 public:
     /**
      * type of DataMapper calculated output, which is just an array of server ID
@@ -67,34 +124,102 @@ public:
 
     /* con/dtors */
 public:
-    DataMapper() noexcept : client(nullptr)
-    { }
+    DataMapper() noexcept;
     /**
      * initializer, DataMapper is move-constructed
      * @private
-     * @param _c parent gestalt::Client
+     * @param _c parent gestalt::ClientBase
      */
-    explicit DataMapper(Client *_c);
+    explicit DataMapper(ClientBase *_c);
     DataMapper(const DataMapper &) = delete;
     DataMapper &operator=(const DataMapper &) = delete;
-    DataMapper &operator=(DataMapper &&tmp) = default;
-    ~DataMapper()
-    { }
+    DataMapper &operator=(DataMapper &&tmp) noexcept;
+    ~DataMapper();
 
     /* interface */
 public:
     /**
      * Get server nodes responsible for some object key
      *
-     * Simple linear-probe.
-     *
-     * @param khx object key (okey) hash
+     * @param khx object key (okey) placement hash, see
+     *      gestalt::dataslot_key_digest
      * @param r replica count
      * @return ordered acting set of size `r`, if smaller than `r` then something
      * is wrong.
      */
     acting_set map(uint32_t khx, unsigned r) const;
+
+    /**
+     * inputs of placement, detached from DataMapper, so that placement of
+     * an older cluster map can still be calculated
+     */
+    struct placement_view {
+        placement::Engine engine;
+        /**
+         * every server of the rank, usable or not, for the modulus of modulo
+         * and jump placement to stay what map(uint32_t, unsigned) const used
+         */
+        vector<unsigned> rank;
+        /** empty for uniform */
+        vector<double> weight;
+        /** servers of #rank not up, skipped as map(uint32_t, unsigned) const does */
+        vector<unsigned> down;
+    };
+    placement_view view() const;
+    /**
+     * @sa map(uint32_t, unsigned) const
+     */
+    static acting_set map(const placement_view &v, uint32_t khx, unsigned r);
+
     void mark_out(unsigned id);
+    /**
+     * weigh servers by capacity, so that expected load factor is equal
+     * across servers
+     * @note only effective with placement::Engine::rendezvous , and unless
+     *      config `global.placement_weights` is `uniform`
+     * @param capacity server ID -> number of slots, servers not listed keep
+     *      a weight of average capacity
+     */
+    void weigh(const unordered_map<unsigned, size_t> &capacity);
+
+    /* cluster map updates */
+
+    inline uint64_t get_epoch() const noexcept
+    {
+        return epoch;
+    }
+    /**
+     * start following cluster map changes pushed by monitor
+     * @note updates are only buffered, the owning client applies them with
+     *      apply_update(update&) on its own thread
+     */
+    void watch();
+    /**
+     * @return whether a newer cluster map is waiting to be applied
+     */
+    bool has_update() const noexcept;
+    /** membership change of an applied update */
+    struct update {
+        uint64_t epoch;
+        vector<unsigned> added;
+        vector<unsigned> removed;
+    };
+    /**
+     * apply the latest cluster map pushed by monitor
+     * @note server weights are reset, re-weigh after connecting new servers
+     * @param[out] u membership change
+     * @return whether cluster map advanced
+     */
+    bool apply_update(update &u);
+
+    /* bootstrap cache */
+
+    /**
+     * persist cluster map to #cache_path, no-op if disabled
+     * @note atomically replaces the cache, clients of other processes may be
+     *      reading or writing it at the same time
+     */
+    void save_cache() const;
 
     inline string dump_clustermap() const
     {
@@ -121,10 +246,13 @@ public:
                 break;
             }
             os << ", ";
-            os << "addr=" << s.addr
-                << "), ";
+            os << "addr=" << s.addr;
+            if (!server_weight.empty())
+                os << ", weight=" << server_weight[r];
+            os << "), ";
         }
-        os << "]";
+        os << "], placement=" << placement::engine_name(engine)
+            << ", epoch=" << epoch;
         return os.str();
     }
 
@@ -14,6 +14,7 @@
 
 #include "../spec/bufferlist.hpp"
 #include "../spec/params.hpp"
+#include "./qp_mux.hpp"
 #include "optim.hpp"
 
 
@@ -57,6 +58,11 @@ protected:
      * @sa gestalt::optimization::batched_poll
      */
     ibv_cq *scq;
+    /**
+     * (optional) multiplexer #id belongs to, work requests are submitted
+     * through it instead of posted directly
+     */
+    QpMux *mux = nullptr;
 
     /* c/dtor */
 public:
@@ -107,6 +113,8 @@ protected:
         const ibv_send_wr *wr,
         ibv_send_wr* &bad_wr, ibv_wc &wc) const noexcept
     {
+        if (mux)
+            [[unlikely]] return mux->perform(id, wr, wc);
         if (ibv_post_send(id->qp, const_cast<ibv_send_wr*>(wr), &bad_wr))
             [[unlikely]] return -EBADR;
         for (unsigned retry = max_poll; true || retry; --retry) {
@@ -115,7 +123,7 @@ protected:
                 r = ibv_poll_cq(scq, 1, &wc);
             }
             else {
-                r = ibv_poll_cq(id->send_cq, 1, &wc);
+                r = ibv_poll_cq(id->qp->send_cq, 1, &wc);
             }
             if (r == 1)
                 [[likely]] return 0;
@@ -147,6 +155,14 @@ protected:
         return r;
     }
 public:
+    /**
+     * submit work requests through #m from now on
+     * @note #buf must be registered to the PD of #m
+     */
+    inline void multiplex(QpMux *m) noexcept
+    {
+        mux = m;
+    }
     /**
      * should be implemented as wrapper around
      * perform(const ibv_send_wr *wr, ibv_send_wr*&, ibv_wc&) while taking
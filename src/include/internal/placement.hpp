@@ -0,0 +1,203 @@
+/**
+ * @file placement.hpp
+ *
+ * Placement engines - choosing acting servers of an object key from the
+ * ranked server list of a bucket
+ *
+ * All engines are pure functions of the placement hash and the server rank, so
+ * that every client (and the simulation tool) agrees on the mapping without
+ * communicating.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+
+#include "../spec/dataslot.hpp"
+
+
+namespace gestalt {
+namespace placement {
+
+using namespace std;
+
+enum class Engine {
+    /**
+     * `(hash + i) % N`, legacy round-robin, remaps nearly every key on any
+     * membership change
+     */
+    modulo,
+    /**
+     * Jump consistent hash (Lamping & Veach), moves ~1/N keys when servers are
+     * appended to or removed from the tail of the rank
+     */
+    jump,
+    /**
+     * Rendezvous (highest random weight) hashing, moves ~1/N keys when any
+     * server joins or leaves, the only engine honoring server weights
+     */
+    rendezvous,
+};
+
+inline Engine parse_engine(const string &name)
+{
+    if (name == "modulo")
+        return Engine::modulo;
+    if (name == "jump")
+        return Engine::jump;
+    if (name == "rendezvous")
+        return Engine::rendezvous;
+    throw std::invalid_argument("unknown placement engine " + name);
+}
+
+inline const char *engine_name(Engine e) noexcept
+{
+    switch (e) {
+    case Engine::modulo:
+        return "modulo";
+    case Engine::jump:
+        return "jump";
+    case Engine::rendezvous:
+        return "rendezvous";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @param key 64-bit key hash
+ * @param buckets number of buckets, positive
+ * @return bucket in [0, buckets)
+ */
+constexpr int32_t jump_consistent_hash(uint64_t key, int32_t buckets) noexcept
+{
+    int64_t b = -1, j = 0;
+    while (j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ull + 1;
+        j = static_cast<int64_t>((b + 1) * (double(1ll << 31) / double((key >> 33) + 1)));
+    }
+    return b;
+}
+
+/**
+ * @param khx placement hash of object key
+ * @param id server ID
+ * @return weight of server #id for the key, highest wins
+ */
+constexpr uint64_t rendezvous_score(uint32_t khx, unsigned id) noexcept
+{
+    return dataslot_key_digest::mix((uint64_t(khx) << 32) ^ id);
+}
+
+/**
+ * @param khx placement hash of object key
+ * @param id server ID
+ * @param w weight of server #id, positive
+ * @return weighted score, servers win keys in proportion to their weights
+ * @see Schindelhauer & Schomaker, "Weighted distributed hash tables"
+ */
+inline double weighted_rendezvous_score(uint32_t khx, unsigned id, double w) noexcept
+{
+    /* uniform in (0, 1) */
+    const double u = (rendezvous_score(khx, id) + .5) * 0x1p-64;
+    return -w / std::log(u);
+}
+
+/**
+ * Calculate acting set
+ * @param e engine
+ * @param khx placement hash of object key, see gestalt::dataslot_key_digest
+ * @param rank ranked server IDs of the bucket
+ * @param r replica count
+ * @param usable `bool(unsigned id)`, whether a server may take I/O
+ * @param[out] out acting set, ordered by replica rank, smaller than #r if not
+ *      enough usable servers
+ * @param weights (optional) weights of servers in #rank, ignored by engines
+ *      other than Engine::rendezvous
+ */
+template <class Pred>
+void place(Engine e, uint32_t khx, const vector<unsigned> &rank, unsigned r,
+        Pred &&usable, vector<unsigned> &out,
+        const vector<double> *weights = nullptr)
+{
+    out.clear();
+    const size_t n = rank.size();
+    if (!n || !r)
+        [[unlikely]] return;
+
+    const auto taken = [&out] (unsigned id) {
+        for (const auto &o : out)
+            if (o == id)
+                return true;
+        return false;
+    };
+
+    switch (e) {
+    case Engine::jump: {
+        /* one jump per replica, each with its own key, falling back to linear
+            probing only if servers are out or the rank is too short */
+        for (unsigned i = 0; i < 4 * n && out.size() < r; i++) {
+            const uint64_t k = dataslot_key_digest::mix(
+                (uint64_t(khx) << 32) ^ (uint64_t(i) * 0x9e3779b97f4a7c15ull));
+            const unsigned id = rank[jump_consistent_hash(k, n)];
+            if (taken(id) || !usable(id))
+                [[unlikely]] continue;
+            out.push_back(id);
+        }
+        if (out.size() >= r)
+            [[likely]] break;
+        [[fallthrough]];
+    }
+    case Engine::modulo: {
+        for (size_t off = 0; off < n && out.size() < r; ++off) {
+            const unsigned id = rank[(off + khx) % n];
+            if (taken(id) || !usable(id))
+                [[unlikely]] continue;
+            out.push_back(id);
+        }
+        break;
+    }
+    case Engine::rendezvous: {
+        /* partial selection of top-r scores, r is tiny */
+        const auto select = [&] (auto score_fn) {
+            vector<pair<decltype(score_fn(0u, size_t(0))), unsigned>> top;
+            top.reserve(r + 1);
+            for (size_t i = 0; i < n; i++) {
+                const auto id = rank[i];
+                if (!usable(id))
+                    [[unlikely]] continue;
+                const auto s = score_fn(id, i);
+                if (top.size() == r && s <= top.back().first)
+                    continue;
+                auto it = top.begin();
+                while (it != top.end() && it->first >= s)
+                    ++it;
+                top.insert(it, {s, id});
+                if (top.size() > r)
+                    top.pop_back();
+            }
+            for (const auto &[s, id] : top)
+                out.push_back(id);
+        };
+        if (weights)
+            select([&] (unsigned id, size_t i) {
+                return weighted_rendezvous_score(khx, id, (*weights)[i]);
+            });
+        else
+            [[likely]] select([&] (unsigned id, size_t) {
+                return rendezvous_score(khx, id);
+            });
+        break;
+    }
+    default:
+        throw std::invalid_argument("placement engine");
+    }
+}
+
+}   /* namespace placement */
+}   /* namespace gestalt */
@@ -0,0 +1,459 @@
+/**
+ * @file qp_mux.hpp
+ *
+ * Multiplexing I/O of many client threads onto a few QPs per server
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+
+#include <boost/core/noncopyable.hpp>
+#include <rdma/rdma_cma.h>
+
+#include "../common/boost_log_helper.hpp"
+
+
+namespace gestalt {
+
+using namespace std;
+
+
+/**
+ * SubmissionRing - bounded lock-free MPMC queue (Vyukov)
+ *
+ * Producers are application threads, the consumer is whichever thread holds
+ * the channel the ring belongs to.
+ *
+ * @tparam T trivially copyable
+ * @tparam N capacity, power of 2
+ */
+template <class T, size_t N>
+class SubmissionRing : private boost::noncopyable {
+    static_assert(N && !(N & (N - 1)), "capacity must be power of 2");
+
+    struct cell {
+        atomic<size_t> seq;
+        T v;
+    };
+    alignas(64) cell cells[N];
+    alignas(64) atomic<size_t> head = 0;
+    alignas(64) atomic<size_t> tail = 0;
+
+public:
+    SubmissionRing() noexcept
+    {
+        for (size_t i = 0; i < N; i++)
+            cells[i].seq.store(i, memory_order_relaxed);
+    }
+
+    /**
+     * @return false if full
+     */
+    inline bool push(const T &v) noexcept
+    {
+        size_t pos = head.load(memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &cells[pos & (N - 1)];
+            const auto diff = intptr_t(c->seq.load(memory_order_acquire)) - intptr_t(pos);
+            if (!diff) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    [[likely]] break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = head.load(memory_order_relaxed);
+        }
+        c->v = v;
+        c->seq.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @return false if empty
+     */
+    inline bool pop(T &v) noexcept
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &cells[pos & (N - 1)];
+            const auto diff = intptr_t(c->seq.load(memory_order_acquire)) - intptr_t(pos + 1);
+            if (!diff) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    [[likely]] break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = tail.load(memory_order_relaxed);
+        }
+        v = c->v;
+        c->seq.store(pos + N, memory_order_release);
+        return true;
+    }
+};
+
+
+/**
+ * QpMux - lets client threads of a process share a small pool of QPs
+ *
+ * Every client holding its own RC QP to every server makes QP count grow with
+ * thread count, thrashing the QP context cache of server RNICs. With a QpMux,
+ * clients connect each server only once per process, with #lanes QPs, and
+ * submit work requests into the lock-free ring of a QP instead of posting
+ * them.
+ *
+ * There is no dedicated progress thread. A submitter (or waiter) that finds
+ * the QP idle takes it over, posts everything queued in one batched
+ * `ibv_post_send()`, and reaps completions on behalf of everyone, routing them
+ * back to their requests by `wr_id`.
+ *
+ * One instance is meant to be shared by all clients of a process, e.g. one per
+ * benchmark, and must outlive them.
+ *
+ * @sa gestalt::ClientBase::qp_mux
+ */
+class QpMux : private boost::noncopyable {
+public:
+    /** send queue depth of multiplexed QPs */
+    static constexpr unsigned sq_depth = 256;
+    /** requests posted by one `ibv_post_send()` at most */
+    static constexpr unsigned max_batch = 32;
+    /** pending requests per QP */
+    static constexpr size_t ring_size = 1024;
+    /**
+     * work requests per request, i.e. chain length of an op, e.g. ops::Claim
+     * Reading a whole search window
+     */
+    static constexpr unsigned max_wr = 8;
+
+    struct channel;
+
+    /**
+     * work request chain of one op, owned by the submitter, must stay alive
+     * until waited
+     * @note like any op, the chain must generate one and only one work
+     *      completion
+     */
+    struct request {
+        /** private copy, the op may re-parameterize its own right away */
+        ibv_send_wr wrs[max_wr];
+        unsigned nwr;
+        channel *ch;
+        /** index of channel::outstanding holding this request while posted */
+        unsigned slot;
+        /** not yet completed */
+        atomic<bool> pending;
+        /** 0 ok, or see ops::Base::perform(const ibv_send_wr*, ibv_send_wr*&, ibv_wc&) */
+        int r;
+        /** first unhealthy work completion, if any */
+        ibv_wc wc;
+    };
+
+    /** submission side of a QP */
+    struct channel : private boost::noncopyable {
+        rdma_cm_id *id;
+        SubmissionRing<request*, ring_size> ring;
+        /** taken by the thread currently posting and reaping for this QP */
+        atomic_flag busy = ATOMIC_FLAG_INIT;
+        /** work requests posted, not yet retired */
+        atomic<unsigned> inflight = 0;
+        /**
+         * requests posted, not yet retired, for the send queue holds no more
+         * than #sq_depth; clearing its slot is what retires a request, so that
+         * a request is retired only once, see retire()
+         */
+        atomic<request*> outstanding[sq_depth] = {};
+        /** where to look for a free slot of #outstanding, guarded by #busy */
+        unsigned cursor = 0;
+        /** popped from #ring but did not fit into send queue, guarded by #busy */
+        request *held = nullptr;
+    public:
+        explicit channel(rdma_cm_id *_id) noexcept : id(_id)
+        { }
+    };
+
+    /** client ID the shared QPs are connected with */
+    const unsigned id;
+    /** QPs per server */
+    const unsigned lanes;
+
+private:
+    struct __IbvPdDeleter {
+        inline void operator()(ibv_pd *pd)
+        {
+            if (ibv_dealloc_pd(pd))
+                boost_log_errno_throw(ibv_dealloc_pd);
+        }
+    };
+    ibv_context **devices;
+    shared_ptr<ibv_pd> _pd;
+
+    struct server_slot {
+        /** serializes connecting the same server */
+        mutex m;
+        /** connections to the server, type erased */
+        shared_ptr<const void> region;
+    };
+    mutex m;
+    unordered_map<unsigned, shared_ptr<server_slot>> servers;
+    /**
+     * channels, addressed by `rdma_cm_id::context` of their QP
+     * @note channels of retired servers stay until the multiplexer goes away
+     */
+    vector<unique_ptr<channel>> channels;
+
+public:
+    /** number of requests posted */
+    atomic<unsigned long long> posted = 0;
+    /** number of `ibv_post_send()` calls, #posted / #post_calls is batch size */
+    atomic<unsigned long long> post_calls = 0;
+
+    /* c/dtor */
+public:
+    /**
+     * @param _id client ID to connect servers with, must not be used by any
+     *      other client
+     * @param _lanes QPs per server
+     */
+    QpMux(unsigned _id, unsigned _lanes = 2) : id(_id), lanes(_lanes)
+    {
+        if (!lanes)
+            throw std::invalid_argument("lanes");
+        devices = rdma_get_devices(NULL);
+        if (!devices) {
+            BOOST_LOG_TRIVIAL(fatal) << "No RNIC found!";
+            throw std::runtime_error("no RNIC");
+        }
+        ibv_pd *pd = ibv_alloc_pd(devices[0]);
+        if (!pd)
+            boost_log_errno_throw(ibv_alloc_pd);
+        _pd.reset(pd, __IbvPdDeleter());
+    }
+    ~QpMux()
+    {
+        servers.clear();
+        _pd.reset();
+        rdma_free_devices(devices);
+    }
+
+    /* connection management */
+public:
+    /**
+     * PD of shared QPs, buffers of multiplexed ops must be registered here
+     */
+    inline const shared_ptr<ibv_pd> &pd() const noexcept
+    {
+        return _pd;
+    }
+
+    /**
+     * get connections to #server_id, connecting on first use
+     * @param[out] out connections
+     * @param connect `int(shared_ptr<const T>&)`, sets up connections, called
+     *      once per server unless failed
+     * @return 0 ok, or error of #connect
+     */
+    template <class T, class F>
+    int share(unsigned server_id, shared_ptr<const T> &out, F &&connect)
+    {
+        shared_ptr<server_slot> s;
+        {
+            lock_guard l(m);
+            auto &p = servers[server_id];
+            if (!p)
+                p = make_shared<server_slot>();
+            s = p;
+        }
+
+        lock_guard l(s->m);
+        if (!s->region) {
+            shared_ptr<const T> created;
+            if (int r = connect(created); r)
+                [[unlikely]] return r;
+            s->region = std::move(created);
+        }
+        out = static_pointer_cast<const T>(s->region);
+        return 0;
+    }
+    /**
+     * drop connections to #server_id, they go away once no client uses them
+     */
+    inline void forget(unsigned server_id)
+    {
+        lock_guard l(m);
+        servers.erase(server_id);
+    }
+    /**
+     * make QP of #ep multiplexed, called on shared connections before use
+     */
+    inline void attach(rdma_cm_id *ep)
+    {
+        lock_guard l(m);
+        ep->context = channels.emplace_back(make_unique<channel>(ep)).get();
+    }
+
+    /* data path */
+public:
+    /**
+     * queue #wr for posting to QP of #ep
+     * @param ep multiplexed connection, see attach()
+     * @param[out] req request to wait on, see wait()
+     * @param wr work request chain, at most #max_wr long, copied
+     * @return 0 ok, or -E2BIG if #wr is longer than #max_wr, nothing is queued
+     */
+    inline int submit(rdma_cm_id *ep, request &req, const ibv_send_wr *wr) noexcept
+    {
+        auto &ch = *static_cast<channel*>(ep->context);
+        unsigned n = 0;
+        for (; wr; wr = wr->next, n++) {
+            if (n == max_wr)
+                [[unlikely]] return -E2BIG;
+            auto &w = req.wrs[n];
+            w = *wr;
+            /* unsignaled WRs only complete in error, after the request has been
+                retired by its signaled one, skip them */
+            w.wr_id = w.send_flags & IBV_SEND_SIGNALED ?
+                reinterpret_cast<uintptr_t>(&req) : 0;
+            if (n)
+                req.wrs[n - 1].next = &w;
+        }
+        req.wrs[n - 1].next = NULL;
+        req.nwr = n;
+        req.ch = &ch;
+        req.r = 0;
+        req.pending.store(true, memory_order_relaxed);
+
+        while (!ch.ring.push(&req))
+            [[unlikely]] progress(ch);
+        progress(ch);
+        return 0;
+    }
+
+    /**
+     * wait for #req, helping progress its QP meanwhile
+     * @param[out] wc unhealthy work completion, if any
+     * @return see ops::Base::perform(const ibv_send_wr*, ibv_send_wr*&, ibv_wc&)
+     */
+    inline int wait(request &req, ibv_wc &wc) noexcept
+    {
+        while (req.pending.load(memory_order_acquire))
+            progress(*req.ch);
+        if (req.r)
+            [[unlikely]] wc = req.wc;
+        return req.r;
+    }
+
+    inline int perform(rdma_cm_id *ep, const ibv_send_wr *wr, ibv_wc &wc) noexcept
+    {
+        request req;
+        if (int r = submit(ep, req, wr); r)
+            [[unlikely]] return r;
+        return wait(req, wc);
+    }
+
+private:
+    /** complete #req, already taken off channel::outstanding */
+    static inline void finish(request &req, int r) noexcept
+    {
+        auto &ch = *req.ch;
+        const auto nwr = req.nwr;
+        req.r = r;
+        req.pending.store(false, memory_order_release);
+        ch.inflight.fetch_sub(nwr, memory_order_relaxed);
+    }
+    /** complete #req, unless retired already by a sweep of a broken CQ */
+    static inline void retire(request &req, int r) noexcept
+    {
+        request *expected = &req;
+        if (req.ch->outstanding[req.slot].compare_exchange_strong(
+                expected, nullptr, memory_order_acq_rel))
+            [[likely]] finish(req, r);
+    }
+
+    /**
+     * post queued requests of #ch in one batch and reap completions, no-op if
+     * some other thread is already on it
+     */
+    void progress(channel &ch) noexcept
+    {
+        if (ch.busy.test_and_set(memory_order_acquire))
+            return;
+
+        /* 1. drain ring into one chain, as far as the send queue allows */
+        request *batch[max_batch];
+        unsigned n = 0, nwr = 0;
+        unsigned room = sq_depth - ch.inflight.load(memory_order_relaxed);
+        for (request *req; n < max_batch; ) {
+            if (ch.held)
+                [[unlikely]] req = std::exchange(ch.held, nullptr);
+            else if (!ch.ring.pop(req))
+                break;
+            if (req->nwr > room) {
+                [[unlikely]] ch.held = req;
+                break;
+            }
+            room -= req->nwr;
+            nwr += req->nwr;
+            /* a free slot is due, requests are no more than WRs in flight */
+            while (ch.outstanding[ch.cursor % sq_depth].load(memory_order_relaxed))
+                ch.cursor++;
+            req->slot = ch.cursor++ % sq_depth;
+            ch.outstanding[req->slot].store(req, memory_order_release);
+            if (n)
+                batch[n - 1]->wrs[batch[n - 1]->nwr - 1].next = req->wrs;
+            batch[n++] = req;
+        }
+        if (n) {
+            ch.inflight.fetch_add(nwr, memory_order_relaxed);
+            ibv_send_wr *bad_wr;
+            unsigned k = n;
+            if (ibv_post_send(ch.id->qp, batch[0]->wrs, &bad_wr)) [[unlikely]] {
+                /* requests from the one containing #bad_wr on were not posted */
+                k = 0;
+                while (k < n && !(bad_wr >= batch[k]->wrs && bad_wr < batch[k]->wrs + batch[k]->nwr))
+                    k++;
+                for (unsigned i = k; i < n; i++)
+                    retire(*batch[i], -EBADR);
+            }
+            if (k) {
+                [[likely]] posted.fetch_add(k, memory_order_relaxed);
+                post_calls.fetch_add(1, memory_order_relaxed);
+            }
+        }
+
+        /* 2. reap, the CQ may be shared with other QPs of the server */
+        ibv_wc wcs[16];
+        const int c = ibv_poll_cq(ch.id->qp->send_cq, 16, wcs);
+        for (int i = 0; i < c; i++) {
+            if (!wcs[i].wr_id)
+                [[unlikely]] continue;
+            auto &req = *reinterpret_cast<request*>(wcs[i].wr_id);
+            if (wcs[i].status != IBV_WC_SUCCESS) [[unlikely]] {
+                req.wc = wcs[i];
+                retire(req, -ECANCELED);
+            }
+            else
+                [[likely]] retire(req, 0);
+        }
+        if (c < 0) [[unlikely]] {
+            /* CQ broken, nothing posted here will ever complete, in this batch
+                or any earlier one */
+            for (auto &o : ch.outstanding)
+                if (const auto req = o.exchange(nullptr, memory_order_acq_rel); req)
+                    finish(*req, -ECOMM);
+        }
+
+        ch.busy.clear(memory_order_release);
+    }
+};
+
+}   /* namespace gestalt */
@@ -5,8 +5,10 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 #include <filesystem>
 #include <memory>
+#include <algorithm>
 #include <arpa/inet.h>
 
 #include "../common/boost_log_helper.hpp"
@@ -14,6 +16,8 @@
 #include <rdma/rdma_cma.h>
 
 #include "../spec/dataslot.hpp"
+#include "../spec/session.hpp"
+#include "../spec/key_filter.hpp"
 
 
 namespace gestalt {
@@ -21,12 +25,14 @@ namespace gestalt {
 using namespace std;
 
 using okey = dataslot::key_type;
-class Client;
+class ClientBase;
+template <class Traits> class BasicClient;
 
 
 class RDMAConnectionPool {
-    Client *client;
-    friend class gestalt::Client;
+    ClientBase *client;
+    friend class gestalt::ClientBase;
+    template <class Traits> friend class gestalt::BasicClient;
 
     struct __RdmaConnDeleter {
         inline void operator()(rdma_cm_id *ep)
@@ -37,30 +43,209 @@ class RDMAConnectionPool {
             rdma_destroy_ep(ep);
         }
     };
+    struct __IbvCqDeleter {
+        inline void operator()(ibv_cq *cq)
+        {
+            if (ibv_destroy_cq(cq))
+                boost_log_errno_throw(ibv_destroy_cq);
+        }
+    };
+    using conn_ptr = unique_ptr<rdma_cm_id, __RdmaConnDeleter>;
+public:
     struct memory_region {
         /** VA on remote */
         uintptr_t addr;
         size_t length;
         size_t slots;
-        uint32_t rkey;
-        /** RDMA connection */
-        unique_ptr<rdma_cm_id, __RdmaConnDeleter> conn;
+        /**
+         * rkeys of the MRs the remote space is registered as, per QP of #qps,
+         * for QPs to different RNICs of the server see different MRs; MRs are
+         * contiguous chunks of #chunk_length bytes each, the last one may be
+         * shorter
+         */
+        vector<vector<uint32_t>> rkeys;
+        size_t chunk_length;
+        /**
+         * index region of the remote table, i.e. the occupancy bitmap at
+         * #bitmap_addr followed by #filter_blocks blocks of key filter at
+         * #filter_addr, and its rkey per QP of #qps, see
+         * session::conn_reply::index
+         */
+        uintptr_t bitmap_addr;
+        uintptr_t filter_addr;
+        size_t filter_blocks;
+        vector<uint32_t> index_rkeys;
+        /** current generation of the remote table, see session::conn_reply */
+        uint8_t generation;
+        /** durability of the remote memory, decides whether writes are flushed */
+        session::durability durability;
+        /**
+         * RDMA endpoints of the server, QP #i of #qps is connected to endpoint
+         * #i % #endpoints, and #qps is a multiple of it
+         */
+        size_t endpoints;
+        /**
+         * send CQ shared by all of #conns, NULL if each connection polls its
+         * own (single QP) or gestalt::optimization::batched_poll is on
+         * @note declared before #conns, QPs go before their CQ
+         */
+        unique_ptr<ibv_cq, __IbvCqDeleter> cq;
+        /** RDMA connections, i.e. QPs, to the same server */
+        vector<conn_ptr> conns;
+        /** QPs operations go to, those of #conns, or of #shared */
+        vector<rdma_cm_id*> qps;
+        /** [mux] connections of a gestalt::QpMux, empty #conns if set */
+        shared_ptr<const memory_region> shared;
+        /** next QP for round-robin striping */
+        mutable unsigned rr = 0;
     public:
-        memory_region() noexcept : length(0), conn(nullptr)
+        memory_region() noexcept : length(0), chunk_length(0),
+            bitmap_addr(0), filter_addr(0), filter_blocks(0), generation(0),
+            durability(session::durability::power_fail), endpoints(1)
         { }
         memory_region(
-                uintptr_t _addr, size_t _len, uint32_t _rkey,
-                decltype(conn) &&_conn) noexcept :
-            addr(_addr), length(_len), slots(length / sizeof(dataslot)), rkey(_rkey),
-            conn(std::move(_conn))
+                uintptr_t _addr, size_t _len,
+                decltype(rkeys) &&_rkeys, size_t _chunk_len,
+                uintptr_t _bitmap_addr, uintptr_t _filter_addr, size_t _filter_blocks,
+                decltype(index_rkeys) &&_index_rkeys, uint8_t _gen,
+                session::durability _durability, size_t _endpoints,
+                decltype(cq) &&_cq, decltype(conns) &&_conns) :
+            addr(_addr), length(_len), slots(length / sizeof(dataslot)),
+            rkeys(std::move(_rkeys)), chunk_length(_chunk_len),
+            bitmap_addr(_bitmap_addr), filter_addr(_filter_addr),
+            filter_blocks(_filter_blocks), index_rkeys(std::move(_index_rkeys)),
+            generation(_gen), durability(_durability), endpoints(_endpoints),
+            cq(std::move(_cq)), conns(std::move(_conns))
+        {
+            for (const auto &c : conns)
+                qps.push_back(c.get());
+        }
+        /**
+         * view of connections owned by someone else
+         */
+        explicit memory_region(shared_ptr<const memory_region> &&o) :
+            addr(o->addr), length(o->length), slots(o->slots),
+            rkeys(o->rkeys), chunk_length(o->chunk_length),
+            bitmap_addr(o->bitmap_addr), filter_addr(o->filter_addr),
+            filter_blocks(o->filter_blocks), index_rkeys(o->index_rkeys),
+            generation(o->generation), durability(o->durability),
+            endpoints(o->endpoints), qps(o->qps), shared(std::move(o))
         { }
         memory_region(memory_region &&tmp) = default;
         memory_region &operator=(memory_region &&tmp) = default;
         ~memory_region()
         { }
+
+        /**
+         * whether there are QPs to operate on, owned or those of #shared,
+         * @note #conns is empty for a view
+         */
+        inline bool connected() const noexcept
+        {
+            return !qps.empty();
+        }
+
+        /**
+         * rkey of the MR covering remote #raddr, as seen by QP #lane
+         * @note a data slot never spans two MRs
+         */
+        inline uint32_t rkey(unsigned lane, uintptr_t raddr) const noexcept
+        {
+            const auto &k = rkeys[lane];
+            if (k.size() == 1)
+                [[likely]] return k[0];
+            return k[(raddr - addr) / chunk_length];
+        }
+        /** index of the slot at remote #raddr, i.e. its bit in the bitmap */
+        inline size_t slot_index(uintptr_t raddr) const noexcept
+        {
+            return (raddr - addr) / sizeof(dataslot);
+        }
+
+        /**
+         * choose a QP, i.e. index of #qps, for operating on remote #raddr
+         * @param raddr remote address, operations on the same data slot stay
+         *      on the same QP when striping by key
+         * @param by_key stripe by key, otherwise round robin
+         */
+        inline unsigned lane(uintptr_t raddr, bool by_key) const noexcept
+        {
+            const size_t n = qps.size();
+            if (n == 1)
+                [[likely]] return 0;
+            if (by_key)
+                return (raddr - addr) / sizeof(dataslot) % n;
+            return rr++ % n;
+        }
+        /**
+         * choose a QP for atomics on the data slot at remote #raddr, whatever
+         * the striping, so that atomics on a slot from every client take the
+         * same RNIC of the server, i.e. endpoint slot index % #endpoints
+         */
+        inline unsigned atomic_lane(uintptr_t raddr) const noexcept
+        {
+            return lane(raddr, true);
+        }
+        /**
+         * choose a QP for atomics on the index region, i.e. one connected to
+         * endpoint 0, for the index is registered per RNIC and a search may
+         * claim any of the words it read
+         * @param index index of the slot operated on, spreads over QPs
+         */
+        inline unsigned index_lane(size_t index) const noexcept
+        {
+            return index % (qps.size() / endpoints) * endpoints;
+        }
     };
+private:
     /** session pool, server ID -> MR fields */
     unordered_map<unsigned, memory_region> pool;
+    /** connect on first use, see config `client.connect` */
+    bool lazy = false;
+    /** QPs per server, see config `client.qps_per_server` */
+    unsigned lanes = 1;
+    /**
+     * stripe operations across QPs of a server by key (default), or round
+     * robin, see config `client.qp_striping`
+     */
+    bool stripe_by_key = true;
+
+    /**
+     * set up connection to server #server_id, without touching #pool, the MR
+     * is carried in private data of the RDMA CM handshake
+     * @note with gestalt::ClientBase::qp_mux set, connections are shared with
+     *      other clients of the multiplexer
+     * @note thread-safe, may be run concurrently for different servers
+     * @param[out] out connected MR
+     * @return 0 ok, or negative errno of rdma_connect()
+     */
+    int establish(unsigned server_id, memory_region &out) const;
+    /**
+     * @param client_id ID to connect as
+     * @param nr_qps QPs to set up
+     * @param sq_depth send queue depth of each QP
+     * @sa establish()
+     */
+    int establish(unsigned server_id, memory_region &out,
+        unsigned client_id, unsigned nr_qps, unsigned sq_depth) const;
+
+public:
+    /**
+     * QPs to set up to a server, #wanted rounded up to a multiple of
+     * #endpoints, or down if that exceeds #max, but at least one per endpoint
+     * @param wanted QPs asked for, see config `client.qps_per_server`
+     * @param endpoints RDMA endpoints of the server
+     * @param max QPs the server accepts from a client, see config
+     *      `server.max_connections_per_client`
+     */
+    static inline unsigned lanes_for(
+        unsigned wanted, size_t endpoints, unsigned max) noexcept
+    {
+        const size_t up = (wanted + endpoints - 1) / endpoints * endpoints;
+        if (up <= max)
+            [[likely]] return up;
+        return std::max(max / endpoints, size_t(1)) * endpoints;
+    }
 
     /* c/dtors */
 public:
@@ -71,7 +256,7 @@ public:
      * @private
      * @param _c 
      */
-    explicit RDMAConnectionPool(Client *_c);
+    explicit RDMAConnectionPool(ClientBase *_c);
     RDMAConnectionPool(const RDMAConnectionPool &) = delete;
     RDMAConnectionPool &operator=(const RDMAConnectionPool &) = delete;
     RDMAConnectionPool &operator=(RDMAConnectionPool &&tmp) = default;
@@ -79,6 +264,52 @@ public:
 
     /* interface */
 public:
+    /**
+     * connect to server #server_id in cluster map, no-op if already connected
+     * @return 0 ok, or negative errno of rdma_connect(), in which case the
+     *      server is marked out
+     * @throw std::runtime_error if server did not advertise its MR
+     */
+    int connect(unsigned server_id);
+    /**
+     * connect to servers not yet connected, concurrently
+     * @return number of servers failed to connect, which are marked out
+     */
+    unsigned connect_all(const vector<unsigned> &ids);
+    /**
+     * make sure all servers of an acting set are connected
+     * @note with config `client.connect = lazy`, this is where connections
+     *      are set up, on first use
+     * @return number of servers failed to connect, which are marked out
+     */
+    inline unsigned ensure(const vector<unsigned> &ids)
+    {
+        for (const auto &id : ids)
+            if (!pool.contains(id))
+                [[unlikely]] return connect_all(ids);
+        return 0;
+    }
+    /**
+     * disconnect from server #server_id, no-op if not connected
+     * @param graceful notify server with Session::Disconnect, set to false if
+     *      server already left cluster
+     */
+    void disconnect(unsigned server_id, bool graceful = true);
+    /**
+     * disconnect from servers #ids concurrently, skipping those not connected
+     * @note bounded by config `client.shutdown_timeout_ms`, servers not
+     *      acknowledging in time are left to reclaim the connection on their
+     *      own when RDMA CM reports the disconnect
+     */
+    void disconnect_all(const vector<unsigned> &ids);
+    inline bool is_connected(unsigned server_id) const
+    {
+        return pool.contains(server_id);
+    }
+    inline bool is_lazy() const noexcept
+    {
+        return lazy;
+    }
     // TODO: register_op()
 
 };  /* class RDMAConnection Pool */
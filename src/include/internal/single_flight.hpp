@@ -0,0 +1,166 @@
+/**
+ * @file single_flight.hpp
+ *
+ * Coalescing of concurrent reads on the same key
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "../spec/dataslot.hpp"
+
+
+namespace gestalt {
+
+using namespace std;
+
+using okey = dataslot::key_type;
+
+
+/**
+ * SingleFlight - lets concurrent `get`s of the same key share one RDMA READ
+ *
+ * The first reader of a key boards a new flight and becomes its leader, readers
+ * arriving while the leader's READ is still outstanding board the same flight
+ * and wait for the leader to land it with the validated result.
+ *
+ * The leader departs the flight (i.e. stops taking passengers) as soon as its
+ * READ completes, so that every passenger has boarded before the data was
+ * fetched, and sharing the result is as fresh as issuing a READ of its own.
+ *
+ * One instance is meant to be shared by all clients of a process, e.g. one per
+ * benchmark thread.
+ *
+ * @sa gestalt::ClientBase::read_flights
+ */
+class SingleFlight : private boost::noncopyable {
+public:
+    struct flight {
+        mutex m;
+        condition_variable cv;
+        bool landed = false;
+
+        /* result, valid after landed */
+
+        /** return value of the leader's `get` */
+        int r;
+        /** validated slots, empty if #r is non-zero */
+        vector<uint8_t> payload;
+        /** bufferlist::pos of the leader's read buffer */
+        ssize_t pos;
+        /** bufferlist::working_range of the leader's read buffer */
+        ssize_t working_range;
+        /** bufferlist::generation of the leader's read buffer */
+        uint8_t generation;
+
+        /**
+         * wait for the leader to land this flight
+         * @return the leader's result
+         */
+        inline int wait()
+        {
+            unique_lock l(m);
+            cv.wait(l, [this] { return landed; });
+            return r;
+        }
+    };
+
+private:
+    mutex m;
+    unordered_map<okey, shared_ptr<flight>> inflight;
+
+public:
+    /** number of reads that were served by someone else's flight */
+    atomic<unsigned long long> coalesced = 0;
+
+    /**
+     * @param key object key
+     * @param[out] is_leader whether the caller has to perform the read
+     * @return flight of #key
+     */
+    inline shared_ptr<flight> board(const okey &key, bool &is_leader)
+    {
+        lock_guard l(m);
+        auto [it, created] = inflight.try_emplace(key);
+        if (created)
+            it->second = make_shared<flight>();
+        else
+            coalesced.fetch_add(1, memory_order_relaxed);
+        is_leader = created;
+        return it->second;
+    }
+
+    /**
+     * stop taking passengers on flight #f, called by the leader once its READ
+     * has completed
+     */
+    inline void depart(const okey &key, const shared_ptr<flight> &f)
+    {
+        lock_guard l(m);
+        if (auto it = inflight.find(key); it != inflight.end() && it->second == f)
+            [[likely]] inflight.erase(it);
+    }
+
+    /**
+     * publish result of the leader and wake up all passengers
+     * @param f flight, must have departed
+     * @param r result of the leader
+     * @param src validated data, ignored if #r is non-zero
+     * @param len length of #src
+     * @param pos, working_range, generation see gestalt::bufferlist
+     */
+    static inline void land(flight &f, int r, const void *src, size_t len,
+            ssize_t pos, ssize_t working_range, uint8_t generation)
+    {
+        {
+            lock_guard l(f.m);
+            f.r = r;
+            if (!r) {
+                [[likely]] f.payload.resize(len);
+                memcpy(f.payload.data(), src, len);
+            }
+            f.pos = pos;
+            f.working_range = working_range;
+            f.generation = generation;
+            f.landed = true;
+        }
+        f.cv.notify_all();
+    }
+
+    /**
+     * lands the flight of a leader with -ECOMM if the leader leaves scope
+     * without landing it, e.g. by an exception, for passengers wait untimed
+     */
+    class leader_guard : private boost::noncopyable {
+        SingleFlight &sf;
+        const okey &key;
+        const shared_ptr<flight> &f;
+    public:
+        leader_guard(SingleFlight &_sf, const okey &_key,
+                const shared_ptr<flight> &_f) noexcept :
+            sf(_sf), key(_key), f(_f)
+        { }
+        ~leader_guard()
+        {
+            {
+                lock_guard l(f->m);
+                if (f->landed)
+                    [[likely]] return;
+            }
+            sf.depart(key, f);
+            land(*f, -ECOMM, nullptr, 0, -1, 0, 0);
+        }
+    };
+};
+
+}   /* namespace gestalt */
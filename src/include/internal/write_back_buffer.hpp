@@ -0,0 +1,183 @@
+/**
+ * @file write_back_buffer.hpp
+ *
+ * Client-side coalescing of overwrites on the same key
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/core/noncopyable.hpp>
+
+#include "../spec/dataslot.hpp"
+
+
+namespace gestalt {
+
+using namespace std;
+
+using okey = dataslot::key_type;
+
+
+/**
+ * WriteBackBuffer - holds dirty values of a client until they are flushed
+ *
+ * Overwrites on a buffered key replace its value in place, so all updates
+ * within the window are written to remote with a single `put`. An entry is due
+ * for flushing once no update has arrived for #window, or once it has been
+ * dirty for #max_staleness, whichever comes first, i.e. a constantly updated
+ * key is still written back at least every #max_staleness.
+ *
+ * @note Not thread-safe, owned by one client, just like the client itself.
+ * @note There is no background flusher, due entries are written back by the
+ * next I/O of the owning client, or by an explicit flush.
+ *
+ * @sa gestalt::BasicClient::flush()
+ */
+class WriteBackBuffer : private boost::noncopyable {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct entry {
+        vector<uint8_t> value;
+        /** time of the first unflushed update */
+        clock::time_point first_dirty;
+        /** time of the latest update */
+        clock::time_point last_dirty;
+    };
+
+    /** quiet period after which a dirty entry is flushed */
+    const clock::duration window;
+    /** upper bound of how long an update may stay in the buffer */
+    const clock::duration max_staleness;
+    /** dirty entries beyond this count are flushed regardless of age */
+    const size_t max_entries;
+    /**
+     * slots a buffered value may take at most, larger ones are refused on
+     * staging rather than failing on every later write-back
+     */
+    const size_t max_slots;
+
+private:
+    /** keys in the order they got dirty, oldest first */
+    list<okey> order;
+    unordered_map<okey, pair<entry, decltype(order)::iterator>> entries;
+    /** earliest time any entry may be due, skips scanning before that */
+    clock::time_point next_due = clock::time_point::max();
+
+    inline clock::time_point due(const entry &e) const noexcept
+    {
+        return std::min(e.last_dirty + window, e.first_dirty + max_staleness);
+    }
+
+public:
+    WriteBackBuffer(clock::duration _window, clock::duration _max_staleness,
+            size_t _max_entries, size_t _max_slots = 1) :
+        window(_window), max_staleness(_max_staleness), max_entries(_max_entries),
+        max_slots(_max_slots)
+    { }
+
+    inline size_t size() const noexcept
+    {
+        return entries.size();
+    }
+    inline bool empty() const noexcept
+    {
+        return entries.empty();
+    }
+
+    /**
+     * buffer an overwrite
+     * @param key object key
+     * @param din, dlen new value
+     * @throw std::runtime_error if the value takes more than #max_slots slots
+     */
+    inline void stage(const okey &key, const void *din, size_t dlen,
+            clock::time_point now = clock::now())
+    {
+        if (dlen > max_slots * dataslot::segment_type::capacity(key.size()))
+            [[unlikely]] throw std::runtime_error("large object not supported yet");
+
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            order.push_back(key);
+            it = entries.emplace(key,
+                make_pair(entry{{}, now, now}, std::prev(order.end()))).first;
+        }
+        auto &e = it->second.first;
+        e.value.resize(dlen);
+        memcpy(e.value.data(), din, dlen);
+        e.last_dirty = now;
+        next_due = std::min(next_due, due(e));
+    }
+
+    /**
+     * @return dirty entry of #key, NULL if not buffered
+     */
+    inline const entry *find(const okey &key) const
+    {
+        const auto it = entries.find(key);
+        return it == entries.end() ? nullptr : &it->second.first;
+    }
+
+    /**
+     * drop buffered value of #key, e.g. when it is overwritten by a write-through
+     */
+    inline void discard(const okey &key)
+    {
+        const auto it = entries.find(key);
+        if (it == entries.end())
+            [[likely]] return;
+        order.erase(it->second.second);
+        entries.erase(it);
+    }
+
+    /**
+     * write back entries
+     * @param put_fn `int(const okey&, const entry&)`, writes one entry to remote
+     * @param all flush all entries, otherwise only those due or overflowed
+     * @return 0 if all attempted writes succeeded, otherwise the first error.
+     * Entries failing with -EBUSY or -EAGAIN stay dirty and will be retried,
+     * entries failing with other errors are dropped, i.e. their values are
+     * lost.
+     */
+    template <class F>
+    int drain(F &&put_fn, bool all = false, clock::time_point now = clock::now())
+    {
+        if (!all && now < next_due && entries.size() <= max_entries)
+            [[likely]] return 0;
+
+        int ret = 0;
+        next_due = clock::time_point::max();
+        for (auto oit = order.begin(); oit != order.end(); ) {
+            const auto eit = entries.find(*oit);
+            const auto &e = eit->second.first;
+            if (!all && entries.size() <= max_entries && now < due(e)) {
+                next_due = std::min(next_due, due(e));
+                ++oit;
+                continue;
+            }
+
+            const int r = put_fn(*oit, e);
+            if (r == -EBUSY || r == -EAGAIN) {
+                [[unlikely]] next_due = now;
+                ++oit;
+            }
+            else {
+                entries.erase(eit);
+                oit = order.erase(oit);
+            }
+            if (r && !ret)
+                [[unlikely]] ret = r;
+        }
+        return ret;
+    }
+};
+
+}   /* namespace gestalt */
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <vector>
 #include <rdma/rdma_verbs.h>
 
 namespace gestalt {
@@ -19,6 +20,23 @@ namespace numa {
  */
 int get_numa_node(const ibv_device *dev);
 
+/**
+ * Get CPUs of a NUMA node
+ *
+ * @param numa NUMA ID
+ * @return CPU IDs, empty on unknown node
+ */
+std::vector<unsigned> get_cpus(int numa);
+
+/**
+ * Get NUMA node of PMem device (or namespace)
+ *
+ * @param pmem_dev PMem system device name, e.g. "pmem1" or "dax0.0"
+ * @return NUMA ID, or -1 on cannot detect
+ * @throw std::runtime_error no `pmem_dev` found in topology
+ */
+int get_pmem_numa_node(const char *pmem_dev);
+
 /**
  * Get an RNIC on the same NUMA as PMem device (or namespace)
  *
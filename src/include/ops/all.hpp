@@ -9,3 +9,5 @@
 #include "./read.hpp"
 #include "./lock.hpp"
 #include "./write_apm.hpp"
+#include "./claim.hpp"
+#include "./key_filter.hpp"
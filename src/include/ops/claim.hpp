@@ -0,0 +1,252 @@
+/**
+ * @file claim.hpp
+ *
+ * Claim operation, searching the window of slots following a home slot for a
+ * key, or claiming a free slot of it for inserting the key, through the
+ * occupancy bitmap of the remote table (see session::conn_reply::bitmap)
+ *
+ * A search is one chained post: a Read of the bitmap word(s) covering the
+ * window, and a Read of the 8-byte atomic field of every slot of it, instead of
+ * Reading whole slots. A free slot, one with neither its bit set nor data of
+ * the current generation, is then claimed by setting its bit with an atomic
+ * Compare and Swap, retried with what the remote word turned out to be, as
+ * RDMA has no masked bit-set.
+ */
+
+#pragma once
+
+#include "internal/ops_base.hpp"
+
+
+namespace gestalt {
+namespace ops {
+
+using namespace std;
+
+
+class Claim final : public Base {
+public:
+    using Base::buf;
+    struct target_t {
+        uintptr_t addr;
+        uint32_t rkey;
+    };
+    /** slots a window spans at most */
+    static constexpr size_t max_window = params::hht_search_length;
+
+    /**
+     * offset in the window of the slot found or claimed by the last perform()
+     */
+    mutable size_t found;
+private:
+    /**
+     * [0] Read of bitmap words covering the window, [1, #window] Read of the
+     * atomic field of each slot of the window
+     */
+    ibv_sge sgl[1 + max_window];
+    ibv_send_wr wr[1 + max_window];
+    ibv_sge cas_sgl[1];
+    mutable ibv_send_wr cas_wr[1];
+
+    /* layout of #buf */
+    static constexpr size_t words_offset = 0;
+    static constexpr size_t atomics_offset = 16;
+    static constexpr size_t cas_offset = atomics_offset + 8 * max_window;
+
+    using flag_t = dataslot::meta_type::bits_flag;
+    using atomic_t = decltype(dataslot::meta_type::atomic);
+
+    /** slots of the window */
+    size_t window;
+    /** bit of the first slot of the window, in the first word read */
+    unsigned first_bit;
+    /** remote VA of the first word read */
+    uintptr_t words_addr;
+    uint32_t khx;
+    uint8_t generation;
+    /** whether the window is Read first, otherwise the bit is just set */
+    bool probe;
+    /** whether a free slot is claimed if the key is not found */
+    bool claim;
+
+    string opname() const noexcept override
+    {
+        return "Claim";
+    }
+
+    inline uint64_t *words() const noexcept
+    {
+        return reinterpret_cast<uint64_t*>(
+            reinterpret_cast<uint8_t*>(buf.data()) + words_offset);
+    }
+    inline const atomic_t &atomic_of(size_t i) const noexcept
+    {
+        return *reinterpret_cast<const atomic_t*>(
+            reinterpret_cast<uint8_t*>(buf.data()) + atomics_offset + 8 * i);
+    }
+    /** whether slot #i of the window holds data of the current generation */
+    inline bool is_occupied(size_t i) const noexcept
+    {
+        const auto &a = atomic_of(i);
+        return (a.m.bits & flag_t::valid) && a.m.generation == generation;
+    }
+
+    /* c/dtor */
+public:
+    Claim(ibv_pd *pd, ibv_cq *scq) : Base(pd, scq)
+    {
+        const auto base = reinterpret_cast<uintptr_t>(buf.data());
+        sgl[0].addr = base + words_offset;
+        sgl[0].lkey = mr->lkey;
+        wr[0].sg_list = &sgl[0]; wr[0].num_sge = 1;
+        wr[0].opcode = IBV_WR_RDMA_READ;
+        for (size_t i = 1; i <= max_window; i++) {
+            sgl[i].addr = base + atomics_offset + 8 * (i - 1);
+            sgl[i].length = 8;
+            sgl[i].lkey = mr->lkey;
+            wr[i].sg_list = &sgl[i]; wr[i].num_sge = 1;
+            wr[i].opcode = IBV_WR_RDMA_READ;
+        }
+
+        cas_sgl[0].addr = base + cas_offset;
+        cas_sgl[0].length = 8;
+        cas_sgl[0].lkey = mr->lkey;
+        cas_wr[0].next = NULL;
+        cas_wr[0].sg_list = cas_sgl; cas_wr[0].num_sge = 1;
+        cas_wr[0].opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
+        cas_wr[0].send_flags = IBV_SEND_SIGNALED;
+    }
+
+    /* interface */
+public:
+    /**
+     * search a window for a key, claiming a free slot of it if not found
+     * @param id
+     * @param bitmap remote VA and rkey of the occupancy bitmap
+     * @param index index of the first slot of the window in the remote table
+     * @param slots justified remote VA and rkey of each slot of the window
+     * @param n slots of the window, at most #max_window, none past the end of
+     *      the table
+     * @param khx key tag (see gestalt::dataslot_key_digest )
+     * @param gen current generation of the remote table
+     * @param _claim claim a free slot if the key is not found
+     */
+    inline void parameterize(
+        rdma_cm_id *id, const target_t &bitmap, size_t index,
+        const target_t *slots, size_t n, uint32_t _khx, uint8_t gen,
+        bool _claim) noexcept
+    {
+        Base::id = id;
+        window = n;
+        first_bit = index % 64;
+        words_addr = bitmap.addr + index / 64 * 8;
+        khx = _khx;
+        generation = gen;
+        probe = true;
+        claim = _claim;
+
+        sgl[0].length = ((index + n - 1) / 64 - index / 64 + 1) * 8;
+        wr[0].wr.rdma.remote_addr = words_addr;
+        wr[0].wr.rdma.rkey = bitmap.rkey;
+        wr[0].next = &wr[1];
+        wr[0].send_flags = 0;
+        for (size_t i = 1; i <= n; i++) {
+            wr[i].wr.rdma.remote_addr = slots[i - 1].addr + offsetof(dataslot, meta.atomic);
+            wr[i].wr.rdma.rkey = slots[i - 1].rkey;
+            wr[i].next = &wr[i + 1];
+            wr[i].send_flags = 0;
+        }
+        /* completion of the last Read implies those ahead of it on the QP */
+        wr[n].next = NULL;
+        wr[n].send_flags = IBV_SEND_SIGNALED;
+        cas_wr[0].wr.atomic.rkey = bitmap.rkey;
+    }
+    inline Claim &operator()(
+        rdma_cm_id *id, const target_t &bitmap, size_t index,
+        const target_t *slots, size_t n, const dataslot::key_view &key,
+        uint8_t gen, bool _claim = true) noexcept
+    {
+        parameterize(id, bitmap, index, slots, n, key.digest().tag(), gen, _claim);
+        return *this;
+    }
+    /**
+     * set the bit of one slot, known to be empty, without searching
+     * @param id
+     * @param bitmap remote VA and rkey of the occupancy bitmap
+     * @param index index of the slot in the remote table
+     */
+    inline Claim &operator()(
+        rdma_cm_id *id, const target_t &bitmap, size_t index) noexcept
+    {
+        Base::id = id;
+        window = 1;
+        first_bit = index % 64;
+        words_addr = bitmap.addr + index / 64 * 8;
+        probe = false;
+        claim = true;
+        cas_wr[0].wr.atomic.rkey = bitmap.rkey;
+        return *this;
+    }
+
+    /**
+     *
+     * @return
+     * * 0 claimed slot #found of the window
+     * * -EEXIST key found at slot #found of the window, or the only slot of
+     *      the window is taken, if not searched
+     * * -ENOENT key not found, and not asked to claim
+     * * -EDQUOT key not found, and no free slot in the window
+     * * other see ops::Base::perform(const ibv_send_wr*)
+     */
+    int perform(void) const override
+    {
+        const auto w = words();
+        if (probe) {
+            if (int r = Base::perform(wr); r)
+                [[unlikely]] return r;
+            for (size_t i = 0; i < window; i++)
+                if (is_occupied(i) && atomic_of(i).m.key_tag == khx) {
+                    found = i;
+                    return -EEXIST;
+                }
+            if (!claim)
+                return -ENOENT;
+        }
+        else
+            /* a guess, corrected by the first Compare and Swap if wrong */
+            w[0] = 0;
+
+        /* bits are only ever set, the loop ends once the window fills up */
+        const auto &old = *reinterpret_cast<const uint64_t*>(cas_sgl[0].addr);
+        while (true) {
+            size_t i = 0;
+            for (; i < window; i++) {
+                const unsigned bit = first_bit + i;
+                if (!(w[bit / 64] & (1ul << (bit % 64))) && !(probe && is_occupied(i)))
+                    break;
+            }
+            if (i == window)
+                return probe ? -EDQUOT : -EEXIST;
+
+            const unsigned bit = first_bit + i;
+            cas_wr[0].wr.atomic.remote_addr = words_addr + bit / 64 * 8;
+            cas_wr[0].wr.atomic.compare_add = w[bit / 64];
+            cas_wr[0].wr.atomic.swap = w[bit / 64] | (1ul << (bit % 64));
+            if (int r = Base::perform(cas_wr); r)
+                [[unlikely]] return r;
+            if (old == cas_wr[0].wr.atomic.compare_add) {
+                [[likely]] found = i;
+                return 0;
+            }
+            BOOST_LOG_TRIVIAL(trace) << std::hex << "ops::Claim raced on word "
+                << cas_wr[0].wr.atomic.remote_addr << ", expect "
+                << cas_wr[0].wr.atomic.compare_add << " read " << old << std::dec;
+            w[bit / 64] = old;
+        }
+    }
+    using Base::operator();
+
+};  /* class Claim */
+
+}   /* namespace ops */
+}   /* namespace gestalt */
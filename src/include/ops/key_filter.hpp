@@ -0,0 +1,117 @@
+/**
+ * @file key_filter.hpp
+ *
+ * Key filter operations, Reading a block of the key filter of a server, or
+ * counting a key in with an RDMA Fetch and Add per counter, see
+ * gestalt::key_filter
+ */
+
+#pragma once
+
+#include "internal/ops_base.hpp"
+#include "spec/key_filter.hpp"
+
+
+namespace gestalt {
+namespace ops {
+
+using namespace std;
+
+
+class KeyFilter final : public Base {
+public:
+    using Base::buf;
+    struct target_t {
+        uintptr_t addr;
+        uint32_t rkey;
+    };
+private:
+    ibv_sge read_sgl[1];
+    ibv_send_wr read_wr[1];
+    /** one Fetch and Add per counter, chained */
+    ibv_sge faa_sgl[key_filter::nr_hashes];
+    ibv_send_wr faa_wr[key_filter::nr_hashes];
+
+    /** whether a key is counted in, otherwise a block is Read */
+    bool adding;
+
+    string opname() const noexcept override
+    {
+        return "KeyFilter";
+    }
+
+    /* c/dtor */
+public:
+    KeyFilter(ibv_pd *pd, ibv_cq *scq) : Base(pd, scq)
+    {
+        const auto base = reinterpret_cast<uintptr_t>(buf.data());
+        read_sgl[0].addr = base;
+        read_sgl[0].length = sizeof(key_filter::block);
+        read_sgl[0].lkey = mr->lkey;
+        read_wr[0].next = NULL;
+        read_wr[0].sg_list = read_sgl; read_wr[0].num_sge = 1;
+        read_wr[0].opcode = IBV_WR_RDMA_READ;
+        read_wr[0].send_flags = IBV_SEND_SIGNALED;
+
+        /* old values are of no interest, but have to land somewhere */
+        for (unsigned i = 0; i < key_filter::nr_hashes; i++) {
+            faa_sgl[i].addr = base + sizeof(key_filter::block) + 8 * i;
+            faa_sgl[i].length = 8;
+            faa_sgl[i].lkey = mr->lkey;
+            faa_wr[i].next = i + 1 < key_filter::nr_hashes ? &faa_wr[i + 1] : NULL;
+            faa_wr[i].sg_list = &faa_sgl[i]; faa_wr[i].num_sge = 1;
+            faa_wr[i].opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
+            faa_wr[i].send_flags = 0;
+        }
+        /* completion of the last one implies those ahead of it on the QP */
+        faa_wr[key_filter::nr_hashes - 1].send_flags = IBV_SEND_SIGNALED;
+    }
+
+    /* interface */
+public:
+    /**
+     * Read the block of a key, or count the key in
+     * @param id
+     * @param filter remote VA and rkey of the key filter
+     * @param p position of the key
+     * @param add count the key in, instead of Reading its block
+     */
+    inline KeyFilter &operator()(
+        rdma_cm_id *id, const target_t &filter, const key_filter::position &p,
+        bool add = false) noexcept
+    {
+        Base::id = id;
+        adding = add;
+        const uintptr_t raddr = filter.addr + p.block * sizeof(key_filter::block);
+        if (!add) {
+            read_wr[0].wr.rdma.remote_addr = raddr;
+            read_wr[0].wr.rdma.rkey = filter.rkey;
+            return *this;
+        }
+        for (unsigned i = 0; i < key_filter::nr_hashes; i++) {
+            faa_wr[i].wr.atomic.remote_addr = raddr + 8 * p.word(i);
+            faa_wr[i].wr.atomic.compare_add = p.addend(i);
+            faa_wr[i].wr.atomic.rkey = filter.rkey;
+        }
+        return *this;
+    }
+
+    /** block Read by the last perform() */
+    inline const key_filter::block &block() const noexcept
+    {
+        return *reinterpret_cast<const key_filter::block*>(buf.data());
+    }
+
+    /**
+     * @return see ops::Base::perform(const ibv_send_wr*)
+     */
+    int perform(void) const override
+    {
+        return Base::perform(adding ? faa_wr : read_wr);
+    }
+    using Base::operator();
+
+};  /* class KeyFilter */
+
+}   /* namespace ops */
+}   /* namespace gestalt */
@@ -15,7 +15,7 @@ namespace ops {
 using namespace std;
 
 
-class Lock : public Base {
+class Lock final : public Base {
 public:
     using Base::buf;
 private:
@@ -50,17 +50,18 @@ public:
      * @param id 
      * @param addr justified remote VA of the dataslot, offset to atomic field
      *      will be calculated internally
-     * @param khx key hash (crc32_iscsi(), see dataslot.hpp)
+     * @param khx key tag (see gestalt::dataslot_key_digest )
      * @param rkey 
+     * @param gen current generation of the remote table
      */
     inline void parameterize(
         rdma_cm_id *id,
-        uintptr_t addr, uint32_t khx, uint32_t rkey) noexcept
+        uintptr_t addr, uint32_t khx, uint32_t rkey, uint8_t gen) noexcept
     {
         Base::id = id;
         wr[0].wr.atomic.remote_addr = addr + offsetof(dataslot, meta.atomic);
         {
-            atomic_t a(khx);
+            atomic_t a(khx, flag_t::valid, gen);
             /* before is unlocked */
             a.m.bits = static_cast<uint8_t>(flag_t::valid);
             wr[0].wr.atomic.compare_add = a.u64;
@@ -72,16 +73,17 @@ public:
     }
     inline Lock &operator()(
         rdma_cm_id *id,
-        uintptr_t addr, uint32_t khx, uint32_t rkey) noexcept
+        uintptr_t addr, uint32_t khx, uint32_t rkey, uint8_t gen) noexcept
     {
-        parameterize(id, addr, khx, rkey);
+        parameterize(id, addr, khx, rkey, gen);
         return *this;
     }
     inline Lock &operator()(
         rdma_cm_id *id,
-        uintptr_t addr, const dataslot::key_type &key, uint32_t rkey) noexcept
+        uintptr_t addr, const dataslot::key_view &key, uint32_t rkey,
+        uint8_t gen) noexcept
     {
-        parameterize(id, addr, key.hash(), rkey);
+        parameterize(id, addr, key.digest().tag(), rkey, gen);
         return *this;
     }
 
@@ -89,7 +91,8 @@ public:
      * 
      * @return 
      * * 0 successfully locked slot
-     * * -EINVAL slot not initialized, i.e. slot is available
+     * * -EINVAL slot not initialized or of another generation, i.e. slot is
+     *      available
      * * -EBUSY slot write-locked
      * * -EBADF key fingerprint mismatch
      * * other see ops::Base::perform(const ibv_send_wr*)
@@ -112,9 +115,12 @@ public:
 
         if (!(old.m.bits & flag_t::valid))
             [[unlikely]] return -EINVAL;
+        /* left over from before the table was formatted, locked or not */
+        if (old.m.generation != before.m.generation)
+            [[unlikely]] return -EINVAL;
         if (old.m.bits & flag_t::lock)
             [[likely]] return -EBUSY;
-        if (old.m.key_crc != before.m.key_crc)
+        if (old.m.key_tag != before.m.key_tag)
             return -EBADF;
 
         throw std::runtime_error("unreachable");
@@ -124,7 +130,7 @@ public:
 };  /* class Lock */
 
 
-class Unlock : public Base {
+class Unlock final : public Base {
 public:
     using Base::buf;
 private:
@@ -159,17 +165,18 @@ public:
      * @param id 
      * @param addr justified remote VA of the dataslot, offset to atomic field
      *      will be calculated internally
-     * @param khx key hash (crc32_iscsi(), see dataslot.hpp)
+     * @param khx key tag (see gestalt::dataslot_key_digest )
      * @param rkey 
+     * @param gen current generation of the remote table
      */
     inline void parameterize(
         rdma_cm_id *id,
-        uintptr_t addr, uint32_t khx, uint32_t rkey) noexcept
+        uintptr_t addr, uint32_t khx, uint32_t rkey, uint8_t gen) noexcept
     {
         Base::id = id;
         wr[0].wr.atomic.remote_addr = addr + offsetof(dataslot, meta.atomic);
         {
-            atomic_t a(khx);
+            atomic_t a(khx, flag_t::valid, gen);
             /* before is locked */
             a.m.bits = flag_t::valid | flag_t::lock;
             wr[0].wr.atomic.compare_add = a.u64;
@@ -181,16 +188,17 @@ public:
     }
     inline Unlock &operator()(
         rdma_cm_id *id,
-        uintptr_t addr, uint32_t khx, uint32_t rkey) noexcept
+        uintptr_t addr, uint32_t khx, uint32_t rkey, uint8_t gen) noexcept
     {
-        parameterize(id, addr, khx, rkey);
+        parameterize(id, addr, khx, rkey, gen);
         return *this;
     }
     inline Unlock &operator()(
         rdma_cm_id *id,
-        uintptr_t addr, const dataslot::key_type &key, uint32_t rkey) noexcept
+        uintptr_t addr, const dataslot::key_view &key, uint32_t rkey,
+        uint8_t gen) noexcept
     {
-        parameterize(id, addr, key.hash(), rkey);
+        parameterize(id, addr, key.digest().tag(), rkey, gen);
         return *this;
     }
 
@@ -15,7 +15,7 @@ namespace ops {
 using namespace std;
 
 
-class Read : public Base {
+class Read final : public Base {
 public:
     using Base::buf;
 private:
@@ -62,7 +62,7 @@ public:
     {
         Base::id = id;
         sgl[0].length = length;
-        buf.working_range = ceil_div(length, params::data_seg_length);
+        buf.working_range = length / sizeof(dataslot);
         wr[0].wr.rdma.remote_addr = addr;
         wr[0].wr.rdma.rkey = rkey;
     }
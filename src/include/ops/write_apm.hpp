@@ -0,0 +1,329 @@
+/**
+ * @file write_apm.hpp
+ *
+ * Write operation, with Application Persistency (APM), i.e. RDMA Write followed
+ * by a random RDMA Read flushing write that may be still residing in RNIC.
+ * Targets of volatile memory are written without the flushing Read.
+ *
+ * This implementation is only an RDMA op, it simply overwrites a remote region
+ * and makes sure it is persistent on return. No gestalt::dataslot availability
+ * check is performed, writing data while expanding or shrinking value size
+ * should be handled by other higher order code.
+ */
+
+#pragma once
+
+#include <vector>
+#include <array>
+#include <bit>
+
+#include "internal/ops_base.hpp"
+#include "optim.hpp"
+
+
+namespace gestalt {
+namespace ops {
+
+using namespace std;
+
+
+/**
+ * Parallel write
+ */
+class WriteAPM final : public Base {
+public:
+    using Base::buf;
+    struct target_t {
+        rdma_cm_id *id;
+        uintptr_t addr;
+        uint32_t rkey;
+        /** current generation of the remote table */
+        uint8_t generation;
+        /**
+         * whether the write has to be flushed out of the remote RNIC, i.e.
+         * the remote memory is persistent, see session::durability
+         */
+        bool flush;
+    public:
+        target_t(rdma_cm_id *_id, uintptr_t _addr, uint32_t _rkey,
+                uint8_t _gen, bool _flush = true) noexcept :
+            id(_id), addr(_addr), rkey(_rkey), generation(_gen), flush(_flush)
+        { }
+    };
+    /** replicas a single write may go to */
+    static constexpr unsigned max_targets = 8;
+
+    /**
+     * ranks of successfully writes
+     */
+    mutable vector<unsigned> success_polls;
+
+private:
+    ibv_sge sgl[2];
+    mutable ibv_send_wr wr[2];
+    /**
+     * atomic region of the header slot as written to each target, i.e. with
+     * generation of its table and, on the primary, the lock bit, spliced into
+     * the write in between the rest of #buf
+     */
+    mutable array<uint64_t, max_targets> tails;
+    mutable array<array<ibv_sge, 3>, max_targets> tail_sgl;
+    /** memory region containing #tails */
+    unique_ptr<ibv_mr, __IbvMrDeleter> tails_mr;
+    /**
+     * If writing to a primary set, the first replica, aka the primary replica,
+     * should be left in locked state. A separate Unlock op will unlock it in
+     * the end.
+     */
+    bool is_primary_set;
+    vector<target_t> targets;
+    /** [mux] in-flight request of each target */
+    mutable unique_ptr<QpMux::request[]> mux_reqs;
+    mutable size_t mux_reqs_size = 0;
+
+    string opname() const noexcept override
+    {
+        return "WriteAPM";
+    }
+
+    /* c/dtor */
+public:
+    WriteAPM(ibv_pd *pd, ibv_cq *scq) : Base(pd, scq)
+    {
+        /* Write */
+        sgl[0].addr = reinterpret_cast<uintptr_t>(buf.data());
+        sgl[0].lkey = mr->lkey;
+
+        wr[0].next = &wr[1];
+        wr[0].sg_list = &sgl[0]; wr[0].num_sge = 1;
+        wr[0].opcode = IBV_WR_RDMA_WRITE;
+        wr[0].send_flags = 0;
+
+        /* Flush */
+        sgl[1].addr = reinterpret_cast<uintptr_t>(buf.data());
+        sgl[1].length = 1;
+        sgl[1].lkey = mr->lkey;
+
+        wr[1].next = NULL;
+        wr[1].sg_list = &sgl[1]; wr[1].num_sge = 1;
+        wr[1].opcode = IBV_WR_RDMA_READ;
+        wr[1].send_flags = IBV_SEND_SIGNALED;
+
+        ibv_mr *raw_mr = ibv_reg_mr(pd, tails.data(), sizeof(tails),
+            IBV_ACCESS_LOCAL_WRITE);
+        if (!raw_mr)
+            boost_log_errno_throw(ibv_reg_mr);
+        tails_mr.reset(raw_mr);
+    }
+
+    /* interface */
+public:
+    /**
+     * 
+     * @note fill #buf before parameterizing
+     * @param vec 
+     * @param primary if writing to primary set
+     */
+    inline void parameterize(const vector<target_t> &vec, bool primary) noexcept
+    {
+        targets = vec;
+        is_primary_set = primary;
+        sgl[0].length = buf.slots() * sizeof(dataslot);
+    }
+    inline WriteAPM &operator()(const vector<target_t> &vec, bool primary) noexcept
+    {
+        parameterize(vec, primary);
+        return *this;
+    }
+
+    /**
+     * 
+     * @param wr 
+     * @param bad_wr 
+     * @param wc 
+     * @return 
+     * * 0 ok
+     * * -EBADR bad work request
+     * * -E2BIG more than #max_targets targets
+     * * ...
+     */
+    int perform(
+        const ibv_send_wr *wr,
+        ibv_send_wr* &bad_wr, ibv_wc &wc) const noexcept override
+    {
+        assert(wr == this->wr);
+        if (targets.size() > max_targets)
+            [[unlikely]] return -E2BIG;
+
+        /* [mux] requests are submitted for the multiplexer to post in batches */
+        if (mux && mux_reqs_size < targets.size()) [[unlikely]] {
+            mux_reqs.reset(new QpMux::request[targets.size()]);
+            mux_reqs_size = targets.size();
+        }
+        const auto post = [&] (unsigned r, rdma_cm_id *id) {
+            /* splice atomic region of target #r into the write */
+            constexpr size_t off = offsetof(dataslot, meta.atomic);
+            const auto base = reinterpret_cast<uintptr_t>(buf.data());
+            const size_t len = sgl[0].length;
+            auto &s = tail_sgl[r];
+            s[0] = {base, off, mr->lkey};
+            s[1] = {reinterpret_cast<uintptr_t>(&tails[r]), sizeof(tails[r]),
+                tails_mr->lkey};
+            s[2] = {base + off + sizeof(tails[r]),
+                static_cast<uint32_t>(len - off - sizeof(tails[r])), mr->lkey};
+            this->wr[0].sg_list = s.data();
+            this->wr[0].num_sge = s[2].length ? 3 : 2;
+
+            /* volatile memory needs no flushing Read, the Write completes */
+            if (targets[r].flush) {
+                [[likely]] this->wr[0].next = &this->wr[1];
+                this->wr[0].send_flags = 0;
+                this->wr[0].wr_id = 0;
+            }
+            else {
+                this->wr[0].next = NULL;
+                this->wr[0].send_flags = IBV_SEND_SIGNALED;
+                this->wr[0].wr_id = this->wr[1].wr_id;
+            }
+
+            if (mux)
+                [[unlikely]] return mux->submit(id, mux_reqs[r], this->wr);
+            return ibv_post_send(id->qp, this->wr, &bad_wr);
+        };
+
+        /* emit requests */
+
+        const auto tail = [&] (unsigned r, bool locked) {
+            auto a = buf.arr[0].meta.atomic;
+            a.m.generation = targets[r].generation;
+            if (locked)
+                a.m.bits |= dataslot::meta_type::bits_flag::lock;
+            tails[r] = a.u64;
+        };
+
+        /* write targets of mask #round, and wait for them */
+        const auto write = [&] (unsigned round) {
+            if (is_primary_set && (round & 1)) {
+                tail(0, true);
+
+                const auto &prim = targets.at(0);
+                this->wr[0].wr.rdma.remote_addr = prim.addr;
+                this->wr[0].wr.rdma.rkey = prim.rkey;
+                this->wr[1].wr_id = 0;
+                this->wr[1].wr.rdma.remote_addr = prim.addr;
+                this->wr[1].wr.rdma.rkey = prim.rkey;
+                if (post(0, prim.id))
+                    [[unlikely]] return -EBADR;
+            }
+
+            for (unsigned r = is_primary_set ? 1 : 0; r < targets.size(); r++) {
+                if (!(round & (1u << r)))
+                    continue;
+                const auto &t = targets.at(r);
+                tail(r, false);
+                this->wr[0].wr.rdma.remote_addr = t.addr;
+                this->wr[0].wr.rdma.rkey = t.rkey;
+                this->wr[1].wr_id = r;
+                this->wr[1].wr.rdma.remote_addr = t.addr;
+                this->wr[1].wr.rdma.rkey = t.rkey;
+                if (post(r, t.id))
+                    [[unlikely]] return -EBADR;
+            }
+
+            /* poll from all channels */
+
+            if (mux) [[unlikely]] {
+                int ret = 0;
+                for (unsigned r = 0; r < targets.size(); r++)
+                    if (round & (1u << r))
+                        if (int v = mux->wait(mux_reqs[r], wc); v && !ret)
+                            [[unlikely]] ret = v;
+                return ret;
+            }
+            if constexpr (optimization::batched_poll) {
+                /* fake success to deligate */
+                wc.status = IBV_WC_SUCCESS;
+
+                ibv_wc wcbuf[8];
+                unsigned remain = std::popcount(round);
+                for (unsigned retry = max_poll; remain && (true || retry); --retry) {
+                    int c;
+                    [[likely]] c = ibv_poll_cq(scq, remain, wcbuf);
+                    remain -= c;
+                    if (!c)
+                        [[unlikely]] continue;
+                    if (c < 0)
+                        [[unlikely]] return -ECOMM;
+                    for (unsigned cc = 0; cc < c; cc++) {
+                        if (wcbuf[cc].status != IBV_WC_SUCCESS) {
+                            [[unlikely]] std::memcpy(&wc, &wcbuf[cc], sizeof(wc));
+                            return -ECANCELED;
+                        }
+                        success_polls.push_back(wcbuf[cc].wr_id);
+                    }
+                }
+                if (remain)
+                    [[unlikely]] return -ETIME;
+            }
+            else {
+                for (unsigned i = 0; i < targets.size(); i++) {
+                    if (!(round & (1u << i)))
+                        continue;
+                    int r;
+                    for (unsigned retry = max_poll; true || retry; --retry) {
+                        [[likely]] r = ibv_poll_cq(targets[i].id->qp->send_cq, 1, &wc);
+                        if (!r)
+                            [[unlikely]] continue;
+                        if (r < 0)
+                            [[unlikely]] return -ECOMM;
+                        if (wc.status != IBV_WC_SUCCESS)
+                            [[unlikely]] return -ECANCELED;
+                        break;
+                    }
+                    if (!r)
+                        [[unlikely]] return -ETIME;
+                }
+            }
+            return 0;
+        };
+
+        if constexpr (optimization::batched_poll) {
+            success_polls.clear();
+            success_polls.reserve(targets.size());
+        }
+
+        /* only the header slot is spliced, continuation slots of a multi-slot
+            value carry the generation of their table in #buf itself, so that
+            targets are written a generation at a time, all at once if they
+            agree or the value takes one slot */
+        const size_t nr_slots = sgl[0].length / sizeof(dataslot);
+        const unsigned all = (1u << targets.size()) - 1;
+        for (unsigned done = 0; done != all; ) {
+            unsigned round = 0;
+            uint8_t gen = 0;
+            for (unsigned r = 0; r < targets.size(); r++) {
+                if (done & (1u << r))
+                    continue;
+                if (!round)
+                    gen = targets[r].generation;
+                if (nr_slots == 1 || targets[r].generation == gen)
+                    round |= 1u << r;
+            }
+            if (nr_slots > 1)
+                [[unlikely]] buf.stamp(gen);
+            if (int r = write(round); r)
+                [[unlikely]] return r;
+            done |= round;
+        }
+        return 0;
+    }
+    int perform(void) const override
+    {
+        return Base::perform(wr);
+    }
+    using Base::operator();
+
+};  /* class WriteAPM */
+
+}   /* namespace ops */
+}   /* namespace gestalt */
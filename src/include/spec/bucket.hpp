@@ -0,0 +1,150 @@
+/**
+ * @file bucket.hpp
+ *
+ * Buckets - named key spaces, each taking a share of the slot table of every
+ * server serving it, with replication and persistence of its own
+ *
+ * Buckets are declared in gestalt.conf, one `[bucket:<name>]` section each,
+ * so that servers, clients and monitor agree on them:
+ *
+ *     [bucket:sessions]
+ *     share = 1            # relative share of member servers' slot tables
+ *     num_replicas = 1     # defaults to global.num_replicas
+ *     search_length = 2    # at most params::hht_search_length
+ *     persistence = none   # flush (default) | none
+ *     placement = jump     # defaults to global.placement
+ *
+ * Without any, there is one bucket, #default_name, taking the entire table.
+ * Servers choose which buckets they serve, and advertise where each of them
+ * lives in their table to monitor.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <boost/property_tree/ptree.hpp>
+
+#include "./params.hpp"
+
+
+namespace gestalt {
+namespace bucket {
+
+using namespace std;
+
+constexpr const char *default_name = "default";
+/** prefix of config sections declaring a bucket */
+constexpr const char *section_prefix = "bucket:";
+
+struct spec {
+    string name;
+    /** relative share of the slot table of every server serving the bucket */
+    unsigned share = 1;
+    unsigned num_replicas = 1;
+    /** linear search length of keys, at most params::hht_search_length */
+    size_t search_length = params::hht_search_length;
+    /**
+     * whether writes are flushed to where the server's storage is durable,
+     * off for data that may be lost with a server, see session::durability
+     */
+    bool persistent = true;
+    /**
+     * placement engine of the bucket, modulo | jump | rendezvous, see
+     * gestalt::placement::Engine
+     */
+    string placement = "modulo";
+};
+
+/**
+ * buckets declared in config, in order of declaration
+ * @throw std::invalid_argument malformed declaration
+ */
+inline vector<spec> parse(const boost::property_tree::ptree &config)
+{
+    const auto replicas = config.get<unsigned>("global.num_replicas");
+    const auto placement = config.get<string>("global.placement", "modulo");
+    const auto is_engine = [] (const string &e) {
+        return e == "modulo" || e == "jump" || e == "rendezvous";
+    };
+    if (!is_engine(placement))
+        throw std::invalid_argument("global.placement");
+    vector<spec> ret;
+    for (const auto &[section, c] : config) {
+        if (!section.starts_with(section_prefix))
+            continue;
+        spec s;
+        s.name = section.substr(string_view(section_prefix).size());
+        s.share = c.get<unsigned>("share", 1);
+        s.num_replicas = c.get<unsigned>("num_replicas", replicas);
+        s.search_length = c.get<size_t>("search_length", params::hht_search_length);
+        const auto persistence = c.get<string>("persistence", "flush");
+        if (persistence != "flush" && persistence != "none")
+            throw std::invalid_argument(section + ".persistence");
+        s.persistent = persistence == "flush";
+        s.placement = c.get<string>("placement", placement);
+        if (!is_engine(s.placement))
+            throw std::invalid_argument(section + ".placement");
+        if (s.name.empty() || !s.share || !s.num_replicas || !s.search_length
+                || s.search_length > params::hht_search_length)
+            throw std::invalid_argument(section);
+        ret.push_back(std::move(s));
+    }
+    if (ret.empty())
+        ret.push_back({ .name = default_name, .num_replicas = replicas,
+            .placement = placement });
+    return ret;
+}
+
+/**
+ * @return bucket #name among #buckets
+ * @throw std::invalid_argument no such bucket
+ */
+inline const spec &find(const vector<spec> &buckets, const string &name)
+{
+    const auto it = std::find_if(buckets.begin(), buckets.end(),
+        [&name] (const auto &b) { return b.name == name; });
+    if (it == buckets.end())
+        throw std::invalid_argument("no such bucket: " + name);
+    return *it;
+}
+
+/** part of a server's slot table taken by a bucket */
+struct extent {
+    string name;
+    /** first slot */
+    size_t offset;
+    /** number of slots */
+    size_t length;
+};
+
+/**
+ * split a slot table among the buckets a server serves, by their share, in
+ * order of #served
+ * @param served buckets served, each of non-zero share
+ * @param nr_slots slots of the table
+ * @return extents, contiguous and in ascending order
+ */
+inline vector<extent> partition(const vector<spec> &served, size_t nr_slots)
+{
+    uint64_t total = 0;
+    for (const auto &b : served)
+        total += b.share;
+    vector<extent> ret;
+    size_t offset = 0;
+    uint64_t acc = 0;
+    for (const auto &b : served) {
+        acc += b.share;
+        /* the last one takes what rounding leaves */
+        const size_t end = static_cast<unsigned __int128>(nr_slots) * acc / total;
+        ret.push_back({b.name, offset, end - offset});
+        offset = end;
+    }
+    return ret;
+}
+
+}   /* namespace bucket */
+}   /* namespace gestalt */
@@ -53,6 +53,13 @@ struct bufferlist {
      * -1 for no data yet
      */
     mutable ssize_t working_range = nr_slots;
+    /**
+     * @private
+     * (for read op only) generation of the table data was read from, 0 for
+     * data not read from remote
+     * @sa gestalt::dataslot::validity()
+     */
+    mutable uint8_t generation = 0;
 
     /* c/dtor */
 
@@ -65,6 +72,14 @@ struct bufferlist {
     {
         return nr_slots * DATA_SEG_LEN;
     }
+    /**
+     * @param klen key length
+     * @return largest value this instance can hold for a key of length #klen
+     */
+    static constexpr size_t max_size(size_t klen) noexcept
+    {
+        return nr_slots * dataslot::segment_type::capacity(klen);
+    }
     /**
      * @return underlying array
      */
@@ -94,7 +109,7 @@ struct bufferlist {
      */
     inline size_t slots() const
     {
-        return ceil_div(size(), DATA_SEG_LEN);
+        return ceil_div(size(), arr[pos].capacity());
     }
 
     /**
@@ -121,7 +136,16 @@ struct bufferlist {
      *          while fetching. However, this should have been prevented with our
      *          locking write design, for the CAS lock will fail on overwrite.
      */
-    int validity(const dataslot::key_type &key) const noexcept
+    int validity(const dataslot::key_view &key) const noexcept
+    {
+        return validity(key, key.fingerprint());
+    }
+    /**
+     * @param key 
+     * @param fp fingerprint of #key, saves recalculating it while searching
+     * @sa validity(const dataslot::key_view&)
+     */
+    int validity(const dataslot::key_view &key, uint64_t fp) const noexcept
     {
         if (pos < 0 || working_range < 0)
             [[unlikely]] return -EINVAL;
@@ -129,17 +153,17 @@ struct bufferlist {
         /* check the first block, i.e. header.
             if header does not match, start anew */
         do {
-            const auto v = arr[pos].validity();
-            if (!v)
-                [[likely]] break;
-            // assert(v);
-            if (arr[pos].key() == key)
-                [[likely]] return v;
-            // assert(v && arr[pos].key != key);
-            if (pos >= std::min(static_cast<size_t>(working_range), params::hht_search_length))
+            /* fingerprint first, inline key is compared only if it matches */
+            if (arr[pos].holds(key, fp)) {
+                [[likely]] if (const auto v = arr[pos].validity(generation); v)
+                    [[unlikely]] return v;
+                break;
+            }
+            // assert(arr[pos].key != key);
+            if (pos + 1 >= std::min(static_cast<size_t>(working_range), params::hht_search_length))
                 [[unlikely]] return -EINVAL;
             pos++;
-            return validity(key);
+            return validity(key, fp);
         } while (0);
 
         const size_t len = size();
@@ -151,22 +175,37 @@ struct bufferlist {
 
         /* shortcut: entire data is held in one slot
             note that validity of the first slot is already checked */
-        if (len < DATA_SEG_LEN)
+        const size_t seg = arr[pos].capacity();
+        if (len <= seg)
             [[likely]] return 0;
 
         /* the buffer can't hold entire value anyway */
-        if (pos * DATA_SEG_LEN + len > max_size())
+        const size_t k = ceil_div(len, seg);
+        if (pos + k > nr_slots)
             [[unlikely]] return -EOVERFLOW;
 
         /* check the entire value */
-        for (size_t i = 1, k = ceil_div(len, DATA_SEG_LEN); i < k; i++) {
+        for (size_t i = 1; i < k; i++) {
             const auto &d = arr[pos + i];
-            if (d.validity() || d.key() != key)
+            if (d.validity(generation) || !d.holds(key, fp))
                 [[unlikely]] return -EREMOTE;
         }
         return 0;
     }
 
+    /**
+     * set generation of every slot of the value but the header one, as a
+     * value to be written to a table of generation #gen, the header slot gets
+     * its generation along with the rest of its atomic region, see
+     * ops::WriteAPM
+     * @note call after set()
+     */
+    inline void stamp(uint8_t gen)
+    {
+        for (size_t i = 1; i < slots(); i++)
+            arr[pos + i].meta.atomic.m.generation = gen;
+    }
+
     /* indexing helper */
 
     /**
@@ -184,22 +223,26 @@ struct bufferlist {
 #define NDEBUG
 #endif
 #endif
-        assert(!validity());
+        assert(!validity(arr[pos].key()));
 
         if (len > size())
             [[unlikely]] throw std::overflow_error("len");
 
+        /* value bytes per slot, all slots of an entry share the same key */
+        const size_t seg = arr[pos].capacity();
+        auto dst = reinterpret_cast<uint8_t*>(out);
+
         /* only take something from the first slot */
-        if (off == 0 && len <= DATA_SEG_LEN) {
-            [[likely]] std::memcpy(out, arr[pos].value().get(), len);
+        if (off == 0 && len <= seg) {
+            [[likely]] std::memcpy(dst, arr[pos].data.value(), len);
             return;
         }
 
-        size_t isrc = pos + off / DATA_SEG_LEN;
-        off %= DATA_SEG_LEN;
+        size_t isrc = pos + off / seg;
+        off %= seg;
 
         /* already checked with validity() */
-        if (isrc * DATA_SEG_LEN + off + len > max_size())
+        if (isrc * seg + off + len > nr_slots * seg)
             [[unlikely]] throw std::overflow_error("validity()");
 
         /* pre-align
@@ -210,12 +253,12 @@ struct bufferlist {
               ^
               off  -- len -->
         */
-        assert(off < DATA_SEG_LEN);
+        assert(off < seg);
         if (off) {
-            size_t run = DATA_SEG_LEN - off;
-            std::memcpy(out, arr[isrc].value().get() + off, run);
+            size_t run = std::min(seg - off, len);
+            std::memcpy(dst, arr[isrc].data.value() + off, run);
             isrc++;
-            out += run;
+            dst += run;
             len -= run;
         }
         /* should not use off from now */
@@ -228,13 +271,13 @@ struct bufferlist {
             [<- this part -->]     ^
             ------- len -----------'
         */
-        while (len > DATA_SEG_LEN) {
-            std::memcpy(out, arr[isrc].value().get(), DATA_SEG_LEN);
+        while (len > seg) {
+            std::memcpy(dst, arr[isrc].data.value(), seg);
             isrc++;
-            out += DATA_SEG_LEN;
-            len -= DATA_SEG_LEN;
+            dst += seg;
+            len -= seg;
         }
-        assert(len <= DATA_SEG_LEN);
+        assert(len <= seg);
 
         /* tail
 
@@ -244,7 +287,7 @@ struct bufferlist {
             -len-^
         */
         if (len) {
-            std::memcpy(out, arr[isrc].value().get(), len);
+            std::memcpy(dst, arr[isrc].data.value(), len);
         }
 #ifdef __DID_NOT_HAVE_NDEBUG
 #undef NDEBUG
@@ -262,7 +305,7 @@ struct bufferlist {
      * @param din source data buffer
      * @param dlen length of data
      */
-    void set(const dataslot::key_type &key, const void *din, size_t dlen)
+    void set(const dataslot::key_view &key, const void *din, size_t dlen)
     {
 #ifdef DEBUG_BUFFERLIST
 #ifndef NDEBUG
@@ -271,14 +314,19 @@ struct bufferlist {
 #endif
 #endif
         pos = 0;
+        /* built locally, not of any table */
+        generation = 0;
+
+        /* value bytes per slot, after the inline key */
+        const size_t seg = dataslot::segment_type::capacity(key.size());
 
         /* one slot holds it all */
-        if (dlen <= DATA_SEG_LEN) {
+        if (dlen <= seg) {
             [[likely]] arr[0].reset(key, din, dlen);
             return;
         }
 
-        if (dlen > max_size())
+        if (dlen > max_size(key.size()))
             [[unlikely]] throw std::overflow_error("len");
 
         size_t isrc = 0;
@@ -299,14 +347,14 @@ struct bufferlist {
             ^^^^^^^^
             this part
         */
-        while (dlen > DATA_SEG_LEN) {
-            arr[isrc].reset(key, din, DATA_SEG_LEN);
+        while (dlen > seg) {
+            arr[isrc].reset(key, din, seg);
             arr[isrc].meta.length = 0;
             isrc++;
-            din = reinterpret_cast<const uint8_t*>(din) + DATA_SEG_LEN;
-            dlen -= DATA_SEG_LEN;
+            din = reinterpret_cast<const uint8_t*>(din) + seg;
+            dlen -= seg;
         }
-        assert(dlen <= DATA_SEG_LEN);
+        assert(dlen <= seg);
 
         /* tail */
         if (dlen) {
@@ -29,7 +29,10 @@ static_assert(!USING_PMEM);
 #include <atomic>
 #include <cstring>
 #include <stdexcept>
+#include <string_view>
+#include <span>
 #include <isa-l/crc.h>
+#include <isa-l/crc64.h>
 
 #include "./params.hpp"
 
@@ -39,6 +42,217 @@ namespace gestalt {
 using namespace std;
 
 constexpr size_t DATA_SEG_LEN = params::data_seg_length;
+constexpr size_t KEY_SEG_RESERVE = params::key_seg_reserve;
+
+/**
+ * Hashes of a key used for different purposes, derived from one 64-bit key
+ * fingerprint.
+ *
+ * Placement (server selection), slot index and the lock tag must not be the
+ * same hash, otherwise keys landing on one server would share residues modulo
+ * server count, leaving only a fraction of its slots reachable.
+ */
+struct dataslot_key_digest {
+    /** 64-bit key fingerprint, as recorded in slot metadata */
+    uint64_t fingerprint;
+    /** selects server nodes, see gestalt::DataMapper */
+    uint32_t placement;
+    /** selects slot on a server */
+    uint64_t slot;
+
+    /**
+     * bijective 64-bit finalizer (MurmurHash3 fmix64), spreading any change
+     * in input to all output bits
+     */
+    static constexpr uint64_t mix(uint64_t x) noexcept
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+    constexpr dataslot_key_digest(uint64_t fp) noexcept :
+        fingerprint(fp),
+        placement(mix(fp ^ params::placement_hash_seed) >> 32),
+        slot(mix(fp ^ params::slot_hash_seed))
+    { }
+
+    /**
+     * 32-bit tag of the fingerprint, stored in the atomic region for headless
+     * CAS
+     */
+    static constexpr uint32_t tag(uint64_t fp) noexcept
+    {
+        return fp >> 32;
+    }
+    constexpr uint32_t tag() const noexcept
+    {
+        return tag(fingerprint);
+    }
+};
+
+/**
+ * Non-owning reference to a key, either inlined in a slot or held by a
+ * gestalt::dataslot_key
+ *
+ * Comparisons are length-bounded, the terminating '\0' is only kept around for
+ * c_str() and logging.
+ */
+struct dataslot_key_view {
+    const char *_k;
+    size_t _len;
+
+    /* constructors */
+public:
+    constexpr dataslot_key_view() noexcept : _k(""), _len(0)
+    { }
+    constexpr dataslot_key_view(const char *k, size_t len) noexcept :
+        _k(k), _len(len)
+    { }
+    dataslot_key_view(const char *k) noexcept : _k(k), _len(strlen(k))
+    { }
+
+    /* required interfaces */
+public:
+    inline const char *c_str() const noexcept
+    {
+        return _k;
+    }
+    inline size_t size() const noexcept
+    {
+        return _len;
+    }
+    inline string_view view() const noexcept
+    {
+        return {_k, _len};
+    }
+
+    /**
+     * 64-bit key fingerprint, recorded in slot metadata so that a mismatching
+     * slot can be told apart without touching the inline key
+     */
+    static inline uint64_t fingerprint(const char *k, size_t len) noexcept
+    {
+        return crc64_ecma_refl(0x114514, (const uint8_t*)k, len);
+    }
+    inline uint64_t fingerprint() const noexcept
+    {
+        return fingerprint(_k, _len);
+    }
+    /**
+     * @return all hashes of the key, computing fingerprint only once
+     */
+    inline dataslot_key_digest digest() const noexcept
+    {
+        return fingerprint();
+    }
+    /**
+     * slot index hash
+     * @sa dataslot_key_digest
+     */
+    static inline uint64_t hash(const char *k, size_t len) noexcept
+    {
+        return dataslot_key_digest(fingerprint(k, len)).slot;
+    }
+    inline uint64_t hash() const noexcept
+    {
+        return hash(_k, _len);
+    }
+
+    /* additional helpers */
+public:
+    inline bool is_valid() const noexcept
+    {
+        return _len;
+    }
+};
+
+inline bool operator==(
+    const dataslot_key_view &l, const dataslot_key_view &r) noexcept
+{
+    return l._len == r._len && !std::memcmp(l._k, r._k, l._len);
+}
+
+/**
+ * Object key, as held by clients (e.g. in locator caches)
+ *
+ * Only as large as the key itself, unlike the fixed 496B field of the previous
+ * slot format.
+ */
+struct dataslot_key {
+    string _k;
+
+    /* constructors */
+public:
+    /**
+     * Default empty constructor, constructs an invalid key.
+     */
+    dataslot_key() noexcept
+    { }
+    dataslot_key(const char *k)
+    {
+        this->set(k, strlen(k));
+    }
+    dataslot_key(const string &k)
+    {
+        this->set(k.c_str(), k.length());
+    }
+    explicit dataslot_key(const dataslot_key_view &k)
+    {
+        this->set(k.c_str(), k.size());
+    }
+
+    /* required interfaces */
+public:
+    inline const char *c_str() const noexcept
+    {
+        return _k.c_str();
+    }
+    inline size_t size() const noexcept
+    {
+        return _k.length();
+    }
+    inline operator dataslot_key_view() const noexcept
+    {
+        return {_k.c_str(), _k.length()};
+    }
+
+    static inline uint64_t hash(const string &k) noexcept
+    {
+        return dataslot_key_view::hash(k.c_str(), k.length());
+    }
+    inline uint64_t hash() const noexcept
+    {
+        return dataslot_key_view::hash(_k.c_str(), _k.length());
+    }
+    inline uint64_t fingerprint() const noexcept
+    {
+        return dataslot_key_view::fingerprint(_k.c_str(), _k.length());
+    }
+    inline dataslot_key_digest digest() const noexcept
+    {
+        return fingerprint();
+    }
+
+    /* additional helpers */
+public:
+    inline void set(const char *k, size_t len)
+    {
+        if (len > params::max_key_length)
+            throw std::invalid_argument("key too long");
+        _k.assign(k, len);
+    }
+    inline bool is_valid() const noexcept
+    {
+        return !_k.empty();
+    }
+    inline void invalidate() noexcept
+    {
+        _k.clear();
+    }
+};
 
 /**
  * Per-slot Metadata Blob
@@ -46,36 +260,42 @@ constexpr size_t DATA_SEG_LEN = params::data_seg_length;
  * __Overview__
  *
  * ```text
- *      +-----------------------------------+
- *   0  |                                   |
- *      |                Key                |
- *      |                                   |
- *      +-----------------------------------+
- * 496+  0        4        8                 16
- *      +--------+--------+-----------------+
- *      | Length | D. CRC |  Atomic Region  |
- *      +--------+--------+-----------------+
- * 512B
+ *  0                8        12       16                                 56       64B
+ * +----------------+--------+--------+----------------------------------+--------+
+ * |  Key Fingerp.  | Length | D. CRC |             Reserved             | Atomic |
+ * +----------------+--------+--------+----------------------------------+--------+
  * ```
  *
- * Where `D. CRC` stands for CRC of the user data in the current slot.
+ * Where `D. CRC` stands for CRC of the entire data segment of the current slot,
+ * i.e. inline key and user data (see gestalt::dataslot ).
  *
- * An empty key (or starts with '\0') should indicate an invalid slot.
+ * The key itself no longer lives in metadata, it is stored length-prefixed at
+ * the start of the data segment, the 64-bit fingerprint here allows us to tell
+ * a mismatching slot apart without comparing the key.
  *
- * If length is larger than `DATA_SEG_LEN`, the KV entry spans accross multiple
- * consecutive slots. Only the first segment records length of the entire entry.
- * In fact, we zero out the `length` field in tailing slots (see bufferlist.hpp).
+ * If length is larger than what a data segment holds, the KV entry spans
+ * accross multiple consecutive slots. Only the first segment records length of
+ * the entire entry. In fact, we zero out the `length` field in tailing slots
+ * (see bufferlist.hpp).
  *
  * __Atomic Region__
  *
  * ```text
  *  0        8        16       24       32       40       48       56       64b
  * +-----------------------------------+--------------------------+--------+
- * |          Key Hash (CRC)           |                          |V      L|
- * +-----------------------------------+--------------------------+--------+
+ * |              Key Tag              |                 | Gen.   |V      L|
+ * +-----------------------------------+-----------------+--------+--------+
  * ```
  *
- * Where `V` is valid bit, `L` is lock bit.
+ * Where key tag is the upper half of the key fingerprint.
+ *
+ * Where `Gen.` is the generation of the table the slot was written in. A slot
+ * of another generation than the table's current one is empty, therefore the
+ * server formats its table by merely bumping the generation in its superblock.
+ * Generation 0 is never current, a zeroed slot is empty in every generation.
+ *
+ * Where `V` is valid bit, `L` is lock bit. An unset valid bit indicates an
+ * invalid slot.
  *
  * According to RDMA specification, Writes are performed sequencially, therefore
  * placing lock bit at the very end of a slot allows us to update data and then
@@ -90,79 +310,10 @@ constexpr size_t DATA_SEG_LEN = params::data_seg_length;
  * be CAS-ed.
  */
 struct [[gnu::packed]] dataslot_meta {
-    /**
-     * Packed C-style string, with handy helpers
-     */
-    struct [[gnu::packed]] key_type {
-        char _k[496];
-
-        /* constructors */
-
-        /**
-         * Default empty constructor, constructs an invalid slot metadata.
-         */
-        key_type() noexcept
-        {
-            invalidate();
-        }
-        key_type(const char *k)
-        {
-            this->set(k);
-        }
-        key_type(const string &k)
-        {
-            this->set(k.c_str());
-        }
-        key_type &operator=(const key_type &that) noexcept
-        {
-            strcpy(this->_k, that._k);
-            return *this;
-        }
-
-        /* required interfaces */
-    public:
-        inline const auto c_str() const noexcept
-        {
-            return _k;
-        }
-        inline bool operator==(const key_type &that) const noexcept
-        {
-            return !strcmp(this->_k, that._k);
-        }
-        inline bool operator!=(const key_type &that) const noexcept
-        {
-            return !(*this == that);
-        }
-
-        static inline uint32_t hash(const string &k) noexcept
-        {
-            return crc32_iscsi((uint8_t*)k.c_str(), k.length(), 0x114514);
-        }
-        inline auto hash() const noexcept
-        {
-            return hash(_k);
-        }
-
-        /* additional helpers */
-    public:
-        inline void set(const char *k)
-        {
-            if (strlen(k) > sizeof(key) - 1)
-                throw std::invalid_argument("key too long");
-            strcpy(this->_k, k);
-        }
-        inline bool is_valid() const noexcept
-        {
-            return !!_k[0];
-        }
-        inline void invalidate() noexcept
-        {
-            _k[0] = '\0';
-        }
-    } key;
-
+    uint64_t key_fp;
     uint32_t length;
     uint32_t data_crc;
+    uint8_t _reserved[40] = {};
 
     /* HACK: don't mind the assignment in a byte, atomic anyway */
     enum bits_flag : uint8_t {
@@ -173,13 +324,14 @@ struct [[gnu::packed]] dataslot_meta {
     union [[gnu::packed]] a {
         uint64_t u64;
         struct [[gnu::packed]] p {
-            uint32_t key_crc = 0;
+            uint32_t key_tag = 0;
             /**
              * number of trailing slots if the entry is multi-slot
              * NOTE: currently always 0, since multi-slot is not implemented
              */
             uint16_t nr_slots = 0;
-            uint8_t _ = 0;
+            /** table generation, see above */
+            uint8_t generation = 0;
             uint8_t bits = bits_flag::none;
         public:
             constexpr p() noexcept = default;
@@ -187,9 +339,11 @@ struct [[gnu::packed]] dataslot_meta {
 
         a() noexcept : u64(0)
         { }
-        a(uint32_t crc, bits_flag f = bits_flag::valid) noexcept : u64(0)
+        a(uint32_t tag, bits_flag f = bits_flag::valid, uint8_t gen = 0) noexcept :
+            u64(0)
         {
-            m.key_crc = crc;
+            m.key_tag = tag;
+            m.generation = gen;
             m.bits = f;
         }
     } atomic;
@@ -199,43 +353,15 @@ public:
     /**
      * Default constructor, constructs invalid slot metadata.
      */
-    dataslot_meta() noexcept : key(), atomic() {}
-    dataslot_meta(const char *k) : key(k), atomic(key.hash())
-    { }
-    /**
-     * Helper when initialized with data.
-     * @param k key
-     * @param dlen data length
-     * @param dcrc data CRC
-     */
-    dataslot_meta(const char *k, unsigned dlen, uint32_t dcrc) :
-        key(k), length(dlen), data_crc(dcrc), atomic(key.hash())
-    { }
+    dataslot_meta() noexcept : key_fp(0), length(0), data_crc(0), atomic() {}
 
     /* helpers */
 public:
-    /**
-     * Checks key-related fields.
-     * @return
-     * * 0 if key-related fields are valid
-     * * -EINVAL if key is invalid, i.e. slot is unused
-     * * -ECOMM if key is set but CRC does not match
-     */
-    inline int key_validity() const noexcept
-    {
-        if (!key.is_valid())
-            return -EINVAL;
-        if (!(atomic.m.bits & bits_flag::valid))
-            return -EINVAL;
-        if (key.hash() != atomic.m.key_crc)
-            return -ECOMM;
-        return 0;
-    }
     inline void invalidate() noexcept
     {
         // atomic.m.bits = bits_flag::none;
         atomic.u64 = 0;
-        key.invalidate();
+        key_fp = 0;
     }
 
     /**
@@ -245,10 +371,10 @@ public:
      *
      * @param k new key
      */
-    inline void set_key(const char *k)
+    inline void set_key(const dataslot_key_view &k) noexcept
     {
-        key.set(k);
-        atomic.m.key_crc = key.hash();
+        key_fp = k.fingerprint();
+        atomic.m.key_tag = dataslot_key_digest::tag(key_fp);
         atomic.m.bits = bits_flag::valid;
     }
 
@@ -268,42 +394,79 @@ public:
 };
 static_assert(std::is_standard_layout_v<dataslot_meta>);
 static_assert(sizeof(dataslot_meta::atomic) == 8);
-static_assert(sizeof(dataslot_meta) == 512_B);
+static_assert(sizeof(dataslot_meta) == 64_B);
 
 /**
  * Slot in headless hashtable, packages user data and inline metadata.
  *
  * User data is packed ahead of metadata, for lock bit must be at the end of the
  * slot (see gestalt::dataslot_meta ).
+ *
+ * __Data Segment__
+ *
+ * ```text
+ *  0        2
+ * +--------+------------------+----+--------------------------------------+
+ * | K. Len |       Key        | \0 |              User Data               |
+ * +--------+------------------+----+--------------------------------------+
+ *                                               DATA_SEG_LEN + KEY_SEG_RESERVE
+ * ```
+ *
+ * Keys no longer than `KEY_SEG_RESERVE - 3` leave the full `DATA_SEG_LEN` for
+ * user data, longer keys take it out of user data.
  */
 struct [[gnu::packed]] dataslot {
     using meta_type = dataslot_meta;
-    using key_type = dataslot_meta::key_type;
+    using key_type = dataslot_key;
+    using key_view = dataslot_key_view;
+    /** user data of the current slot */
+    using value_type = std::span<uint8_t>;
 
     /**
-     * Packed buffer, with handy helpers
+     * Packed buffer of inline key and user data, with handy helpers
      */
-    struct [[gnu::packed]] value_type {
-        uint8_t _d[DATA_SEG_LEN];
+    struct [[gnu::packed]] segment_type {
+        uint16_t key_len;
+        uint8_t _d[DATA_SEG_LEN + KEY_SEG_RESERVE - sizeof(key_len)];
 
         /* constructors */
     public:
-        value_type() noexcept {}
+        segment_type() noexcept : key_len(0) {}
+        segment_type(const segment_type &) = delete;
+
+        /* helpers */
+    public:
         /**
-         * Initialize with given data
-         * @param d source buffer
-         * @param len length to be copied
+         * Bytes left for user data after an inline key of length #klen
+         */
+        static constexpr size_t capacity(size_t klen) noexcept
+        {
+            return sizeof(_d) - klen - 1;
+        }
+        /**
+         * @return inline key, or an empty key if the length prefix is garbage
          */
-        value_type(const void *d, size_t len)
+        inline key_view key() const noexcept
+        {
+            if (key_len > params::max_key_length)
+                [[unlikely]] return {};
+            return {reinterpret_cast<const char*>(_d), key_len};
+        }
+        inline uint8_t *value() noexcept
+        {
+            return _d + key_len + 1;
+        }
+        inline const uint8_t *value() const noexcept
+        {
+            return _d + key_len + 1;
+        }
+        inline size_t capacity() const noexcept
         {
-            this->set(d, len);
+            return capacity(key_len);
         }
-        value_type(const value_type &) = delete;
 
-        /* helpers */
-    public:
         /**
-         * Assigns data
+         * Assigns key and data
          *
          * @note
          * Unused part of the buffer should be zeroed-out, for data length is
@@ -311,23 +474,21 @@ struct [[gnu::packed]] dataslot {
          * consecutive-slots-design, valid segment size of the current slot is
          * not recorded at all), so we checksum on the entire block.
          *
+         * @param k key
          * @param d source data buffer
          * @param len length to be copied
          */
-        inline void set(const void *d, size_t len)
+        inline void set(const key_view &k, const void *d, size_t len)
         {
-            if (len > sizeof(_d))
+            if (k.size() > params::max_key_length)
+                throw std::invalid_argument("key too long");
+            if (len > capacity(k.size()))
                 throw std::invalid_argument("too large");
-            memcpy(_d, d, len);
-            memset(_d + len, 0, sizeof(_d) - len);
-        }
-        /**
-         * Get buffer
-         * @return raw buffer pointer
-         */
-        inline auto get() noexcept
-        {
-            return _d;
+            key_len = k.size();
+            memcpy(_d, k.c_str(), key_len);
+            _d[key_len] = '\0';
+            memcpy(value(), d, len);
+            memset(value() + len, 0, sizeof(_d) - key_len - 1 - len);
         }
 
         static inline uint32_t checksum(const void *d, size_t len) noexcept
@@ -336,7 +497,7 @@ struct [[gnu::packed]] dataslot {
         }
         inline auto checksum() const noexcept
         {
-            return checksum(_d, sizeof(_d));
+            return checksum(this, sizeof(*this));
         }
     } data;
 
@@ -348,40 +509,47 @@ public:
      * Default constructor, constructs invalid / unused slot.
      */
     dataslot() noexcept : meta() {}
-    dataslot(const char *k, const void *d, size_t dlen)
+    dataslot(const key_view &k, const void *d, size_t dlen)
     {
         reset(k, d, dlen);
     }
-    void reset(const key_type &k, const void *d, size_t dlen)
+    dataslot(const key_type &k, std::span<const uint8_t> v)
+    {
+        reset(k, v.data(), v.size());
+    }
+    void reset(const key_view &k, const void *d, size_t dlen)
     {
         /* optionally invalidate slot, setting data automatically causes checksum
             to mismatch */
         // invalidate();
-        data.set(d, dlen);
+        data.set(k, d, dlen);
         meta.length = dlen;
         meta.data_crc = data.checksum();
         /* set valid flag at the end */
-        meta.set_key(k.c_str());
+        meta.set_key(k);
     }
-    dataslot(const string &k, const value_type &v) :
-        data(const_cast<value_type&>(v).get(), sizeof(v)),
-        meta(k.c_str(), sizeof(v), v.checksum())
-    { }
 
     /* required interface */
 public:
-    inline const key_type &key() const noexcept
+    inline key_view key() const noexcept
     {
-        return meta.key;
+        return data.key();
     }
-    inline value_type &value() noexcept
+    inline value_type value() noexcept
     {
-        return data;
+        return {data.value(), data.capacity()};
     }
     inline size_t size() const noexcept
     {
         return meta.length;
     }
+    /**
+     * @return bytes of user data this slot can hold with its current key
+     */
+    inline size_t capacity() const noexcept
+    {
+        return data.capacity();
+    }
 
     inline void invalidate() noexcept
     {
@@ -389,10 +557,8 @@ public:
     }
     inline bool is_valid() const noexcept
     {
-        return (
-                meta.key_validity() == 0
-            && data.checksum() == meta.data_crc
-        );
+        const int v = validity();
+        return !v || v == -EAGAIN;
     }
     inline bool is_invalid() const noexcept
     {
@@ -401,27 +567,52 @@ public:
 
     /* helpers */
 public:
+    /**
+     * Check whether slot holds key #k, compares fingerprint first, and only
+     * compares the inline key if it matches.
+     * @param k wanted key
+     * @param fp fingerprint of #k
+     */
+    inline bool holds(const key_view &k, uint64_t fp) const noexcept
+    {
+        return meta.key_fp == fp && key() == k;
+    }
+    inline bool holds(const key_view &k) const noexcept
+    {
+        return holds(k, k.fingerprint());
+    }
+
     /**
      * Check slot validity
+     * @param gen current generation of the table this slot was read from, 0
+     *      for not checking, e.g. slots built locally
      * @return
      * * 0 slot is valid, ready to be read
-     * * -EINVAL if invalid or unused
+     * * -EINVAL if invalid or unused, or of another generation
      * * -ECOMM if checksum, either key or data, does not match
      * * -EAGAIN valid, but currently locked
      */
-    inline int validity() const noexcept
+    inline int validity(uint8_t gen = 0) const noexcept
     {
-        if (auto kv = meta.key_validity(); kv)
-            return kv;
+        if (!(meta.atomic.m.bits & meta_type::bits_flag::valid))
+            return -EINVAL;
+        if (gen && meta.atomic.m.generation != gen)
+            return -EINVAL;
         if (data.checksum() != meta.data_crc)
             return -ECOMM;
+        const auto k = key();
+        if (!k.is_valid())
+            return -EINVAL;
+        if (k.fingerprint() != meta.key_fp
+                || dataslot_key_digest::tag(meta.key_fp) != meta.atomic.m.key_tag)
+            return -ECOMM;
         if (meta.is_locked())
             return -EAGAIN;
         return 0;
     }
 };
 static_assert(std::is_standard_layout_v<dataslot>);
-static_assert((sizeof(dataslot) % 512_B) == 0);
+static_assert((sizeof(dataslot) % 64_B) == 0);
 
 }   /* namespace gestalt */
 
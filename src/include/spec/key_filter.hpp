@@ -0,0 +1,108 @@
+/**
+ * @file key_filter.hpp
+ *
+ * Key filter - a blocked counting Bloom filter over keys resident on a server,
+ * for clients to tell keys certainly absent without Reading their slots
+ *
+ * Counters of a key all lie in one 64 B block, so that a lookup is a single
+ * small Read, and a block is what clients cache. Counters are 16 bits, four to
+ * a 64-bit word, and incremented by inserting clients with RDMA Fetch and Add
+ * on the word, far from ever carrying into the next counter. The filter
+ * follows the occupancy bitmap in the index region of a server, see
+ * session::conn_reply::index .
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "./params.hpp"
+#include "./dataslot.hpp"
+
+
+namespace gestalt {
+namespace key_filter {
+
+using counter_t = uint16_t;
+/** counters a key takes */
+constexpr unsigned nr_hashes = 4;
+constexpr size_t counters_per_word = sizeof(uint64_t) / sizeof(counter_t);
+
+struct alignas(64) block {
+    uint64_t words[8];
+};
+static_assert(sizeof(block) == 64_B);
+constexpr size_t counters_per_block = sizeof(block) / sizeof(counter_t);
+
+/** where the counters of a key lie */
+struct position {
+    size_t block;
+    /** counters in #block, may repeat */
+    uint8_t counter[nr_hashes];
+
+    /** word of #block counter #i is in */
+    inline unsigned word(unsigned i) const noexcept
+    {
+        return counter[i] / counters_per_word;
+    }
+    /** bit counter #i starts at in its word */
+    inline unsigned shift(unsigned i) const noexcept
+    {
+        return counter[i] % counters_per_word * 8 * sizeof(counter_t);
+    }
+    /** Fetch and Add operand incrementing counter #i */
+    inline uint64_t addend(unsigned i) const noexcept
+    {
+        return 1ul << shift(i);
+    }
+};
+
+/**
+ * @param fp key fingerprint, see gestalt::dataslot_key_digest
+ * @param nr_blocks blocks of the filter, non-zero
+ */
+inline position locate(uint64_t fp, size_t nr_blocks) noexcept
+{
+    const uint64_t h = dataslot_key_digest::mix(fp ^ params::filter_hash_seed);
+    position p;
+    p.block = static_cast<unsigned __int128>(h) * nr_blocks >> 64;
+    /* low bits are left to pick counters, #block takes the high ones */
+    const uint64_t g = dataslot_key_digest::mix(h);
+    for (unsigned i = 0; i < nr_hashes; i++)
+        p.counter[i] = (g >> (8 * i)) % counters_per_block;
+    return p;
+}
+
+inline counter_t count(const block &b, const position &p, unsigned i) noexcept
+{
+    return b.words[p.word(i)] >> p.shift(i);
+}
+
+/** whether a key at #p may be resident, false means certainly absent */
+inline bool may_contain(const block &b, const position &p) noexcept
+{
+    for (unsigned i = 0; i < nr_hashes; i++)
+        if (!count(b, p, i))
+            return false;
+    return true;
+}
+
+/** count a key in, as RDMA Fetch and Add on the remote block would */
+inline void add(block &b, const position &p) noexcept
+{
+    for (unsigned i = 0; i < nr_hashes; i++)
+        b.words[p.word(i)] += p.addend(i);
+}
+
+/**
+ * where the filter starts in the index region of a table of #nr_slots slots,
+ * i.e. bytes of the occupancy bitmap, padded to whole blocks
+ */
+constexpr size_t offset(size_t nr_slots) noexcept
+{
+    return (nr_slots + 8 * sizeof(block) - 1) / (8 * sizeof(block)) * sizeof(block);
+}
+
+}   /* namespace key_filter */
+}   /* namespace gestalt */
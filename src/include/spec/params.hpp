@@ -14,6 +14,17 @@ namespace params {
 
 constexpr size_t hht_search_length = 5;
 constexpr size_t data_seg_length = 4_K;
+/**
+ * room in front of each data segment for the length-prefixed key, keys shorter
+ * than this do not eat into #data_seg_length
+ */
+constexpr size_t key_seg_reserve = 64_B;
+constexpr size_t max_key_length = 495;
+
+/* seeds deriving independent hashes from one key fingerprint */
+constexpr uint64_t placement_hash_seed = 0x9e3779b97f4a7c15;
+constexpr uint64_t slot_hash_seed = 0xbf58476d1ce4e5b9;
+constexpr uint64_t filter_hash_seed = 0x94d049bb133111eb;
 constexpr size_t max_op_size = 1e2 * 4_K + hht_search_length;
 constexpr unsigned max_poll_retry = 1e6;
 constexpr unsigned eager_retry_threshold_ns = 1e3;
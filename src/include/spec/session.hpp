@@ -0,0 +1,97 @@
+/**
+ * @file session.hpp
+ *
+ * RDMA CM private data exchanged when a client connects to a server
+ *
+ * The client names itself in the private data of its connection request, and
+ * the server replies with descriptors of the memory regions it serves in the
+ * private data of its accept, therefore a session is bootstrapped with one RDMA
+ * CM exchange.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+namespace gestalt {
+namespace session {
+
+constexpr uint32_t magic = 0x67737431;  // "gst1"
+constexpr uint16_t version = 4;
+
+/**
+ * private data of rdma_connect(), IB allows at most 56 bytes
+ */
+struct __attribute__((packed)) conn_request {
+    uint32_t magic;
+    uint16_t version;
+    /**
+     * index of this connection among QPs of the client to the same server, a
+     * client reconnecting a lane it already holds has restarted
+     */
+    uint16_t lane;
+    /** client unique ID */
+    uint32_t client_id;
+};
+static_assert(sizeof(conn_request) <= 56);
+
+/** required fields operating RDMA memory region */
+struct __attribute__((packed)) region_descriptor {
+    uint64_t addr;
+    uint64_t length;
+    uint32_t rkey;
+};
+
+/**
+ * what survives if a server goes away, deciding how clients make their writes
+ * durable
+ */
+enum class durability : uint8_t {
+    /** volatile memory, e.g. a DRAM cache tier, nothing to flush */
+    none = 0,
+    /**
+     * page cache of a file, survives server restarts but not power failures,
+     * written data only has to reach memory
+     */
+    process = 1,
+    /**
+     * persistent memory, survives power failures once flushed out of the RNIC,
+     * i.e. Write followed by a flushing Read
+     */
+    power_fail = 2,
+};
+
+/**
+ * private data of rdma_accept(), IB allows at most 196 bytes
+ */
+struct __attribute__((packed)) conn_reply {
+    static constexpr size_t max_regions = 8;
+
+    uint32_t magic;
+    uint16_t version;
+    /** number of valid entries in #regions */
+    uint8_t nr_regions;
+    /**
+     * current generation of the slot table, slots of other generations are
+     * empty, see gestalt::dataslot_meta
+     */
+    uint8_t generation;
+    /** durability of the memory regions */
+    session::durability durability;
+    uint8_t _reserved[3];
+    /**
+     * index region of the slot table: the occupancy bitmap, bit i of word
+     * i / 64 set once slot i is claimed by an inserting client (see
+     * ops::Claim), padded to key filter blocks, followed by the key filter of
+     * resident keys, if any (see gestalt::key_filter)
+     */
+    region_descriptor index;
+    /** memory regions of the bucket, in ascending order of address */
+    region_descriptor regions[max_regions];
+};
+static_assert(sizeof(conn_reply) <= 196);
+
+}   /* namespace session */
+}   /* namespace gestalt */
@@ -27,6 +27,8 @@ scope_guard::scope_guard(scope_guard &&other)
     pci_root = other.pci_root;
     do_nothing = other.do_nothing;
     original_perfctrlsts = other.original_perfctrlsts;
+    /* only one of them restores DDIO */
+    other.do_nothing = true;
 }
 
 scope_guard::~scope_guard()
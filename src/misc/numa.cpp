@@ -5,6 +5,7 @@
 #include <cstring>
 #include <filesystem>
 #include <stdexcept>
+#include <unistd.h>
 #ifdef GET_NUMA_WITH_LIBNDCTL
 #include <ndctl/libndctl.h>
 #endif
@@ -32,10 +33,27 @@ int get_numa_node(const ibv_device *dev)
     return numa_id;
 }
 
-ibv_context *choose_rnic_on_same_numa(
-    const char *pmem_dev,
-    ibv_context **devices
-) {
+vector<unsigned> get_cpus(int numa)
+{
+    vector<unsigned> cpus;
+    if (numa < 0)
+        return cpus;
+    ifstream f(filesystem::path("/sys/devices/system/node")
+        / ("node" + std::to_string(numa)) / "cpulist");
+    /* e.g. "0-15,32-47" */
+    for (string range; std::getline(f >> std::ws, range, ',');) {
+        unsigned lo, hi;
+        const auto dash = range.find('-');
+        lo = std::stoul(range.substr(0, dash));
+        hi = dash == string::npos ? lo : std::stoul(range.substr(dash + 1));
+        for (auto c = lo; c <= hi; c++)
+            cpus.push_back(c);
+    }
+    return cpus;
+}
+
+int get_pmem_numa_node(const char *pmem_dev)
+{
     int numa = -1;
 
 #ifdef GET_NUMA_WITH_LIBNDCTL
@@ -79,10 +97,11 @@ ibv_context *choose_rnic_on_same_numa(
     {
         namespace pt = boost::property_tree;
 
-        /* get `ndctl` output */
+        /* get `ndctl` output, to a file of this thread, for shards of a
+            server look up their devices concurrently */
         const auto outdir = filesystem::path("/tmp/gestalt/");
         filesystem::create_directory(outdir);
-        const auto out = outdir / "ndctl_out.json";
+        const auto out = outdir / ("ndctl_out." + std::to_string(gettid()) + ".json");
         std::system((string("echo -n '{\"data\":' > ") + out.string()).c_str());
         std::system((string("ndctl list -v >> ") + out.string()).c_str());
         std::system((string("echo -n '}' >> ") + out.string()).c_str());
@@ -117,6 +136,15 @@ ibv_context *choose_rnic_on_same_numa(
         }
     }
 
+    return numa;
+}
+
+ibv_context *choose_rnic_on_same_numa(
+    const char *pmem_dev,
+    ibv_context **devices
+) {
+    const int numa = get_pmem_numa_node(pmem_dev);
+
     /* iterate through RNIC devices */
     for (int i = 0; devices[i]; ++i) {
         auto &ctx = devices[i];
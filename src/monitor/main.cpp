@@ -7,7 +7,10 @@
  */
 
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <map>
+#include <vector>
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
@@ -28,6 +31,7 @@
 #include "defaults.hpp"
 
 using namespace std;
+using namespace std::chrono_literals;
 
 
 namespace gestalt {
@@ -40,16 +44,56 @@ using namespace google::protobuf;
 class ClusterMapServicer final : public gestalt::rpc::ClusterMap::Service {
 
     mutable std::mutex _mutex;
+    /** notified when #epoch advances */
+    std::condition_variable epoch_cv;
+    /** cluster map epoch, advanced on every membership change */
+    uint64_t epoch = 1;
 
     struct server_prop_t {
         boost::asio::ip::address addr;
+        uint64_t capacity;
+        vector<boost::asio::ip::address> rdma_addrs;
+        /** bucket membership, and where buckets live on the server */
+        vector<BucketExtent> buckets;
     public:
-        server_prop_t(const boost::asio::ip::address &_addr) noexcept :
-            addr(_addr)
+        server_prop_t(const boost::asio::ip::address &_addr, uint64_t _cap,
+                vector<boost::asio::ip::address> &&_rdma_addrs,
+                vector<BucketExtent> &&_buckets) noexcept :
+            addr(_addr), capacity(_cap), rdma_addrs(std::move(_rdma_addrs)),
+            buckets(std::move(_buckets))
         { }
     };
     map<unsigned, server_prop_t> server_props;  ///< server ID -> properties
 
+    /** @note call with #_mutex held */
+    void dump_servers(ServerList *out) const
+    {
+        for (const auto &[id, prop] : server_props) {
+            auto p = out->add_servers();
+            p->set_id(id);
+            ostringstream addr;
+            addr << prop.addr;
+            p->set_addr(addr.str());
+            p->set_capacity(prop.capacity);
+            for (const auto &a : prop.rdma_addrs) {
+                ostringstream rdma_addr;
+                rdma_addr << a;
+                p->add_rdma_addrs(rdma_addr.str());
+            }
+            for (const auto &b : prop.buckets)
+                *p->add_buckets() = b;
+        }
+        out->set_epoch(epoch);
+    }
+
+    /** @note call with #_mutex held */
+    void advance_epoch()
+    {
+        epoch++;
+        epoch_cv.notify_all();
+        BOOST_LOG_TRIVIAL(info) << "Cluster map advanced to epoch " << epoch;
+    }
+
 public:
     ClusterMapServicer() : server_props()
     { }
@@ -79,6 +123,7 @@ public:
 
         /* verifying address */
         boost::asio::ip::address addr;
+        vector<boost::asio::ip::address> rdma_addrs;
         try {
             addr = boost::asio::ip::make_address(in->addr());
         }
@@ -87,25 +132,87 @@ public:
                 << in->addr() << ": " << e.what();
             return Status(StatusCode::INVALID_ARGUMENT, "addr");
         }
+        for (const auto &a : in->rdma_addrs()) {
+            try {
+                rdma_addrs.push_back(boost::asio::ip::make_address(a));
+            }
+            catch (std::exception &e) {
+                BOOST_LOG_TRIVIAL(warning) << "Failed to digest server RDMA "
+                    << "address " << a << ": " << e.what();
+                return Status(StatusCode::INVALID_ARGUMENT, "rdma_addrs");
+            }
+        }
+
+        /* buckets of a server must not overlap, nor leave its memory region */
+        vector<BucketExtent> buckets(in->buckets().begin(), in->buckets().end());
+        std::sort(buckets.begin(), buckets.end(), [] (const auto &a, const auto &b) {
+            return a.offset() < b.offset();
+        });
+        for (size_t i = 0; i < buckets.size(); i++) {
+            const auto &b = buckets[i];
+            if (b.name().empty() || !b.length()
+                    || (in->capacity() && b.offset() + b.length() > in->capacity())
+                    || (i && buckets[i - 1].offset() + buckets[i - 1].length() > b.offset())) {
+                BOOST_LOG_TRIVIAL(warning) << "Server " << in->addr()
+                    << " advertised malformed bucket " << b.name();
+                return Status(StatusCode::INVALID_ARGUMENT, "buckets");
+            }
+        }
 
-        server_props.insert({new_id, {addr}});
+        ostringstream membership;
+        for (const auto &b : buckets)
+            membership << " " << b.name();
+        server_props.insert({new_id,
+            {addr, in->capacity(), std::move(rdma_addrs), std::move(buckets)}});
         BOOST_LOG_TRIVIAL(info) << "Registered server " << new_id
-            << " @ " << in->addr();
+            << " @ " << in->addr() << ", buckets:" << membership.str();
+        advance_epoch();
 
         out->set_id(new_id);
         return Status::OK;
     }
 
+    Status RemoveServer(ServerContext *ctx,
+        const ServerProp *in, Empty *out) override
+    {
+        std::scoped_lock l(_mutex);
+
+        if (!server_props.erase(in->id())) {
+            BOOST_LOG_TRIVIAL(warning) << "Try removing unknown server "
+                << in->id() << ", do nothing";
+            return Status(StatusCode::NOT_FOUND, "no server with this ID");
+        }
+        BOOST_LOG_TRIVIAL(info) << "Removed server " << in->id();
+        advance_epoch();
+        return Status::OK;
+    }
+
     Status GetServers(ServerContext *ctx,
         const Empty *in, ServerList *out) override
     {
         std::scoped_lock l(_mutex);
-        for (const auto &[id, prop] : server_props) {
-            auto p = out->add_servers();
-            p->set_id(id);
-            ostringstream addr;
-            addr << prop.addr;
-            p->set_addr(addr.str());
+        dump_servers(out);
+        return Status::OK;
+    }
+
+    Status Watch(ServerContext *ctx,
+        const WatchRequest *in, ServerWriter<ServerList> *out) override
+    {
+        BOOST_LOG_TRIVIAL(trace) << "Watch request from peer " << ctx->peer();
+
+        uint64_t sent = in->known_epoch();
+        while (!ctx->IsCancelled()) {
+            ServerList o;
+            {
+                std::unique_lock l(_mutex);
+                /* wake up once in a while to notice cancellation */
+                if (!epoch_cv.wait_for(l, 1s, [&] { return epoch > sent; }))
+                    continue;
+                dump_servers(&o);
+                sent = epoch;
+            }
+            if (!out->Write(o))
+                break;
         }
         return Status::OK;
     }
@@ -165,6 +165,13 @@ public:
     {
         return _capacity;
     }
+    /**
+     *  @return underlying buffer
+     */
+    inline entry_type *data() noexcept
+    {
+        return _d;
+    }
 
     /* modifiers */
 
@@ -186,7 +193,7 @@ public:
      */
     void insert(const entry_type &e)
     {
-        auto &cell = (*this)[e.key()];
+        auto &cell = (*this)[key_type(e.key())];
         if (cell.is_valid())
             throw std::overflow_error("key already exist");
         cell = e;
@@ -5,7 +5,13 @@
  */
 
 #include <filesystem>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <boost/log/trivial.hpp>
 #include "common/boost_log_helper.hpp"
@@ -13,6 +19,8 @@
 
 #include "defaults.hpp"
 #include "./server.hpp"
+#include "misc/numa.hpp"
+#include "common/defer.hpp"
 
 using namespace std;
 
@@ -23,9 +31,15 @@ int main(const int argc, const char **argv)
 
     filesystem::path config_path;   // path to config file
     string log_level;               // Boost log level
-    unsigned server_id = 0;         // specified server ID
-    string server_addr;             // specified server address
-    filesystem::path dax_path;      // path to devdax
+    vector<unsigned> server_ids;    // specified server IDs, one per shard
+    vector<string> server_addrs;    // specified server addresses, one per shard
+    vector<string> rdma_addrs;      // RDMA endpoints, one per RNIC or port
+    vector<string> buckets;         // buckets served
+    string backend;                 // storage backend
+    vector<filesystem::path> paths; // storage of each shard
+    vector<int> numas;              // NUMA node of each shard
+    gestalt::StorageBackend::spec storage;
+    size_t size_mb, hugepage_mb;
 
     {
         namespace po = boost::program_options;
@@ -37,20 +51,64 @@ int main(const int argc, const char **argv)
                 "./etc/gestalt/gestalt.conf, whichever comes first.")
             ("log", po::value(&log_level)->default_value("info"),
                 "Logging level (Boost).")
-            ("id", po::value(&server_id), "specify server ID")
-            ("addr", po::value(&server_addr)->required(), "specify server address")
-            ("dax-dev", po::value(&dax_path)->required(),
-                "Path to DEVDAX device.")
+            ("id", po::value(&server_ids)->multitoken(),
+                "specify server ID, of each shard")
+            ("addr", po::value(&server_addrs)->multitoken()->required(),
+                "specify server address, of each shard, e.g. of its NUMA-local "
+                "RNIC, one shard is served per address")
+            ("rdma-addr", po::value(&rdma_addrs)->multitoken(),
+                "Addresses to serve RDMA on, one per RNIC or port, all serving "
+                "the same storage, --addr if not given. Single shard only.")
+            ("bucket", po::value(&buckets)->multitoken(),
+                "Buckets to serve, sharing storage by their configured share, "
+                "all declared in config if not given.")
+            ("backend", po::value(&backend)->default_value("devdax"),
+                "Storage backend, devdax | file (fsdax or any filesystem) "
+                "| hugepage (volatile DRAM).")
+            ("dax-dev", po::value(&paths)->multitoken(),
+                "Path to DEVDAX device, or to file of the file backend, of "
+                "each shard.")
+            ("numa", po::value(&numas)->multitoken(),
+                "NUMA node of each shard, its threads and memory stay there, "
+                "detected for devdax, -1 for any.")
+            ("size", po::value(&size_mb)->default_value(0),
+                "Storage size in MiB, for hugepage, or for creating a file, "
+                "of each shard, existing files and devdax are mapped whole.")
+            ("hugepage-size", po::value(&hugepage_mb)->default_value(2),
+                "Hugepage size in MiB, 2 or 1024.")
             ;
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);
     }
+    storage.kind = gestalt::StorageBackend::parse_kind(backend);
+    storage.size = size_mb << 20;
+    storage.hugepage_size = hugepage_mb << 20;
+    const size_t nr_shards = server_addrs.size();
+    if (storage.kind != gestalt::StorageBackend::Kind::hugepage && paths.size() != nr_shards) {
+        BOOST_LOG_TRIVIAL(fatal) << "--dax-dev of each shard is required by "
+            << backend << " backend";
+        exit(EXIT_FAILURE);
+    }
+    if ((!server_ids.empty() && server_ids.size() != nr_shards)
+            || (!numas.empty() && numas.size() != nr_shards)
+            || (!paths.empty() && paths.size() != nr_shards)) {
+        BOOST_LOG_TRIVIAL(fatal) << "--id, --dax-dev and --numa must be given "
+            << "for all " << nr_shards << " shard(s) or none";
+        exit(EXIT_FAILURE);
+    }
+    if (!rdma_addrs.empty() && nr_shards > 1) {
+        BOOST_LOG_TRIVIAL(fatal) << "--rdma-addr is for a single shard, shards "
+            << "serve RDMA on their --addr";
+        exit(EXIT_FAILURE);
+    }
+    server_ids.resize(nr_shards, 0);
+    paths.resize(nr_shards);
 
     set_boost_log_level(log_level);
 
     /* PMem DEVDAX mapping requires root */
-    if (geteuid()) {
+    if (storage.kind == gestalt::StorageBackend::Kind::devdax && geteuid()) {
         BOOST_LOG_TRIVIAL(fatal) << "Not running as root!";
         exit(EXIT_FAILURE);
     }
@@ -70,14 +128,73 @@ int main(const int argc, const char **argv)
     }
 
 
-    /* run server */
-    auto server_runtime = gestalt::Server::create(
-        config_path, server_id, server_addr, dax_path);
-    BOOST_LOG_TRIVIAL(info) << "Server runtime successfully created!";
+    /* run shards, each on its own thread and NUMA node, so that everything
+        a shard spawns (MR registration, formatting, connection manager, RPC)
+        and every page it touches first stays local to its device */
+    mutex m;
+    condition_variable cv;
+    /* runtimes of shards up, one failing takes the others down */
+    vector<gestalt::Server*> runtimes(nr_shards, nullptr);
+    size_t nr_stopped = 0;
+    bool failed = false;
+    vector<std::jthread> shards;
+    for (size_t i = 0; i < nr_shards; i++) {
+        shards.emplace_back([&, i] {
+            try {
+                auto spec = storage;
+                spec.path = paths[i];
+                int numa = numas.empty() ? -1 : numas[i];
+                if (numas.empty() && spec.kind == gestalt::StorageBackend::Kind::devdax)
+                    numa = gestalt::misc::numa::get_pmem_numa_node(
+                        spec.path.filename().c_str());
+                if (const auto cpus = gestalt::misc::numa::get_cpus(numa); !cpus.empty()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    for (const auto &c : cpus)
+                        CPU_SET(c, &set);
+                    if (errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); errno)
+                        boost_log_errno_throw(pthread_setaffinity_np);
+                    BOOST_LOG_TRIVIAL(info) << "Shard " << i << " @ "
+                        << server_addrs[i] << " runs on NUMA " << numa;
+                }
+
+                auto server_runtime = gestalt::Server::create(config_path,
+                    server_ids[i], server_addrs[i], rdma_addrs, buckets, spec);
+                BOOST_LOG_TRIVIAL(info) << "Server runtime successfully created!";
+                {
+                    lock_guard l(m);
+                    if (failed)
+                        [[unlikely]] return;
+                    runtimes[i] = server_runtime.get();
+                }
+                defer([&] {
+                    lock_guard l(m);
+                    runtimes[i] = nullptr;
+                    nr_stopped++;
+                    cv.notify_all();
+                });
+
+                server_runtime->run();
+            }
+            catch (const std::exception &e) {
+                BOOST_LOG_TRIVIAL(fatal) << "Shard " << i << " failed: " << e.what();
+                lock_guard l(m);
+                failed = true;
+                cv.notify_all();
+            }
+        });
+    }
 
     /* TODO: register stop() to SIGINT */
 
-    server_runtime->run();
+    {
+        unique_lock l(m);
+        cv.wait(l, [&] { return failed || nr_stopped == nr_shards; });
+        for (const auto &r : runtimes)
+            if (r)
+                r->stop();
+    }
+    shards.clear();
 
-    return 0;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
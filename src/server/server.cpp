@@ -8,7 +8,10 @@
 #include <fstream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
 using namespace std::chrono_literals;
+#include <poll.h>
+#include <arpa/inet.h>
 
 #include "common/boost_log_helper.hpp"
 #include <boost/property_tree/ini_parser.hpp>
@@ -26,9 +29,11 @@ using namespace std::chrono_literals;
 #include <grpcpp/security/server_credentials.h>
 
 #include "./server.hpp"
+#include "./table_format.hpp"
 #include "misc/numa.hpp"
 #include "misc/ddio.hpp"
 #include "common/defer.hpp"
+#include "spec/session.hpp"
 #include "./session_servicer.hpp"
 
 
@@ -36,27 +41,99 @@ namespace gestalt {
 using namespace std;
 
 namespace {
-struct __IbvPdDeleter {
-    inline void operator()(ibv_pd *pd)
+
+/** QP of the listening endpoint and of every accepted connection */
+inline ibv_qp_init_attr qp_init_attr()
+{
+    return ibv_qp_init_attr{
+        .cap = { .max_send_wr = 1024, .max_recv_wr = 1024,
+                    .max_send_sge = 16, .max_recv_sge = 16,
+                    .max_inline_data = 512 },
+        .qp_type = IBV_QPT_RC,
+        .sq_sig_all = 0
+    };
+}
+}
+
+decltype(Server::rnic_t::mrs) Server::register_storage(
+    const boost::property_tree::ptree &config,
+    const StorageBackend &backend, ibv_pd *pd)
+{
+    /* registered in chunks concurrently, pinning pages is what takes long */
+    decltype(rnic_t::mrs) mrs;
+    const auto table = static_cast<uint8_t*>(backend.addr()) + superblock::reserved_size;
+    const size_t nr_slots = (backend.size() - superblock::reserved_size) / sizeof(dataslot);
+    /* chunks break at slot boundaries, no slot spans two MRs */
+    const auto [chunk_slots, nr_chunks] = split_table(nr_slots, std::clamp<size_t>(
+        config.get<size_t>("server.mr_chunks", session::conn_reply::max_regions),
+        1, session::conn_reply::max_regions));
+    BOOST_LOG_TRIVIAL(info) << "Registering storage " << backend.describe()
+        << " to RNIC " << pd->context->device->name << " in " << nr_chunks
+        << " chunk(s) ...";
+
+    const auto start = chrono::steady_clock::now();
+    mrs.resize(nr_chunks);
+    vector<int> errs(nr_chunks, 0);
     {
-        if (errno = ibv_dealloc_pd(pd); errno)
-            boost_log_errno_throw(ibv_dealloc_pd);
+        vector<std::jthread> workers;
+        for (size_t c = 0; c < nr_chunks; c++)
+            workers.emplace_back([&, c] {
+                const size_t begin = c * chunk_slots;
+                const size_t end = std::min(nr_slots, begin + chunk_slots);
+                mrs[c].reset(ibv_reg_mr(pd,
+                    table + begin * sizeof(dataslot), (end - begin) * sizeof(dataslot),
+                    IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                    IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC));
+                if (!mrs[c])
+                    [[unlikely]] errs[c] = errno;
+            });
     }
-};
+    for (const auto &e : errs)
+        if (e) [[unlikely]] {
+            errno = e;
+            boost_log_errno_throw(ibv_reg_mr);
+        }
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    BOOST_LOG_TRIVIAL(info) << "Successfully registered memory regions in "
+        << elapsed.count() << " s!";
+    return mrs;
 }
 
 unique_ptr<Server> Server::create(
     const filesystem::path &config_path,
-    unsigned id, const string &addr,
-    const filesystem::path &dax_path)
+    unsigned id, const string &addr, const vector<string> &rdma_addrs,
+    const vector<string> &bucket_names,
+    const StorageBackend::spec &storage_spec)
 {
+    const auto endpoints = rdma_addrs.empty() ? vector<string>{addr} : rdma_addrs;
     boost::property_tree::ptree config;
     {
         ifstream f(config_path);
         boost::property_tree::read_ini(f, config);
     }
 
-    /* add self to cluster map, retrieve server ID */
+    /* map storage */
+    auto backend = StorageBackend::create(storage_spec);
+
+    /* split the table among buckets served */
+    vector<bucket::extent> extents;
+    {
+        const auto declared = bucket::parse(config);
+        vector<bucket::spec> served;
+        if (bucket_names.empty())
+            served = declared;
+        else
+            for (const auto &name : bucket_names)
+                served.push_back(bucket::find(declared, name));
+        extents = bucket::partition(served,
+            (backend->size() - superblock::reserved_size) / sizeof(dataslot));
+        for (const auto &e : extents)
+            BOOST_LOG_TRIVIAL(info) << "Serving bucket " << e.name << " on slots ["
+                << e.offset << ", " << e.offset + e.length << ")";
+    }
+
+    /* add self to cluster map, retrieve server ID, advertising capacity for
+        clients to weigh placement before connecting */
     {
         using namespace grpc;
         using namespace gestalt::rpc;
@@ -70,6 +147,15 @@ unique_ptr<Server> Server::create(
         ServerProp in, out;
         in.set_id(id);
         in.set_addr(addr);
+        for (const auto &a : endpoints)
+            in.add_rdma_addrs(a);
+        for (const auto &e : extents) {
+            auto &b = *in.add_buckets();
+            b.set_name(e.name);
+            b.set_offset(e.offset * sizeof(dataslot));
+            b.set_length(e.length * sizeof(dataslot));
+        }
+        in.set_capacity(backend->size() - superblock::reserved_size);
         if (auto r = mon_stub->AddServer(&ctx, in, &out); !r.ok()) {
             ostringstream what;
             what << "Failed to add self to cluster map, monitor complained: "
@@ -82,153 +168,288 @@ unique_ptr<Server> Server::create(
     }
     BOOST_LOG_TRIVIAL(info) << "Successfully joined cluster map, with ID " << id;
 
-    /* get mapped DAX */
-    void *pmem_space;
-    size_t pmem_size;
+    /* one bit per slot, for clients to claim slots with RDMA atomics,
+        followed by the key filter, for them to skip Reading absent keys */
+    decltype(Server::index) index;
     {
-        if (!filesystem::is_character_file(dax_path)) {
-            ostringstream what;
-            what << "Cannot map DEVDAX at " << dax_path;
-            BOOST_LOG_TRIVIAL(fatal) << what.str();
-            throw std::runtime_error(what.str());
-        }
-        pmem_space = pmem_map_file(
-            dax_path.c_str(), /*length=entire file*/0, /*flag*/0, /*mode*/0,
-            &pmem_size, NULL);
-        if (!pmem_space) {
-            ostringstream what;
-            what << "Failed to map DEVDAX at " << dax_path << ": " << std::strerror(errno);
-            BOOST_LOG_TRIVIAL(fatal) << what.str();
-            throw std::runtime_error(what.str());
-        }
+        const size_t nr_slots = (backend->size() - superblock::reserved_size) / sizeof(dataslot);
+        const size_t counters = config.get<size_t>("server.key_filter_counters", 8);
+        const size_t filter_blocks = (nr_slots * counters
+            + key_filter::counters_per_block - 1) / key_filter::counters_per_block;
+        index.resize(key_filter::offset(nr_slots) / sizeof(key_filter::block)
+            + filter_blocks);
+        BOOST_LOG_TRIVIAL(info) << "Index takes " << index.size() * sizeof(key_filter::block)
+            << " B, with a key filter of " << filter_blocks << " block(s)";
     }
-    managed_pmem_t managed_pmem(pmem_space, pmem_size);
 
-    /* get RNIC */
-    /* TODO: don't know how to get RNIC name from IP address directly, for now
-        we just use whatever we got */
-    ibv_context **raw_devices, *rnic_chosen;
-    {
-        raw_devices = rdma_get_devices(NULL);
-        if (!raw_devices) {
-            BOOST_LOG_TRIVIAL(fatal) << "No RNIC found!";
-            throw std::runtime_error("no RNIC");
-        }
-        rnic_chosen = gestalt::misc::numa::choose_rnic_on_same_numa(
-            dax_path.filename().c_str(), raw_devices);
-        if (!rnic_chosen) {
-            BOOST_LOG_TRIVIAL(warning) << "Cannot find a matching RNIC on the "
-                << "same NUMA as the DEVDAX, using the first RNIC listed "
-                << "instead!";
-            rnic_chosen = raw_devices[0];
-        }
+    /* listen on every RDMA endpoint, each bound to the RNIC (port) owning
+        its address, storage is registered once per RNIC */
+    managed_ibvctx_t ibvctx(rdma_get_devices(NULL));
+    if (!ibvctx.devices) {
+        BOOST_LOG_TRIVIAL(fatal) << "No RNIC found!";
+        throw std::runtime_error("no RNIC");
     }
-    managed_ibvctx_t ibvctx(raw_devices);
-    ibvctx.chosen = rnic_chosen;
-
-    /* register memory region */
-    BOOST_LOG_TRIVIAL(info) << "Registering PMem " << dax_path
-        << " to RNIC " << ibvctx.chosen->device->name
-        << ", this may take a while ...";
-    unique_ptr<ibv_pd, __IbvPdDeleter> pd(ibv_alloc_pd(ibvctx.chosen));
-    if (!pd)
-        boost_log_errno_throw(ibv_alloc_pd);
-    decltype(Server::ibvmr) ibvmr(ibv_reg_mr(
-        pd.get(),
-        managed_pmem.buffer, managed_pmem.size,
-        IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
-        IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC
-    ));
-    if (!ibvmr)
-        boost_log_errno_throw(ibv_reg_mr);
-    BOOST_LOG_TRIVIAL(info) << "Successfully registered memory region!";
-
-    /* start RDMA CM */
-    rdma_cm_id *raw_listen_id;
-    {
-        unsigned port = config.get_child("server.rdma_port").get_value<unsigned>();
-        rdma_addrinfo
-            hint{.ai_flags = RAI_PASSIVE, .ai_port_space = RDMA_PS_TCP},
-            *info;
-        if (rdma_getaddrinfo(
-                addr.c_str(), std::to_string(port).c_str(),
-                &hint, &info)) {
-            ostringstream what;
-            what << "Failed to resolve " << addr << ":" << port
-                << ": " << std::strerror(errno);
-            BOOST_LOG_TRIVIAL(fatal) << what.str();
-            throw std::runtime_error(what.str());
+    const unsigned port = config.get_child("server.rdma_port").get_value<unsigned>();
+    decltype(Server::rnics) rnics;
+    rnics.reserve(endpoints.size());
+    decltype(Server::listen_ids) listen_ids;
+    for (const auto &a : endpoints) {
+        rdma_cm_id *raw_listen_id;
+        {
+            rdma_addrinfo
+                hint{.ai_flags = RAI_PASSIVE, .ai_port_space = RDMA_PS_TCP},
+                *info;
+            if (rdma_getaddrinfo(
+                    a.c_str(), std::to_string(port).c_str(),
+                    &hint, &info)) {
+                ostringstream what;
+                what << "Failed to resolve " << a << ":" << port
+                    << ": " << std::strerror(errno);
+                BOOST_LOG_TRIVIAL(fatal) << what.str();
+                throw std::runtime_error(what.str());
+            }
+            defer([&] { rdma_freeaddrinfo(info); });
+            if (rdma_create_ep(&raw_listen_id, info, NULL, NULL)) {
+                ostringstream what;
+                what << "rdma_create_ep() on " << a << ":" << port << " failed: "
+                    << std::strerror(errno);
+                BOOST_LOG_TRIVIAL(fatal) << what.str();
+                throw std::runtime_error(what.str());
+            }
         }
-        defer([&] { rdma_freeaddrinfo(info); });
-        ibv_qp_init_attr init_attr{
-            .cap = { .max_send_wr = 1024, .max_recv_wr = 1024,
-                        .max_send_sge = 16, .max_recv_sge = 16,
-                        .max_inline_data = 512 },
-            .qp_type = IBV_QPT_RC,
-            .sq_sig_all = 0
-        };
-        if (rdma_create_ep(&raw_listen_id, info, pd.get(), &init_attr)) {
+        auto &listen_id = listen_ids.emplace_back(raw_listen_id);
+        /* a wildcard address is bound to no RNIC, QPs of its connections
+            could end up on any of them */
+        if (!listen_id->verbs) {
             ostringstream what;
-            what << "rdma_create_ep() on " << addr << ":" << port << " failed: "
-                << std::strerror(errno);
+            what << "RDMA address " << a << " is not owned by any RNIC";
             BOOST_LOG_TRIVIAL(fatal) << what.str();
             throw std::runtime_error(what.str());
         }
+
+        if (const auto it = std::find_if(rnics.begin(), rnics.end(),
+                [&] (const auto &r) { return r.verbs == listen_id->verbs; });
+                it != rnics.end()) {
+            BOOST_LOG_TRIVIAL(info) << "Listening on " << a << ":" << port
+                << ", RNIC " << it->verbs->device->name << " (shared)";
+            continue;
+        }
+        auto &rnic = rnics.emplace_back();
+        rnic.verbs = listen_id->verbs;
+        rnic.pd.reset(ibv_alloc_pd(rnic.verbs));
+        if (!rnic.pd)
+            boost_log_errno_throw(ibv_alloc_pd);
+        rnic.mrs = register_storage(config, *backend, rnic.pd.get());
+        rnic.index_mr.reset(ibv_reg_mr(rnic.pd.get(),
+            index.data(), index.size() * sizeof(key_filter::block),
+            IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+            IBV_ACCESS_REMOTE_ATOMIC));
+        if (!rnic.index_mr)
+            boost_log_errno_throw(ibv_reg_mr);
+        BOOST_LOG_TRIVIAL(info) << "Listening on " << a << ":" << port
+            << ", RNIC " << rnic.verbs->device->name;
+    }
+
+    /* only PMem devices have a NUMA node of their own, passes over the
+        table are run local to it, as well as to the RNIC */
+    ibvctx.chosen = rnics.front().verbs;
+    if (const auto dev = backend->pmem_device(); !dev.empty()) {
+        const auto local = gestalt::misc::numa::choose_rnic_on_same_numa(
+            dev.c_str(), ibvctx.devices);
+        if (std::any_of(rnics.begin(), rnics.end(),
+                [local] (const auto &r) { return r.verbs == local; }))
+            ibvctx.chosen = local;
+        else
+            BOOST_LOG_TRIVIAL(warning) << "None of the RNICs listened on is on "
+                << "the same NUMA as the DEVDAX!";
     }
-    decltype(Server::listen_id) listen_id(raw_listen_id);
-    pd.release();
 
     return make_unique<Server>(
         id, config,
-        std::move(managed_pmem),
+        std::move(backend), extents, std::move(index),
         boost::asio::ip::make_address(addr),
-        std::move(ibvctx), std::move(ibvmr),
-        std::move(listen_id)
+        std::move(ibvctx), std::move(rnics),
+        std::move(listen_ids)
     );
 }
 
 Server::Server(
     unsigned _id,
     const boost::property_tree::ptree &_cfg,
-    managed_pmem_t &&_pmem,
+    unique_ptr<StorageBackend> &&_backend,
+    const vector<bucket::extent> &_buckets,
+    decltype(index) &&_index,
     const boost::asio::ip::address &_addr,
-    decltype(ibvctx) &&_ibvctx, decltype(ibvmr) &&_ibvmr,
-    decltype(listen_id) &&_listen_id
+    decltype(ibvctx) &&_ibvctx, decltype(rnics) &&_rnics,
+    decltype(listen_ids) &&_listen_ids
 ) : id(_id), config(_cfg),
-    managed_pmem(std::move(_pmem)),
-    storage(static_cast<dataslot*>(managed_pmem.buffer),
-            managed_pmem.size / sizeof(dataslot)),
-    addr(_addr), ibvctx(std::move(_ibvctx)), ibvmr(std::move(_ibvmr)),
-    listen_id(std::move(_listen_id)),
-    ddio_guard(misc::ddio::scope_guard::from_rnic(ibvctx.chosen->device->name)),
+    backend(std::move(_backend)),
+    sb(static_cast<superblock*>(backend->addr())),
+    storage(reinterpret_cast<dataslot*>(
+                static_cast<uint8_t*>(backend->addr()) + superblock::reserved_size),
+            (backend->size() - superblock::reserved_size) / sizeof(dataslot)),
+    generation(0), occupied_slots(0), index(std::move(_index)),
+    filter(index.begin() + key_filter::offset(storage.capacity()) / sizeof(key_filter::block),
+        index.end()),
+    addr(_addr), ibvctx(std::move(_ibvctx)), rnics(std::move(_rnics)),
+    listen_ids(std::move(_listen_ids)),
+    max_conns_per_client(config.get<unsigned>("server.max_connections_per_client", 4)),
+    max_clients(config.get<unsigned>("server.max_clients", 0)),
     is_stopping(false)
 {
-    BOOST_LOG_TRIVIAL(info) << "cleaning storage, this may take a while ...";
+    for (const auto &e : _buckets)
+        buckets.insert({e.name, {
+            .addr = reinterpret_cast<uintptr_t>(storage.data() + e.offset),
+            .length = e.length * sizeof(dataslot),
+        }});
+    ddio_guards.reserve(rnics.size());
+    for (const auto &r : rnics)
+        ddio_guards.push_back(misc::ddio::scope_guard::from_rnic(r.verbs->device->name));
     BOOST_LOG_TRIVIAL(debug) << "storage.capacity() = " << storage.capacity();
-    storage.clear();
-    pmem_msync(managed_pmem.buffer, managed_pmem.size);
+    format_storage();
     BOOST_LOG_TRIVIAL(info) << "Server successfully initialized!";
 }
 
+void Server::format_storage()
+{
+    const auto mode = config.get<string>("server.format", "instant");
+    if (mode != "instant" && mode != "full" && mode != "warm")
+        throw std::invalid_argument("server.format");
+    const bool sb_valid = sb->is_valid(storage.capacity());
+    /*
+     * table passes flush caches line by line unless the page cache of a file
+     * has to be synced, DRAM takes flushes it does not need, not msync()
+     */
+    const bool flush_only = !backend->needs_msync();
+    const auto persist_sb = [this] {
+        if (errno = -backend->persist(sb, sizeof(*sb)); errno)
+            [[unlikely]] boost_log_errno_throw(msync);
+    };
+
+    /* passes over the whole table go with threads local to the device, the
+        RNIC is chosen on its NUMA */
+    table_format_options opt;
+    opt.cpus = misc::numa::get_cpus(misc::numa::get_numa_node(ibvctx.chosen->device));
+    opt.nr_threads = config.get<unsigned>("server.format_threads", 0);
+    auto start = chrono::steady_clock::now();
+    const auto pass = [&] (const char *what) {
+        start = chrono::steady_clock::now();
+        opt.progress = [&start, what] (size_t done, size_t total) {
+            const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            BOOST_LOG_TRIVIAL(info) << what << " storage, " << done * 100 / total
+                << "% done, " << done * sizeof(dataslot) / elapsed.count() / (1 << 20)
+                << " MiB/s";
+        };
+        BOOST_LOG_TRIVIAL(info) << what << " storage with "
+            << (opt.nr_threads ? opt.nr_threads
+                : opt.cpus.empty() ? std::thread::hardware_concurrency() : opt.cpus.size())
+            << " thread(s) on "
+            << (opt.cpus.empty() ? "any CPU" : "NUMA-local CPUs") << " ...";
+    };
+    const auto elapsed = [&start] {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    /* [warm] keep data of the former run, in the same generation */
+    if (mode == "warm" && sb_valid) {
+        generation = sb->generation;
+        table_recovery_stats stats;
+        pass("recovering");
+        if (int r = recover_table(storage.data(), storage.capacity(), generation,
+                flush_only, opt, stats, reinterpret_cast<uint64_t*>(index.data()),
+                filter); r) {
+            errno = -r;
+            boost_log_errno_throw(pmem_msync);
+        }
+        occupied_slots = stats.occupied;
+        BOOST_LOG_TRIVIAL(info) << "storage recovered in " << elapsed() << " s, "
+            << "generation " << unsigned(generation) << ", " << occupied_slots
+            << " of " << storage.capacity() << " slots occupied, "
+            << stats.unlocked << " stale lock(s) released, "
+            << stats.discarded << " torn write(s) discarded";
+        return;
+    }
+    if (mode == "warm")
+        BOOST_LOG_TRIVIAL(warning) << "no valid superblock, or it describes "
+            << "another table layout, cannot keep data";
+
+    /* [instant] slots of former generations are empty */
+    if (mode != "full" && sb_valid && sb->generation < superblock::max_generation) {
+        generation = sb->generation + 1;
+        sb->reset(storage.capacity(), generation);
+        persist_sb();
+        BOOST_LOG_TRIVIAL(info) << "storage formatted instantly, generation "
+            << unsigned(generation);
+        return;
+    }
+    /* e.g. fresh DRAM, every slot is of generation 0 already */
+    if (backend->is_zeroed())
+        BOOST_LOG_TRIVIAL(info) << "storage is zero-filled, no need to format";
+    else {
+        if (mode != "full")
+            BOOST_LOG_TRIVIAL(info) << (sb_valid
+                ? "table generations exhausted" : "no valid superblock")
+                << ", formatting every slot, this may take a while ...";
+
+        pass("formatting");
+        if (int r = format_table(storage.data(), storage.capacity(), flush_only, opt); r) {
+            errno = -r;
+            boost_log_errno_throw(pmem_msync);
+        }
+        BOOST_LOG_TRIVIAL(info) << "storage formatted in " << elapsed() << " s";
+    }
+
+    /* every slot is of generation 0 now, which is never current */
+    generation = 1;
+    sb->reset(storage.capacity(), generation);
+    persist_sb();
+}
+
 Server::~Server()
 {
     stop();
-    /* CMBK: unregister from monitor, for now we don't bother  */
+
+    /* leave cluster map, so that clients watching it retire this server */
+    {
+        using namespace grpc;
+        using namespace gestalt::rpc;
+
+        auto mon_stub = ClusterMap::NewStub(CreateChannel(
+            config.get_child("global.monitor_address").get_value<string>(),
+            InsecureChannelCredentials()));
+        ClientContext ctx;
+        ServerProp in;
+        in.set_id(id);
+        google::protobuf::Empty out;
+        if (auto r = mon_stub->RemoveServer(&ctx, in, &out); !r.ok())
+            BOOST_LOG_TRIVIAL(warning) << "Failed to leave cluster map: "
+                << r.error_message();
+    }
 }
 
 
 /**
  * runs indefinitely unless stop() called
  *
- * 1. start listening for incoming connections
+ * 1. start listening for incoming connections, served by cm_event_loop()
  * 2. start and block on RPC service
  * 3. try to stop when stop() is invoked
  */
 void Server::run()
 {
-    /* start listening */
-    if (rdma_listen(listen_id.get(), 0))
-        boost_log_errno_throw(rdma_listen);
+    /* start listening, moving the listening endpoint to an event channel so
+        that connection requests are accepted as they arrive */
+    cm_channel.reset(rdma_create_event_channel());
+    if (!cm_channel)
+        boost_log_errno_throw(rdma_create_event_channel);
+    for (const auto &l : listen_ids) {
+        if (rdma_migrate_id(l.get(), cm_channel.get()))
+            boost_log_errno_throw(rdma_migrate_id);
+        /* a deep backlog absorbs reconnect storms of restarted clients */
+        if (rdma_listen(l.get(), config.get<int>("server.listen_backlog", 1024)))
+            boost_log_errno_throw(rdma_listen);
+    }
+    std::jthread cm_thread([this] { cm_event_loop(); });
 
     /* start RPC service */
     gestalt::rpc::SessionServicer session_svc(this);
@@ -252,6 +473,8 @@ void Server::run()
     while (is_stopping.load() == false) {
         std::this_thread::sleep_for(1s);
     }
+    /* Wait() alone only returns once someone shut the RPC server down */
+    session_grpc_server->Shutdown();
     session_grpc_server->Wait();
 
     BOOST_LOG_TRIVIAL(info) << "Server stopped!";
@@ -262,4 +485,238 @@ void Server::stop()
     is_stopping.store(true);
 }
 
+
+void Server::cm_event_loop()
+{
+    pollfd pfd{ .fd = cm_channel->fd, .events = POLLIN };
+    while (is_stopping.load() == false) {
+        /* errors here are no reason to take the server down, the data path
+            does not need this thread, retry instead */
+        if (int r = poll(&pfd, 1, /*ms*/1000); r <= 0) {
+            if (r < 0 && errno != EINTR) [[unlikely]] {
+                BOOST_LOG_TRIVIAL(error) << "poll() on RDMA CM channel failed: "
+                    << std::strerror(errno);
+                std::this_thread::sleep_for(100ms);
+            }
+            continue;
+        }
+
+        rdma_cm_event *ev;
+        if (rdma_get_cm_event(cm_channel.get(), &ev)) [[unlikely]] {
+            /* EAGAIN if someone else took it */
+            if (errno != EAGAIN)
+                BOOST_LOG_TRIVIAL(error) << "rdma_get_cm_event() failed: "
+                    << std::strerror(errno);
+            continue;
+        }
+        const auto type = ev->event;
+        const auto id = ev->id;
+        switch (type) {
+        case RDMA_CM_EVENT_CONNECT_REQUEST: {
+            /* private data is owned by the event, only valid until acked */
+            const auto param = ev->param.conn;
+            session::conn_request req{};
+            if (param.private_data)
+                memcpy(&req, param.private_data,
+                    std::min<size_t>(sizeof(req), param.private_data_len));
+            auto p = param;
+            p.private_data = &req;
+            p.private_data_len = param.private_data_len < sizeof(req) ? 0 : sizeof(req);
+            rdma_ack_cm_event(ev);
+            on_connect_request(id, p);
+            break;
+        }
+        case RDMA_CM_EVENT_ESTABLISHED:
+            BOOST_LOG_TRIVIAL(trace) << "connection of client "
+                << reinterpret_cast<uintptr_t>(id->context) << " established";
+            rdma_ack_cm_event(ev);
+            break;
+        case RDMA_CM_EVENT_DISCONNECTED:
+        /* client gave up or died before the connection was established */
+        case RDMA_CM_EVENT_CONNECT_ERROR:
+        case RDMA_CM_EVENT_UNREACHABLE: {
+            /* #id stays alive until acked, and must be acked before destroyed
+                or rdma_destroy_id() blocks forever */
+            const unsigned client_id = reinterpret_cast<uintptr_t>(id->context);
+            const int status = ev->status;
+            rdma_ack_cm_event(ev);
+            if (type != RDMA_CM_EVENT_DISCONNECTED)
+                [[unlikely]] BOOST_LOG_TRIVIAL(warning) << "connection of client "
+                    << client_id << " failed: " << rdma_event_str(type)
+                    << " (status " << status << ")";
+            on_disconnected(client_id, id);
+            break;
+        }
+        case RDMA_CM_EVENT_DEVICE_REMOVAL:
+            rdma_ack_cm_event(ev);
+            BOOST_LOG_TRIVIAL(fatal) << "RNIC removed, stopping server";
+            stop();
+            break;
+        case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+            rdma_ack_cm_event(ev);
+            break;
+        default:
+            BOOST_LOG_TRIVIAL(debug) << "ignoring RDMA CM event " << rdma_event_str(type);
+            rdma_ack_cm_event(ev);
+            break;
+        }
+    }
+}
+
+int Server::on_connect_request(rdma_cm_id *id, const rdma_conn_param &param)
+{
+    /* rejected requests are never seen by anyone else, dispose of them here */
+    const auto reject = [id] (int err) {
+        rdma_reject(id, NULL, 0);
+        rdma_destroy_id(id);
+        return err;
+    };
+
+    const auto &req = *static_cast<const session::conn_request*>(param.private_data);
+    if (!param.private_data_len || req.magic != session::magic
+        || req.version != session::version) [[unlikely]] {
+        BOOST_LOG_TRIVIAL(warning) << "rejecting connection from "
+            << inet_ntoa(id->route.addr.dst_sin.sin_addr)
+            << " with malformed session request";
+        return reject(-EPROTO);
+    }
+
+    if (req.lane >= max_conns_per_client) [[unlikely]] {
+        BOOST_LOG_TRIVIAL(warning) << "client " << req.client_id << " asks for "
+            << req.lane + 1 << " connections, exceeding limit of "
+            << max_conns_per_client << ", rejecting";
+        return reject(-EDQUOT);
+    }
+
+    /* admission, reclaiming stale connections: client IDs are unique among
+        live clients, so a client connecting a lane it already holds has
+        restarted without its previous process saying goodbye */
+    vector<client_conn_t> reclaimed;
+    {
+        std::scoped_lock l(_mutex);
+        const auto it = connected_client_id.find(req.client_id);
+        if (it == connected_client_id.end()) {
+            if (max_clients && connected_client_id.size() >= max_clients) [[unlikely]] {
+                BOOST_LOG_TRIVIAL(warning) << "too many clients, rejecting client "
+                    << req.client_id;
+                return reject(-EUSERS);
+            }
+        }
+        else if (auto &eps = it->second.eps; std::any_of(eps.begin(), eps.end(),
+                [&req] (const auto &c) { return c.lane == req.lane; })) {
+            BOOST_LOG_TRIVIAL(warning) << "client " << req.client_id
+                << " reconnected, reclaiming its " << eps.size()
+                << " stale connection(s)";
+            reclaimed = std::move(eps);
+            eps.clear();
+        }
+    }
+    /* QPs destroyed out of lock, this may wait for the client's hang-up */
+    reclaimed.clear();
+
+    /* connections come in on the RNIC of the endpoint they were sent to */
+    const auto rnic = std::find_if(rnics.begin(), rnics.end(),
+        [id] (const auto &r) { return r.verbs == id->verbs; });
+    if (rnic == rnics.end()) [[unlikely]] {
+        BOOST_LOG_TRIVIAL(error) << "connection of client " << req.client_id
+            << " came in on an unknown RNIC, rejecting";
+        return reject(-ENODEV);
+    }
+    ibv_device_attr dev_attr;
+    if (errno = ibv_query_device(id->verbs, &dev_attr); errno) [[unlikely]] {
+        const int err = errno;
+        BOOST_LOG_TRIVIAL(error) << "ibv_query_device() for client "
+            << req.client_id << " failed: " << std::strerror(err);
+        return reject(-err);
+    }
+    ibv_qp_init_attr init_attr = qp_init_attr();
+    if (rdma_create_qp(id, rnic->pd.get(), &init_attr)) [[unlikely]] {
+        const int err = errno;
+        BOOST_LOG_TRIVIAL(error) << "rdma_create_qp() for client "
+            << req.client_id << " failed: " << std::strerror(err);
+        return reject(-err);
+    }
+    id->context = reinterpret_cast<void*>(uintptr_t(req.client_id));
+    conn_ptr connected_id(id);
+
+    /* the only round trip of session setup, describe what the client may
+        access right away */
+    session::conn_reply rep{
+        .magic = session::magic,
+        .version = session::version,
+        .nr_regions = static_cast<uint8_t>(rnic->mrs.size()),
+    };
+    rep.generation = generation;
+    rep.durability = backend->durability();
+    rep.index = {
+        .addr = reinterpret_cast<uintptr_t>(rnic->index_mr->addr),
+        .length = rnic->index_mr->length,
+        .rkey = rnic->index_mr->rkey,
+    };
+    for (size_t i = 0; i < rnic->mrs.size(); i++)
+        rep.regions[i] = {
+            .addr = reinterpret_cast<uintptr_t>(rnic->mrs[i]->addr),
+            .length = rnic->mrs[i]->length,
+            .rkey = rnic->mrs[i]->rkey,
+        };
+    rdma_conn_param accept_param{
+        .private_data = &rep,
+        .private_data_len = static_cast<uint8_t>(
+            offsetof(session::conn_reply, regions)
+            + rep.nr_regions * sizeof(session::region_descriptor)),
+        .responder_resources = static_cast<uint8_t>(std::min<int>(
+            param.responder_resources, dev_attr.max_qp_rd_atom)),
+        .initiator_depth = static_cast<uint8_t>(std::min<int>(
+            param.initiator_depth, dev_attr.max_qp_init_rd_atom)),
+        .rnr_retry_count = 7,
+    };
+    if (rdma_accept(id, &accept_param)) [[unlikely]] {
+        const int err = errno;
+        BOOST_LOG_TRIVIAL(error) << "rdma_accept() for client "
+            << req.client_id << " failed: " << std::strerror(err);
+        return -err;
+    }
+    BOOST_LOG_TRIVIAL(trace) << "accepted RDMA connection from "
+        << inet_ntoa(id->route.addr.dst_sin.sin_addr)
+        << ":" << id->route.addr.dst_sin.sin_port
+        << ", with local port "
+        << inet_ntoa(id->route.addr.src_sin.sin_addr)
+        << ":" << id->route.addr.src_sin.sin_port;
+
+    /* client connection now initialized, add it to server runtime registry */
+    {
+        std::scoped_lock l(_mutex);
+        connected_client_id[req.client_id].eps.push_back(
+            {req.lane, std::move(connected_id)});
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "client " << req.client_id << " connected, lane "
+        << req.lane;
+    return 0;
+}
+
+void Server::on_disconnected(unsigned client_id, const rdma_cm_id *id)
+{
+    conn_ptr reclaimed;
+    {
+        std::scoped_lock l(_mutex);
+
+        /* may have been released by Session::Disconnect, or reclaimed already */
+        const auto it = connected_client_id.find(client_id);
+        if (it == connected_client_id.end())
+            return;
+        auto &eps = it->second.eps;
+        const auto ep = std::find_if(eps.begin(), eps.end(),
+            [id] (const auto &c) { return c.ep.get() == id; });
+        if (ep == eps.end())
+            return;
+        reclaimed = std::move(ep->ep);
+        eps.erase(ep);
+        if (eps.empty())
+            connected_client_id.erase(it);
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "client " << client_id << " disconnected";
+}
+
 }   /* namespace gestalt */
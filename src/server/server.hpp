@@ -2,8 +2,8 @@
  * @file server.hpp
  *
  * @note This build is only meant for performance benchmarking, all HA features
- * are not implemented, and there is only one bucket (key space) that maps to the
- * entire mapped PMem.
+ * are not implemented. Buckets (key spaces) split the mapped storage of a
+ * server, see spec/bucket.hpp .
  */
 
 #pragma once
@@ -14,6 +14,8 @@
 #include <unordered_map>
 #include <atomic>
 #include <mutex>
+#include <vector>
+#include <span>
 
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/core/noncopyable.hpp>
@@ -23,8 +25,12 @@
 #include <rdma/rdma_cma.h>
 
 #include "headless_hashtable.hpp"
+#include "superblock.hpp"
+#include "storage_backend.hpp"
 #include "misc/ddio.hpp"
 #include "spec/dataslot.hpp"
+#include "spec/bucket.hpp"
+#include "spec/key_filter.hpp"
 
 
 namespace gestalt {
@@ -50,26 +56,29 @@ class Server final : private boost::noncopyable {
 
     /* storage management */
 
-    /** managed PMem space, supplied to storage */
-    struct managed_pmem_t : private boost::noncopyable {
-        void* buffer;
-        size_t size;
-    public:
-        managed_pmem_t(void *_b, size_t _s) noexcept : buffer(_b), size(_s)
-        { }
-        managed_pmem_t(managed_pmem_t &&o) noexcept : buffer(o.buffer), size(o.size)
-        {
-            o.buffer = nullptr;
-        }
-        ~managed_pmem_t()
-        {
-            if (!buffer)
-                return;
-            pmem_unmap(buffer, size);
-        }
-    } managed_pmem;
-    /** storage container */
+    /** memory space, supplied to storage */
+    unique_ptr<StorageBackend> backend;
+    /** header of #storage, at the start of #backend */
+    superblock *const sb;
+    /** storage container, the slot table following #sb */
     HeadlessHashTable<dataslot> storage;
+    /** current generation of #storage, see gestalt::superblock */
+    uint8_t generation;
+    /** slots holding data when #storage was taken over, 0 if formatted */
+    size_t occupied_slots;
+    /**
+     * index of #storage, updated by inserting clients with RDMA atomics,
+     * rebuilt when data is kept across runs, the occupancy bitmap, one bit per
+     * slot, followed by #filter
+     * @sa session::conn_reply::index
+     */
+    vector<key_filter::block> index;
+    /**
+     * counting Bloom filter of keys resident in #storage, within #index, empty
+     * if disabled
+     * @note config `server.key_filter_counters`
+     */
+    span<key_filter::block> filter;
 
     /* network management */
 
@@ -79,6 +88,7 @@ class Server final : private boost::noncopyable {
     struct managed_ibvctx_t : private boost::noncopyable {
         /** null-terminated array */
         ibv_context **devices;
+        /** RNIC local to #storage, the first one listened on if unknown */
         ibv_context *chosen;
     public:
         managed_ibvctx_t(ibv_context **_devs) noexcept :
@@ -96,6 +106,13 @@ class Server final : private boost::noncopyable {
             rdma_free_devices(devices);
         }
     } ibvctx;
+    struct __IbvPdDeleter {
+        inline void operator()(ibv_pd *pd)
+        {
+            if (errno = ibv_dealloc_pd(pd); errno)
+                boost_log_errno_throw(ibv_dealloc_pd);
+        }
+    };
     struct __IbvMrDeleter {
         inline void operator()(ibv_mr *mr)
         {
@@ -103,46 +120,80 @@ class Server final : private boost::noncopyable {
                 boost_log_errno_throw(ibv_dereg_mr);
         }
     };
-    /** memory region registered to #ibvctx */
-    unique_ptr<ibv_mr, __IbvMrDeleter> ibvmr;
+    /** an RNIC serving #storage, to endpoints of #listen_ids bound to it */
+    struct rnic_t {
+        ibv_context *verbs;
+        /** @note declared before #mrs, MRs go before their PD */
+        unique_ptr<ibv_pd, __IbvPdDeleter> pd;
+        /**
+         * memory regions, chunks of #storage in ascending order of address
+         * @note config `server.mr_chunks`
+         */
+        vector<unique_ptr<ibv_mr, __IbvMrDeleter>> mrs;
+        /** memory region of #index */
+        unique_ptr<ibv_mr, __IbvMrDeleter> index_mr;
+    };
+    /** RNICs listened on, #storage is registered to each */
+    vector<rnic_t> rnics;
+    struct __RdmaEventChannelDeleter {
+        inline void operator()(rdma_event_channel *ch)
+        {
+            rdma_destroy_event_channel(ch);
+        }
+    };
+    /**
+     * RDMA CM event channel of #listen_ids, connection requests and
+     * disconnects are served from here
+     * @sa cm_event_loop()
+     */
+    unique_ptr<rdma_event_channel, __RdmaEventChannelDeleter> cm_channel;
     struct __RdmaListenEpDeleter {
         inline void operator()(rdma_cm_id *ep)
         {
-            if (errno = ibv_dealloc_pd(ep->pd); errno)
-                boost_log_errno_throw(ibv_dealloc_pd);
             rdma_destroy_ep(ep);
         }
     };
     /**
-     * the RDMA endpoint listening for incoming RDMA connections, should have
-     * an associated PD.
+     * RDMA endpoints listening for incoming RDMA connections, one per
+     * address advertised, bound to the RNIC (port) owning it
      */
-    unique_ptr<rdma_cm_id, __RdmaListenEpDeleter> listen_id;
+    vector<unique_ptr<rdma_cm_id, __RdmaListenEpDeleter>> listen_ids;
 
     struct __RdmaConnDeleter {
         inline void operator()(rdma_cm_id *ep)
         {
-            if (int r = rdma_disconnect(ep); r)
-                boost_log_errno_throw(rdma_disconnect);
+            /* fails if client disconnected first, nothing to worry about */
+            rdma_disconnect(ep);
             rdma_destroy_ep(ep);
         }
     };
+    using conn_ptr = unique_ptr<rdma_cm_id, __RdmaConnDeleter>;
+    struct client_conn_t {
+        /** see session::conn_request::lane */
+        uint16_t lane;
+        conn_ptr ep;
+    };
     struct client_prop_t : private boost::noncopyable {
-        unique_ptr<rdma_cm_id, __RdmaConnDeleter> ep;
+        /** accepted connection endpoints, oldest first */
+        vector<client_conn_t> eps;
     public:
-        client_prop_t(decltype(ep) &&_ep) noexcept :
-            ep(std::move(_ep))
+        client_prop_t() noexcept
         { }
         client_prop_t(client_prop_t &&o) noexcept :
-            ep(std::move(o.ep))
+            eps(std::move(o.eps))
         { }
     };
-    /** client ID -> accepted connection endpoint */
+    /** client ID -> accepted connection endpoints */
     unordered_map<unsigned, client_prop_t> connected_client_id;
+    /** connections (QPs) a client may hold, i.e. bound of its lanes */
+    const unsigned max_conns_per_client;
+    /** clients that may be connected at the same time, 0 for unlimited */
+    const unsigned max_clients;
 
     /* runtime */
 
-    misc::ddio::scope_guard ddio_guard;
+    /** one per RNIC of #rnics */
+    vector<misc::ddio::scope_guard> ddio_guards;
     atomic<bool> is_stopping;
     mutex _mutex;
 
@@ -151,8 +202,8 @@ class Server final : private boost::noncopyable {
         size_t length;
     };
     /**
-     * buckets that this server is responsible for
-     * @todo currently we only have one big bucket, so this is not used.
+     * buckets that this server is responsible for, name -> part of #storage,
+     * as advertised to monitor
      */
     unordered_map<string, bucket_descriptor> buckets;
 
@@ -163,13 +214,18 @@ public:
      * @param config_path path to gestalt.conf
      * @param id server ID, if 0 let monitor generate new one
      * @param addr server address
+     * @param rdma_addrs addresses to serve RDMA on, one per RNIC or port,
+     *      #addr alone if empty
+     * @param bucket_names buckets to serve, all declared in config if empty
+     * @param storage_spec storage to map
      * @return Server instance
      * @throw std::runtime_error
      */
     static unique_ptr<Server> create(
         const filesystem::path &config_path,
-        unsigned id, const string &addr,
-        const filesystem::path &dax_path);
+        unsigned id, const string &addr, const vector<string> &rdma_addrs,
+        const vector<string> &bucket_names,
+        const StorageBackend::spec &storage_spec);
     /**
      * Don't use this directly, use create() instead
      * @private
@@ -177,10 +233,12 @@ public:
     Server(
         unsigned _id,
         const boost::property_tree::ptree &_cfg,
-        managed_pmem_t &&_pmem,
+        unique_ptr<StorageBackend> &&_backend,
+        const vector<bucket::extent> &_buckets,
+        decltype(index) &&_index,
         const boost::asio::ip::address &_addr,
-        decltype(ibvctx) &&_ibvctx, decltype(ibvmr) &&_ibvmr,
-        decltype(listen_id) &&_listen_id);
+        decltype(ibvctx) &&_ibvctx, decltype(rnics) &&_rnics,
+        decltype(listen_ids) &&_listen_ids);
     ~Server();
 
     /* interface */
@@ -190,6 +248,47 @@ public:
      * @note call this only once, and call this before stop()
      */
     void run();
+private:
+    /**
+     * register the slot table of #backend to the RNIC of #pd
+     * @note config `server.mr_chunks`
+     * @throw std::runtime_error
+     */
+    static decltype(rnic_t::mrs) register_storage(
+        const boost::property_tree::ptree &config,
+        const StorageBackend &backend, ibv_pd *pd);
+    /**
+     * connection manager, serves RDMA CM events on #cm_channel until stop()
+     * called
+     *
+     * Connection requests are accepted as they arrive, and connections of
+     * clients that hung up, died or never finished connecting are reclaimed
+     * here, all without data path involvement.
+     */
+    void cm_event_loop();
+    /**
+     * accept a connection, replying descriptors of served memory regions
+     * @param id new connection, owned by this call
+     * @param param connection parameters of the request, with private data
+     *      copied out of the event
+     * @return 0 accepted, negative errno if rejected
+     */
+    int on_connect_request(rdma_cm_id *id, const rdma_conn_param &param);
+    /**
+     * release connection of a client that hung up or failed connecting
+     * @param client_id client of #id
+     * @param id connection, compared against the registry only, for it may
+     *      have been reclaimed already
+     */
+    void on_disconnected(unsigned client_id, const rdma_cm_id *id);
+    /**
+     * format #storage, instantly by bumping its generation if the superblock
+     * is intact, otherwise by invalidating every slot, or [warm] recover it
+     * keeping data of the former run
+     * @note config `server.format`
+     */
+    void format_storage();
+public:
     friend class gestalt::rpc::SessionServicer;
     /**
      * signals run() to stop
@@ -26,7 +26,6 @@ public:
     SessionServicer(gestalt::Server *_s) noexcept : server(_s)
     { }
 
-    Status Connect(ServerContext *ctx, const ClientProp *in, ServerWriter<MemoryRegion> *out) override;
     Status Disconnect(ServerContext *ctx, const ClientProp *in, Empty *out) override;
 };  /* class SessionServicer */
 
@@ -0,0 +1,226 @@
+/**
+ * @file storage_backend.cpp
+ *
+ * Implementations of storage backends
+ */
+
+#include <sstream>
+#include <cstring>
+#include <bit>
+#include <sys/mman.h>
+#include <linux/mman.h>
+
+#include "common/boost_log_helper.hpp"
+#include <libpmem.h>
+
+#include "./storage_backend.hpp"
+
+
+namespace gestalt {
+using namespace std;
+
+namespace {
+
+[[noreturn]] void fail(const string &what)
+{
+    BOOST_LOG_TRIVIAL(fatal) << what;
+    throw std::runtime_error(what);
+}
+
+/**
+ * devdax and file, both mapped by libpmem, which maps files with `MAP_SYNC`
+ * if the filesystem supports it, telling whether CPU flushes are enough
+ */
+class PmemBackend final : public StorageBackend {
+    const Kind _kind;
+    const filesystem::path path;
+    bool _is_pmem;
+
+public:
+    PmemBackend(Kind k, const filesystem::path &p, size_t size) :
+        StorageBackend(session::durability::power_fail), _kind(k), path(p)
+    {
+        int flags = 0;
+        const size_t requested = size;
+        if (k == Kind::devdax) {
+            if (!filesystem::is_character_file(path)) {
+                ostringstream what;
+                what << "Cannot map DEVDAX at " << path;
+                fail(what.str());
+            }
+            /* entire device */
+            size = 0;
+        }
+        else if (!filesystem::exists(path)) {
+            if (!size) {
+                ostringstream what;
+                what << "Cannot create " << path << " without a size";
+                fail(what.str());
+            }
+            flags = PMEM_FILE_CREATE;
+        }
+        else {
+            /* entire file */
+            size = 0;
+        }
+
+        int is_pmem;
+        _addr = pmem_map_file(path.c_str(), size, flags, 0600, &_size, &is_pmem);
+        if (!_addr) {
+            ostringstream what;
+            what << "Failed to map " << path << ": " << std::strerror(errno);
+            fail(what.str());
+        }
+        if (requested && !(flags & PMEM_FILE_CREATE) && requested != _size)
+            BOOST_LOG_TRIVIAL(warning) << "ignoring size of " << requested
+                << " bytes, mapped all " << _size << " bytes of existing " << path;
+        _is_pmem = is_pmem || k == Kind::devdax;
+        /* page cache is written back only as the server syncs it */
+        if (!_is_pmem)
+            _durability = session::durability::process;
+        _zeroed = flags & PMEM_FILE_CREATE;
+    }
+    ~PmemBackend() override
+    {
+        pmem_unmap(_addr, _size);
+    }
+
+    Kind kind() const noexcept override
+    {
+        return _kind;
+    }
+    string describe() const override
+    {
+        return path.string();
+    }
+    string pmem_device() const override
+    {
+        return _kind == Kind::devdax ? path.filename().string() : string();
+    }
+    bool is_pmem() const noexcept override
+    {
+        return _is_pmem;
+    }
+    bool needs_msync() const noexcept override
+    {
+        return !_is_pmem;
+    }
+    int persist(const void *addr, size_t len) const noexcept override
+    {
+        if (_is_pmem) {
+            [[likely]] pmem_persist(addr, len);
+            return 0;
+        }
+        return pmem_msync(addr, len) ? -errno : 0;
+    }
+};
+
+/**
+ * anonymous DRAM on hugepages, which also spares the RNIC most of its
+ * translation cache misses
+ */
+class HugepageBackend final : public StorageBackend {
+    const size_t page_size;
+
+public:
+    HugepageBackend(size_t size, size_t _page_size) :
+        StorageBackend(session::durability::none), page_size(_page_size)
+    {
+        if (page_size != 2ul << 20 && page_size != 1ul << 30)
+            fail("hugepage size must be 2 MiB or 1 GiB");
+        if (!size)
+            fail("hugepage storage needs a size");
+        _size = (size + page_size - 1) / page_size * page_size;
+
+        const int huge = std::countr_zero(page_size) << MAP_HUGE_SHIFT;
+        _addr = mmap(NULL, _size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge, -1, 0);
+        if (_addr == MAP_FAILED) {
+            _addr = nullptr;
+            ostringstream what;
+            what << "Failed to map " << _size << " bytes of " << (page_size >> 20)
+                << " MiB hugepages: " << std::strerror(errno)
+                << ", are enough hugepages reserved?";
+            fail(what.str());
+        }
+        _zeroed = true;
+    }
+    ~HugepageBackend() override
+    {
+        munmap(_addr, _size);
+    }
+
+    Kind kind() const noexcept override
+    {
+        return Kind::hugepage;
+    }
+    string describe() const override
+    {
+        return "DRAM on " + std::to_string(page_size >> 20) + " MiB hugepages";
+    }
+    bool is_pmem() const noexcept override
+    {
+        return false;
+    }
+    bool needs_msync() const noexcept override
+    {
+        /* nothing survives the process to sync for */
+        return false;
+    }
+    int persist(const void *, size_t) const noexcept override
+    {
+        return 0;
+    }
+};
+
+}   /* anonymous namespace */
+
+
+StorageBackend::Kind StorageBackend::parse_kind(const string &name)
+{
+    if (name == "devdax")
+        return Kind::devdax;
+    if (name == "file")
+        return Kind::file;
+    if (name == "hugepage")
+        return Kind::hugepage;
+    throw std::invalid_argument("unknown storage backend " + name);
+}
+
+const char *StorageBackend::kind_name(Kind k) noexcept
+{
+    switch (k) {
+    case Kind::devdax:
+        return "devdax";
+    case Kind::file:
+        return "file";
+    case Kind::hugepage:
+        return "hugepage";
+    default:
+        return "unknown";
+    }
+}
+
+unique_ptr<StorageBackend> StorageBackend::create(const spec &s)
+{
+    unique_ptr<StorageBackend> ret;
+    switch (s.kind) {
+    case Kind::devdax:
+    case Kind::file:
+        ret.reset(new PmemBackend(s.kind, s.path, s.size));
+        break;
+    case Kind::hugepage:
+        ret.reset(new HugepageBackend(s.size, s.hugepage_size));
+        break;
+    default:
+        throw std::invalid_argument("storage backend");
+    }
+    BOOST_LOG_TRIVIAL(info) << "mapped " << ret->size() << " bytes of "
+        << kind_name(ret->kind()) << " storage, " << ret->describe()
+        << (ret->durability() == session::durability::power_fail ? ", persistent"
+            : ret->durability() == session::durability::process
+                ? ", not PMem, durable across restarts only" : ", volatile");
+    return ret;
+}
+
+}   /* namespace gestalt */
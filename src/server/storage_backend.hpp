@@ -0,0 +1,124 @@
+/**
+ * @file storage_backend.hpp
+ *
+ * Memory backing the slot table of a server
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <boost/core/noncopyable.hpp>
+
+#include "spec/session.hpp"
+
+
+namespace gestalt {
+
+using namespace std;
+
+/**
+ * StorageBackend - a mapped, RDMA-registrable memory space, and how durable
+ * data written to it is
+ *
+ * @sa create()
+ */
+class StorageBackend : private boost::noncopyable {
+public:
+    enum class Kind {
+        /** PMem DEVDAX character device, e.g. /dev/dax0.0 */
+        devdax,
+        /**
+         * regular file, e.g. on a DAX-mounted (fsdax) filesystem, mapped with
+         * `MAP_SYNC` where the filesystem supports it
+         */
+        file,
+        /** anonymous DRAM on 2 MiB or 1 GiB hugepages, a volatile cache tier */
+        hugepage,
+    };
+    struct spec {
+        Kind kind = Kind::devdax;
+        /** device or file, ignored by Kind::hugepage */
+        filesystem::path path;
+        /**
+         * bytes to map, 0 for the entire device or file, required by
+         * Kind::hugepage and for creating files
+         */
+        size_t size = 0;
+        /** [hugepage] page size, 2 MiB or 1 GiB */
+        size_t hugepage_size = 2ul << 20;
+    };
+
+    static Kind parse_kind(const string &name);
+    static const char *kind_name(Kind k) noexcept;
+
+    /**
+     * map storage
+     * @throw std::runtime_error
+     */
+    static unique_ptr<StorageBackend> create(const spec &s);
+
+protected:
+    void *_addr = nullptr;
+    size_t _size = 0;
+    session::durability _durability;
+    /** whether mapping is zero-filled as created, i.e. needs no formatting */
+    bool _zeroed = false;
+
+    StorageBackend(session::durability d) noexcept : _durability(d)
+    { }
+
+public:
+    virtual ~StorageBackend() = default;
+
+    virtual Kind kind() const noexcept = 0;
+    /** human-readable description, e.g. path */
+    virtual string describe() const = 0;
+    /**
+     * PMem device name for looking up its NUMA node, e.g. "dax0.0", empty if
+     * not backed by a PMem device
+     */
+    virtual string pmem_device() const
+    {
+        return {};
+    }
+
+    inline void *addr() const noexcept
+    {
+        return _addr;
+    }
+    inline size_t size() const noexcept
+    {
+        return _size;
+    }
+    /** what survives if the server goes away, advertised to clients */
+    inline session::durability durability() const noexcept
+    {
+        return _durability;
+    }
+    inline bool is_zeroed() const noexcept
+    {
+        return _zeroed;
+    }
+    /**
+     * whether the memory is persistent, i.e. CPU stores are durable with cache
+     * flushes alone (`pmem_persist()`)
+     */
+    virtual bool is_pmem() const noexcept = 0;
+    /**
+     * whether CPU stores have to be synced with `msync()` to be as durable as
+     * #durability() allows, i.e. the page cache of a file; neither persistent
+     * nor volatile memory does
+     */
+    virtual bool needs_msync() const noexcept = 0;
+
+    /**
+     * make CPU stores to [addr, addr + len) as durable as #durability() allows
+     * @return 0 on success, otherwise negative errno
+     */
+    virtual int persist(const void *addr, size_t len) const noexcept = 0;
+};
+
+}   /* namespace gestalt */
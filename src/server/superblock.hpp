@@ -0,0 +1,94 @@
+/**
+ * @file superblock.hpp
+ *
+ * On-device header of the slot table
+ *
+ * The superblock takes the first slot-sized block of the device, so that the
+ * slot table following it stays slot-aligned. It records the table geometry,
+ * the slot format and hash seeds deciding where keys live, and the current
+ * table generation (see gestalt::dataslot_meta), which is bumped to format the
+ * table instantly. A table is only reused if all of them match this build.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <isa-l/crc.h>
+
+#include "spec/dataslot.hpp"
+#include "spec/params.hpp"
+
+
+namespace gestalt {
+
+struct [[gnu::packed]] superblock {
+    static constexpr uint64_t magic_v = 0x31627374736567;   // "gestsb1"
+    static constexpr uint32_t version_v = 2;
+    /** device space taken by the superblock, ahead of the slot table */
+    static constexpr size_t reserved_size = sizeof(dataslot);
+    /**
+     * generations wrap to 1 after this, stale slots could match again then,
+     * a full format is due
+     */
+    static constexpr uint8_t max_generation = UINT8_MAX;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t nr_slots;
+    /* slot format, see gestalt::dataslot */
+    uint32_t data_seg_length;
+    uint32_t key_seg_reserve;
+    /* hash seeds, see gestalt::dataslot_key_digest */
+    uint64_t placement_hash_seed;
+    uint64_t slot_hash_seed;
+    /** current table generation, never 0 once formatted */
+    uint8_t generation;
+    uint8_t _reserved[7];
+    /** CRC of all fields above */
+    uint32_t crc;
+
+    inline uint32_t checksum() const noexcept
+    {
+        return crc32_iscsi((uint8_t*)this, offsetof(superblock, crc), 0x1919810);
+    }
+
+    /**
+     * @param slots number of slots of the table following this superblock
+     * @return whether this superblock is intact and describes the table
+     */
+    inline bool is_valid(uint64_t slots) const noexcept
+    {
+        return magic == magic_v && version == version_v
+            && slot_size == sizeof(dataslot) && nr_slots == slots
+            && data_seg_length == params::data_seg_length
+            && key_seg_reserve == params::key_seg_reserve
+            && placement_hash_seed == params::placement_hash_seed
+            && slot_hash_seed == params::slot_hash_seed
+            && generation && crc == checksum();
+    }
+
+    /**
+     * fill in a superblock, seal it with CRC
+     * @note persist it afterwards
+     */
+    inline void reset(uint64_t slots, uint8_t gen) noexcept
+    {
+        magic = magic_v;
+        version = version_v;
+        slot_size = sizeof(dataslot);
+        nr_slots = slots;
+        data_seg_length = params::data_seg_length;
+        key_seg_reserve = params::key_seg_reserve;
+        placement_hash_seed = params::placement_hash_seed;
+        slot_hash_seed = params::slot_hash_seed;
+        generation = gen;
+        for (auto &r : _reserved)
+            r = 0;
+        crc = checksum();
+    }
+};
+static_assert(sizeof(superblock) <= superblock::reserved_size);
+
+}   /* namespace gestalt */
@@ -0,0 +1,235 @@
+/**
+ * @file table_format.hpp
+ *
+ * Parallel passes over the slot table, formatting, i.e. invalidating every
+ * slot of a freshly mapped device, and recovering a table left by a former
+ * server run
+ */
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <span>
+#include <utility>
+#include <pthread.h>
+#include <sched.h>
+
+#include <libpmem.h>
+
+#include "spec/dataslot.hpp"
+#include "spec/key_filter.hpp"
+
+
+namespace gestalt {
+
+using namespace std;
+
+struct table_format_options {
+    /** formatting threads, 0 for one per CPU of #cpus */
+    unsigned nr_threads = 0;
+    /** CPUs to pin threads to, e.g. those local to the device, empty for any */
+    vector<unsigned> cpus;
+    /** slots claimed by a thread at a time */
+    size_t chunk_slots = 1 << 18;
+    /**
+     * progress callback `void(size_t formatted, size_t total)`, called from
+     * the calling thread every #progress_interval
+     */
+    function<void(size_t, size_t)> progress;
+    chrono::steady_clock::duration progress_interval = 1s;
+};
+
+/**
+ * Split a table into contiguous chunks of whole slots, alike in length but
+ * the last one, e.g. for registering it as several MRs
+ * @param n number of slots
+ * @param max_chunks chunks to split into at most
+ * @return slots per chunk and number of chunks, none of them empty
+ */
+inline pair<size_t, size_t> split_table(size_t n, size_t max_chunks) noexcept
+{
+    const size_t nr_chunks = std::clamp<size_t>(max_chunks, 1, std::max<size_t>(n, 1));
+    const size_t chunk_slots = (n + nr_chunks - 1) / nr_chunks;
+    /* rounding up chunks may leave trailing ones empty, e.g. 10 slots in 8 */
+    return {chunk_slots, chunk_slots ? (n + chunk_slots - 1) / chunk_slots : 1};
+}
+
+/**
+ * Run #fn over a table in parallel, threads claim disjoint chunks of it
+ * @param n number of slots
+ * @param opt options
+ * @param fn `int(size_t begin, size_t end)`, processes slots [begin, end),
+ *      returns 0 or negative errno
+ * @return 0 on success, otherwise the first error of #fn
+ */
+template <class F>
+int for_each_chunk(size_t n, const table_format_options &opt, F &&fn)
+{
+    const size_t chunk = std::max<size_t>(opt.chunk_slots, 1);
+    const size_t nr_chunks = (n + chunk - 1) / chunk;
+    unsigned nr_threads = opt.nr_threads;
+    if (!nr_threads)
+        nr_threads = opt.cpus.empty() ? std::thread::hardware_concurrency()
+            : opt.cpus.size();
+    nr_threads = std::clamp<size_t>(nr_threads, 1, std::max<size_t>(nr_chunks, 1));
+
+    atomic<size_t> next = 0, processed = 0;
+    atomic<int> ret = 0;
+    {
+        vector<std::jthread> workers;
+        workers.reserve(nr_threads);
+        for (unsigned t = 0; t < nr_threads; t++) {
+            workers.emplace_back([&] {
+                if (!opt.cpus.empty()) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    for (const auto &c : opt.cpus)
+                        CPU_SET(c, &set);
+                    /* best effort, the pass is still correct off-node */
+                    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                }
+
+                for (size_t c; (c = next.fetch_add(1, memory_order_relaxed)) < nr_chunks; ) {
+                    const size_t begin = c * chunk, end = std::min(n, begin + chunk);
+                    if (int r = fn(begin, end); r) {
+                        int expected = 0;
+                        [[unlikely]] ret.compare_exchange_strong(expected, r);
+                    }
+                    processed.fetch_add(end - begin, memory_order_relaxed);
+                }
+                /* fence this thread's non-temporal stores */
+                pmem_drain();
+            });
+        }
+
+        if (opt.progress) {
+            auto last = chrono::steady_clock::now();
+            while (processed.load(memory_order_relaxed) < n && !ret.load()) {
+                std::this_thread::sleep_for(10ms);
+                if (const auto now = chrono::steady_clock::now();
+                        now - last >= opt.progress_interval) {
+                    opt.progress(processed.load(memory_order_relaxed), n);
+                    last = now;
+                }
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ * Invalidate all slots of a table
+ *
+ * Only metadata of every slot is written, i.e. one cacheline per slot, and
+ * written with non-temporal stores, so that formatting neither reads the
+ * device (no RFO) nor thrashes LLC. Threads claim disjoint chunks of the table,
+ * and persist what they wrote before leaving.
+ *
+ * @param d slot table
+ * @param n number of slots
+ * @param is_pmem whether #d is persistent memory, see `pmem_is_pmem()`,
+ *      otherwise chunks are synced with `pmem_msync()`
+ * @param opt options
+ * @return 0 on success, otherwise negative errno of the first failed msync
+ */
+inline int format_table(dataslot *d, size_t n, bool is_pmem,
+        const table_format_options &opt = {})
+{
+    static_assert(sizeof(dataslot_meta) == 64_B);
+
+    return for_each_chunk(n, opt, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            pmem_memset(&d[i].meta, 0, sizeof(dataslot_meta),
+                PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+        if (!is_pmem && pmem_msync(d + begin, (end - begin) * sizeof(dataslot)))
+            [[unlikely]] return -errno;
+        return 0;
+    });
+}
+
+struct table_recovery_stats {
+    /** slots holding data of the current generation */
+    atomic<size_t> occupied = 0;
+    /** slots left locked by dead writers, with intact data, unlocked */
+    atomic<size_t> unlocked = 0;
+    /** slots left locked by dead writers amid writing, invalidated */
+    atomic<size_t> discarded = 0;
+};
+
+/**
+ * Recover a table of a former server run, keeping its data
+ *
+ * A writer dying between locking a slot and unlocking it leaves the lock bit
+ * set, blocking the key for good. Such a slot is unlocked if its checksum
+ * proves the data intact, i.e. the writer died before or right after writing,
+ * and invalidated if it died amid writing. Only metadata is read, except for
+ * slots found locked.
+ *
+ * @param d slot table
+ * @param n number of slots
+ * @param gen current generation of the table, slots of others are empty
+ * @param is_pmem see format_table()
+ * @param opt options
+ * @param[out] stats occupancy and repairs
+ * @param[out] occupancy zeroed bitmap of #n bits, bits of occupied slots are
+ *      set, see session::conn_reply::index
+ * @param[out] filter zeroed key filter, keys of occupied slots are counted in,
+ *      may be empty
+ * @return 0 on success, otherwise negative errno of the first failed msync
+ */
+inline int recover_table(dataslot *d, size_t n, uint8_t gen, bool is_pmem,
+        const table_format_options &opt, table_recovery_stats &stats,
+        uint64_t *occupancy, span<key_filter::block> filter)
+{
+    using flag_t = dataslot::meta_type::bits_flag;
+
+    /* chunks of whole bitmap words, no two threads set bits of the same one */
+    auto o = opt;
+    o.chunk_slots = (std::max<size_t>(o.chunk_slots, 1) + 63) / 64 * 64;
+    return for_each_chunk(n, o, [&] (size_t begin, size_t end) {
+        size_t occupied = 0, unlocked = 0, discarded = 0;
+        for (size_t i = begin; i < end; i++) {
+            auto &m = d[i].meta;
+            auto a = m.atomic;
+            if (!(a.m.bits & flag_t::valid) || a.m.generation != gen)
+                continue;
+            if (a.m.bits & flag_t::lock) {
+                [[unlikely]] if (d[i].data.checksum() == m.data_crc) {
+                    a.m.bits &= ~flag_t::lock;
+                    unlocked++;
+                }
+                else {
+                    a.u64 = 0;
+                    discarded++;
+                }
+                m.atomic.u64 = a.u64;
+                if (is_pmem)
+                    pmem_persist(&m.atomic, sizeof(m.atomic));
+                else if (pmem_msync(&m.atomic, sizeof(m.atomic)))
+                    [[unlikely]] return -errno;
+            }
+            if (!a.u64)
+                continue;
+            occupancy[i / 64] |= 1ul << (i % 64);
+            occupied++;
+            if (filter.empty())
+                continue;
+            /* blocks are shared among threads */
+            const auto p = key_filter::locate(m.key_fp, filter.size());
+            for (unsigned h = 0; h < key_filter::nr_hashes; h++)
+                atomic_ref<uint64_t>(filter[p.block].words[p.word(h)])
+                    .fetch_add(p.addend(h), memory_order_relaxed);
+        }
+        stats.occupied.fetch_add(occupied, memory_order_relaxed);
+        stats.unlocked.fetch_add(unlocked, memory_order_relaxed);
+        stats.discarded.fetch_add(discarded, memory_order_relaxed);
+        return 0;
+    });
+}
+
+}   /* namespace gestalt */
@@ -0,0 +1,94 @@
+/**
+ * @file bucket.cpp
+ * Unittest for spec/bucket
+ */
+
+#define BOOST_TEST_MODULE gestalt bucket
+#include <boost/test/unit_test.hpp>
+#include <sstream>
+#include <boost/property_tree/ini_parser.hpp>
+#include "spec/bucket.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+
+static boost::property_tree::ptree read_config(const char *ini)
+{
+    boost::property_tree::ptree config;
+    istringstream is(ini);
+    boost::property_tree::read_ini(is, config);
+    return config;
+}
+
+BOOST_AUTO_TEST_CASE(test_default_bucket) {
+    const auto buckets = bucket::parse(read_config(
+        "[global]\n"
+        "num_replicas = 2\n"));
+    BOOST_TEST(buckets.size() == 1);
+    BOOST_TEST(buckets[0].name == bucket::default_name);
+    BOOST_TEST(buckets[0].num_replicas == 2);
+    BOOST_TEST(buckets[0].persistent);
+    BOOST_TEST(buckets[0].placement == "modulo");
+
+    const auto e = bucket::partition(buckets, 1000);
+    BOOST_TEST(e.size() == 1);
+    BOOST_TEST(e[0].offset == 0);
+    BOOST_TEST(e[0].length == 1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_declared_buckets) {
+    const auto buckets = bucket::parse(read_config(
+        "[global]\n"
+        "num_replicas = 2\n"
+        "placement = jump\n"
+        "[bucket:small]\n"
+        "share = 1\n"
+        "search_length = 2\n"
+        "[bucket:cache]\n"
+        "share = 2\n"
+        "num_replicas = 1\n"
+        "persistence = none\n"
+        "placement = rendezvous\n"));
+    BOOST_TEST(buckets.size() == 2);
+    const auto &cache = bucket::find(buckets, "cache");
+    BOOST_TEST(cache.num_replicas == 1);
+    BOOST_TEST(!cache.persistent);
+    BOOST_TEST(cache.placement == "rendezvous");
+    BOOST_TEST(bucket::find(buckets, "small").search_length == 2);
+    /* global.placement is the default */
+    BOOST_TEST(bucket::find(buckets, "small").placement == "jump");
+    BOOST_CHECK_THROW(bucket::find(buckets, bucket::default_name), std::invalid_argument);
+
+    /* contiguous, by share, nothing left over */
+    const auto e = bucket::partition(buckets, 1001);
+    BOOST_TEST(e.size() == 2);
+    BOOST_TEST(e[0].offset == 0);
+    BOOST_TEST(e[0].length == 333);
+    BOOST_TEST(e[1].offset == 333);
+    BOOST_TEST(e[1].offset + e[1].length == 1001);
+
+    /* a server may serve some of them */
+    const auto one = bucket::partition({cache}, 1001);
+    BOOST_TEST(one.size() == 1);
+    BOOST_TEST(one[0].name == "cache");
+    BOOST_TEST(one[0].length == 1001);
+}
+
+BOOST_AUTO_TEST_CASE(test_malformed_bucket) {
+    BOOST_CHECK_THROW(bucket::parse(read_config(
+        "[global]\n"
+        "num_replicas = 2\n"
+        "[bucket:huge]\n"
+        "search_length = 100\n")), std::invalid_argument);
+    BOOST_CHECK_THROW(bucket::parse(read_config(
+        "[global]\n"
+        "num_replicas = 2\n"
+        "[bucket:x]\n"
+        "persistence = maybe\n")), std::invalid_argument);
+    BOOST_CHECK_THROW(bucket::parse(read_config(
+        "[global]\n"
+        "num_replicas = 2\n"
+        "[bucket:x]\n"
+        "placement = random\n")), std::invalid_argument);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file key_filter.cpp
+ * Unittest for spec/key_filter
+ */
+
+#define BOOST_TEST_MODULE gestalt spec key_filter
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <string>
+#include "spec/key_filter.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+
+static uint64_t fp_of(const string &k)
+{
+    return dataslot_key(k.c_str()).fingerprint();
+}
+
+BOOST_AUTO_TEST_CASE(test_locate) {
+    const auto p = key_filter::locate(fp_of("key"), 1000);
+    BOOST_TEST(p.block < 1000);
+    for (unsigned i = 0; i < key_filter::nr_hashes; i++) {
+        BOOST_TEST(p.counter[i] < key_filter::counters_per_block);
+        BOOST_TEST(p.word(i) < 8);
+    }
+    /* same key, same counters */
+    const auto q = key_filter::locate(fp_of("key"), 1000);
+    BOOST_TEST(p.block == q.block);
+    for (unsigned i = 0; i < key_filter::nr_hashes; i++)
+        BOOST_TEST(p.counter[i] == q.counter[i]);
+
+    /* the bitmap of a table takes whole blocks */
+    BOOST_TEST(key_filter::offset(1) == 64);
+    BOOST_TEST(key_filter::offset(512) == 64);
+    BOOST_TEST(key_filter::offset(513) == 128);
+}
+
+BOOST_AUTO_TEST_CASE(test_no_false_negative) {
+    constexpr size_t nr_blocks = 64, nr_keys = 256;
+    vector<key_filter::block> filter(nr_blocks);
+    for (size_t i = 0; i < nr_keys; i++) {
+        const auto p = key_filter::locate(fp_of("in" + to_string(i)), nr_blocks);
+        key_filter::add(filter[p.block], p);
+    }
+    for (size_t i = 0; i < nr_keys; i++) {
+        const auto p = key_filter::locate(fp_of("in" + to_string(i)), nr_blocks);
+        BOOST_TEST(key_filter::may_contain(filter[p.block], p));
+    }
+
+    /* 8 counters per key, most absent keys are told apart */
+    size_t positives = 0;
+    for (size_t i = 0; i < 10000; i++) {
+        const auto p = key_filter::locate(fp_of("out" + to_string(i)), nr_blocks);
+        positives += key_filter::may_contain(filter[p.block], p);
+    }
+    BOOST_TEST(positives < 10000 / 10);
+}
+
+BOOST_AUTO_TEST_CASE(test_counters_do_not_carry) {
+    key_filter::block b{};
+    key_filter::position p{ .block = 0, .counter = {3, 3, 4, 7} };
+    for (unsigned n = 0; n < 1000; n++)
+        key_filter::add(b, p);
+    BOOST_TEST(key_filter::count(b, p, 0) == 2000);
+    BOOST_TEST(key_filter::count(b, p, 2) == 1000);
+    BOOST_TEST(key_filter::count(b, p, 3) == 1000);
+    /* neighbours of word 0 untouched */
+    key_filter::position q{ .block = 0, .counter = {0, 1, 2, 5} };
+    BOOST_TEST(!key_filter::may_contain(b, q));
+}
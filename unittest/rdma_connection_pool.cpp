@@ -0,0 +1,60 @@
+/**
+ * @file rdma_connection_pool.cpp
+ * Unittest for internal/rdma_connection_pool memory_region
+ */
+
+#define BOOST_TEST_MODULE gestalt rdma connection pool
+#include <boost/test/unit_test.hpp>
+#include <unordered_map>
+#include "internal/rdma_connection_pool.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+using memory_region = RDMAConnectionPool::memory_region;
+
+
+BOOST_AUTO_TEST_CASE(test_mux_view) {
+    /* connections of a multiplexer, QPs are never operated on here */
+    auto owner = make_shared<memory_region>();
+    owner->addr = 0x10000;
+    owner->length = 64 * sizeof(dataslot);
+    owner->slots = 64;
+    owner->endpoints = 2;
+    for (uintptr_t q = 1; q <= 4; q++)
+        owner->qps.push_back(reinterpret_cast<rdma_cm_id*>(q));
+    const auto qps = owner->qps;
+
+    BOOST_TEST(!memory_region().connected());
+
+    /* a pool over views, as clients of the multiplexer build theirs */
+    unordered_map<unsigned, memory_region> pool;
+    for (unsigned id = 0; id < 3; id++)
+        pool.insert({id, memory_region(shared_ptr<const memory_region>(owner))});
+    owner.reset();
+
+    for (const auto &[id, mr] : pool) {
+        BOOST_TEST(mr.conns.empty());
+        BOOST_TEST(mr.connected());
+        BOOST_TEST(mr.qps == qps);
+        BOOST_TEST(mr.shared->qps == qps);
+        /* lanes route as on the multiplexer's own connections */
+        for (size_t i = 0; i < mr.slots; i++) {
+            const auto raddr = mr.addr + i * sizeof(dataslot);
+            BOOST_TEST(mr.atomic_lane(raddr) == i % qps.size());
+            BOOST_TEST(mr.index_lane(i) % mr.endpoints == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_lanes_for) {
+    /* rounded up to a multiple of endpoints */
+    BOOST_TEST(RDMAConnectionPool::lanes_for(1, 1, 4) == 1);
+    BOOST_TEST(RDMAConnectionPool::lanes_for(3, 2, 4) == 4);
+    BOOST_TEST(RDMAConnectionPool::lanes_for(1, 3, 4) == 3);
+    /* or down, if the server would reject lanes */
+    BOOST_TEST(RDMAConnectionPool::lanes_for(4, 3, 4) == 3);
+    BOOST_TEST(RDMAConnectionPool::lanes_for(8, 2, 5) == 4);
+    /* but one per endpoint at least */
+    BOOST_TEST(RDMAConnectionPool::lanes_for(1, 3, 2) == 3);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file single_flight.cpp
+ * Unittest for internal/single_flight
+ */
+
+#define BOOST_TEST_MODULE gestalt single flight
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include "internal/single_flight.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+
+BOOST_AUTO_TEST_CASE(test_board_depart_land) {
+    SingleFlight sf;
+    const okey k("user4242");
+    bool is_leader;
+
+    auto f = sf.board(k, is_leader);
+    BOOST_TEST(is_leader);
+    auto p = sf.board(k, is_leader);
+    BOOST_TEST(!is_leader);
+    BOOST_TEST(f == p);
+    BOOST_TEST(sf.coalesced == 1);
+
+    /* other keys fly on their own */
+    sf.board(okey("user4343"), is_leader);
+    BOOST_TEST(is_leader);
+
+    int passenger_r = 1;
+    std::jthread passenger([&] { passenger_r = p->wait(); });
+
+    /* departed flight takes no more passengers */
+    sf.depart(k, f);
+    auto n = sf.board(k, is_leader);
+    BOOST_TEST(is_leader);
+    BOOST_TEST(n != f);
+
+    const uint64_t v = 0x114514;
+    SingleFlight::land(*f, 0, &v, sizeof(v), 0, 1, 0);
+    passenger.join();
+    BOOST_TEST(passenger_r == 0);
+    BOOST_TEST(p->payload.size() == sizeof(v));
+    BOOST_TEST(*reinterpret_cast<const uint64_t*>(p->payload.data()) == v);
+
+    /* stale depart does not ground the new flight */
+    sf.depart(k, f);
+    sf.board(k, is_leader);
+    BOOST_TEST(!is_leader);
+}
+
+BOOST_AUTO_TEST_CASE(test_leader_throws) {
+    SingleFlight sf;
+    const okey k("user4242");
+    bool is_leader;
+
+    auto f = sf.board(k, is_leader);
+    auto p = sf.board(k, is_leader);
+    BOOST_TEST(!is_leader);
+
+    int passenger_r = 0;
+    std::jthread passenger([&] { passenger_r = p->wait(); });
+
+    /* passengers are let down, not left waiting */
+    BOOST_CHECK_THROW([&] {
+        const SingleFlight::leader_guard guard(sf, k, f);
+        throw std::runtime_error("READ failed");
+    }(), std::runtime_error);
+    passenger.join();
+    BOOST_TEST(passenger_r == -ECOMM);
+    BOOST_TEST(p->payload.empty());
+
+    /* ... and the key boards a new flight */
+    sf.board(k, is_leader);
+    BOOST_TEST(is_leader);
+
+    /* a landed flight is left alone */
+    const okey l("user4343");
+    auto g = sf.board(l, is_leader);
+    {
+        const SingleFlight::leader_guard guard(sf, l, g);
+        const uint64_t v = 0x114514;
+        sf.depart(l, g);
+        SingleFlight::land(*g, 0, &v, sizeof(v), 0, 1, 0);
+    }
+    BOOST_TEST(g->wait() == 0);
+    BOOST_TEST(g->payload.size() == sizeof(uint64_t));
+}
@@ -0,0 +1,62 @@
+/**
+ * @file submission_ring.cpp
+ * Unittest for internal/qp_mux SubmissionRing
+ */
+
+#define BOOST_TEST_MODULE gestalt submission ring
+#include <boost/test/unit_test.hpp>
+#include <thread>
+#include <vector>
+#include "internal/qp_mux.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+
+BOOST_AUTO_TEST_CASE(test_fifo_bounded) {
+    SubmissionRing<unsigned, 4> ring;
+    unsigned v;
+
+    BOOST_TEST(!ring.pop(v));
+    for (unsigned i = 0; i < 4; i++)
+        BOOST_TEST(ring.push(i));
+    BOOST_TEST(!ring.push(4));
+
+    /* wraps around */
+    for (unsigned round = 0; round < 3; round++) {
+        for (unsigned i = 0; i < 4; i++) {
+            BOOST_TEST(ring.pop(v));
+            BOOST_TEST(v == round * 4 + i);
+        }
+        BOOST_TEST(!ring.pop(v));
+        for (unsigned i = 0; i < 4; i++)
+            BOOST_TEST(ring.push((round + 1) * 4 + i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_producers) {
+    constexpr unsigned producers = 8, per_producer = 100000;
+    SubmissionRing<unsigned, 64> ring;
+    vector<unsigned> seen(producers * per_producer, 0);
+
+    {
+        vector<std::jthread> threads;
+        for (unsigned p = 0; p < producers; p++)
+            threads.emplace_back([&ring, p] {
+                for (unsigned i = 0; i < per_producer; i++)
+                    while (!ring.push(p * per_producer + i))
+                        std::this_thread::yield();
+            });
+
+        unsigned v;
+        for (unsigned got = 0; got < producers * per_producer; )
+            if (ring.pop(v)) {
+                seen.at(v)++;
+                got++;
+            }
+    }
+
+    /* every item delivered exactly once */
+    for (const auto &s : seen)
+        BOOST_REQUIRE(s == 1);
+}
@@ -0,0 +1,52 @@
+/**
+ * @file table_format.cpp
+ * Unittest for server/table_format
+ */
+
+#define BOOST_TEST_MODULE gestalt table format
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include "table_format.hpp"
+
+using namespace std;
+using namespace gestalt;
+
+
+BOOST_AUTO_TEST_CASE(test_split_table) {
+    /* every slot in exactly one chunk, no chunk empty */
+    for (size_t n : {1, 7, 10, 64, 1000, 1 << 20})
+        for (size_t max_chunks : {1, 2, 3, 7, 8}) {
+            const auto [chunk_slots, nr_chunks] = split_table(n, max_chunks);
+            BOOST_TEST(nr_chunks <= max_chunks);
+            BOOST_TEST((nr_chunks - 1) * chunk_slots < n);
+            BOOST_TEST(nr_chunks * chunk_slots >= n);
+        }
+
+    /* rounding up leaves fewer chunks than asked for */
+    const auto [chunk_slots, nr_chunks] = split_table(10, 8);
+    BOOST_TEST(chunk_slots == 2);
+    BOOST_TEST(nr_chunks == 5);
+    BOOST_TEST(split_table(3, 8).second == 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_small_table) {
+    /* fewer slots than a chunk, or than threads */
+    const size_t n = 10;
+    vector<dataslot> d(n);
+    table_format_options opt;
+    opt.nr_threads = 4;
+    opt.chunk_slots = 2;
+    for (auto &s : d)
+        s.meta.atomic.u64 = ~0ul;
+    BOOST_TEST(format_table(d.data(), n, /*is_pmem*/true, opt) == 0);
+    for (const auto &s : d)
+        BOOST_TEST(s.meta.atomic.u64 == 0);
+
+    d[3].reset("user3", "v", 1);
+    d[3].meta.atomic.m.generation = 1;
+    table_recovery_stats stats;
+    vector<uint64_t> occupancy(1);
+    BOOST_TEST(recover_table(d.data(), n, 1, true, opt, stats, occupancy.data(), {}) == 0);
+    BOOST_TEST(stats.occupied == 1);
+    BOOST_TEST(occupancy[0] == 1ul << 3);
+}
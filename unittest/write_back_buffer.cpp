@@ -0,0 +1,93 @@
+/**
+ * @file write_back_buffer.cpp
+ * Unittest for internal/write_back_buffer
+ */
+
+#define BOOST_TEST_MODULE gestalt write back buffer
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include "internal/write_back_buffer.hpp"
+
+using namespace std;
+using namespace gestalt;
+using namespace std::chrono_literals;
+
+
+BOOST_AUTO_TEST_CASE(test_window_and_staleness) {
+    WriteBackBuffer wb(10us, 50us, 16);
+    const auto t0 = WriteBackBuffer::clock::now();
+    map<string, uint64_t> remote;
+    const auto put_fn = [&] (const okey &k, const WriteBackBuffer::entry &e) {
+        remote[k.c_str()] = *reinterpret_cast<const uint64_t*>(e.value.data());
+        return 0;
+    };
+
+    /* updates within the window are merged */
+    for (uint64_t i = 0; i < 5; i++) {
+        wb.stage(okey("counter"), &i, sizeof(i), t0 + i * 5us);
+        BOOST_TEST(wb.drain(put_fn, false, t0 + i * 5us) == 0);
+    }
+    BOOST_TEST(remote.empty());
+    BOOST_TEST(wb.size() == 1);
+    BOOST_TEST(*reinterpret_cast<const uint64_t*>(wb.find(okey("counter"))->value.data()) == 4);
+
+    /* ... but not longer than max staleness */
+    for (uint64_t i = 5; i < 11; i++) {
+        wb.stage(okey("counter"), &i, sizeof(i), t0 + i * 5us);
+        wb.drain(put_fn, false, t0 + i * 5us);
+    }
+    BOOST_TEST(remote.at("counter") == 10);
+    BOOST_TEST(wb.empty());
+
+    /* quiet key is flushed after the window */
+    uint64_t v = 42;
+    wb.stage(okey("session"), &v, sizeof(v), t0);
+    wb.drain(put_fn, false, t0 + 9us);
+    BOOST_TEST(!remote.count("session"));
+    wb.drain(put_fn, false, t0 + 10us);
+    BOOST_TEST(remote.at("session") == 42);
+}
+
+BOOST_AUTO_TEST_CASE(test_flush_and_retry) {
+    WriteBackBuffer wb(1s, 1s, 2);
+    const auto t0 = WriteBackBuffer::clock::now();
+    int busy = 1;
+    unsigned written = 0;
+    const auto put_fn = [&] (const okey &, const WriteBackBuffer::entry &) {
+        if (busy-- > 0)
+            return -EBUSY;
+        written++;
+        return 0;
+    };
+
+    for (uint64_t i = 0; i < 3; i++)
+        wb.stage(okey("user" + to_string(i)), &i, sizeof(i), t0);
+    /* overflow flushes the oldest, which is busy and kept */
+    BOOST_TEST(wb.drain(put_fn, false, t0) == -EBUSY);
+    BOOST_TEST(wb.size() == 2);
+    BOOST_TEST(written == 1);
+
+    wb.discard(okey("user2"));
+    BOOST_TEST(wb.drain(put_fn, true, t0) == 0);
+    BOOST_TEST(wb.empty());
+    BOOST_TEST(written == 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_multi_slot_value) {
+    WriteBackBuffer wb(1s, 1s, 16);
+    const okey key("large");
+    const vector<uint8_t> value(dataslot::segment_type::capacity(key.size()) + 1, 0xa5);
+
+    /* refused up front, instead of failing on every write-back */
+    BOOST_CHECK_THROW(wb.stage(key, value.data(), value.size()), std::runtime_error);
+    BOOST_TEST(wb.empty());
+
+    wb.stage(key, value.data(), value.size() - 1);
+    BOOST_TEST(wb.size() == 1);
+
+    WriteBackBuffer large(1s, 1s, 16, 2);
+    large.stage(key, value.data(), value.size());
+    BOOST_TEST(large.find(key)->value.size() == value.size());
+}